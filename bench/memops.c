@@ -0,0 +1,82 @@
+// Compare loki_memcpy, loki_memmove and loki_memset against the C library.
+//
+// Each operation is timed on a single core for a range of sizes, with both
+// pointers line-aligned and with the source (or destination, for memset)
+// offset by a few bytes. Prints the average cost of one call in cycles.
+
+#include <loki/lokilib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ITERATIONS 8
+#define MAX_SIZE 4096
+#define OFFSET 3
+
+typedef void* (*copy_impl)(void*, const void*, size_t);
+typedef void* (*set_impl)(void*, int, size_t);
+
+static char source[MAX_SIZE + 32] __attribute__((aligned(32)));
+static char destination[MAX_SIZE + 32] __attribute__((aligned(32)));
+
+static unsigned long time_copy(copy_impl copy, char* dst, const char* src,
+                               size_t size) {
+  // Warm up the instruction and data caches.
+  copy(dst, src, size);
+
+  unsigned long start = get_cycle_count();
+  int i;
+  for (i = 0; i < ITERATIONS; i++)
+    copy(dst, src, size);
+  unsigned long end = get_cycle_count();
+
+  return (end - start) / ITERATIONS;
+}
+
+static unsigned long time_set(set_impl set, char* dst, size_t size) {
+  set(dst, 0x5a, size);
+
+  unsigned long start = get_cycle_count();
+  int i;
+  for (i = 0; i < ITERATIONS; i++)
+    set(dst, 0x5a, size);
+  unsigned long end = get_cycle_count();
+
+  return (end - start) / ITERATIONS;
+}
+
+int main(void) {
+  static const size_t sizes[] = {16, 64, 256, 1024, 4096};
+  static const uint offsets[] = {0, OFFSET};
+
+  uint i, j;
+  for (i = 0; i < sizeof(source); i++)
+    source[i] = i;
+
+  printf("operation,implementation,bytes,offset,cycles\n");
+
+  for (i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+    size_t size = sizes[i];
+
+    for (j = 0; j < sizeof(offsets)/sizeof(offsets[0]); j++) {
+      uint offset = offsets[j];
+
+      printf("memcpy,libc,%u,%u,%lu\n", (uint)size, offset,
+             time_copy(&memcpy, destination, source + offset, size));
+      printf("memcpy,loki,%u,%u,%lu\n", (uint)size, offset,
+             time_copy(&loki_memcpy, destination, source + offset, size));
+
+      // Overlapping, with the destination after the source.
+      printf("memmove,libc,%u,%u,%lu\n", (uint)size, offset,
+             time_copy(&memmove, destination + offset, destination, size));
+      printf("memmove,loki,%u,%u,%lu\n", (uint)size, offset,
+             time_copy(&loki_memmove, destination + offset, destination, size));
+
+      printf("memset,libc,%u,%u,%lu\n", (uint)size, offset,
+             time_set(&memset, destination + offset, size));
+      printf("memset,loki,%u,%u,%lu\n", (uint)size, offset,
+             time_set(&loki_memset, destination + offset, size));
+    }
+  }
+
+  return 0;
+}
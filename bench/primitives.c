@@ -0,0 +1,668 @@
+// Measure the cost of the runtime primitives the rest of the library builds on.
+//
+// Every measurement is printed as one CSV row:
+//
+//   primitive,cores,size,cycles
+//
+// `size` is the primitive's other parameter (iterations, array elements, bytes,
+// cache banks, prefetch distance, or 0 if there is none), and `cycles` is the
+// average cost of one operation: one barrier, one atomic operation or lock
+// handover, one launch, one iteration, one array element, one token, one
+// value through a dataflow graph, one transfer or one reconfiguration.
+// Rows for the same (primitive, cores, size) can be compared between library
+// versions to catch regressions.
+//
+// Results which can be checked against single-core code are. Any mismatch is
+// reported on stderr, and makes the program exit with status 1.
+
+#include <loki/lokilib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ITERATIONS 16
+#define FARM_ITERATIONS 1024
+#define PIPELINE_ITERATIONS 256
+#define DATAFLOW_VALUES 256
+#define MAX_TRANSFER_WORDS 256
+#define END_OF_STREAM -1
+
+static bool results_correct = true;
+
+static void report(const char* primitive, uint cores, uint size,
+                   unsigned long cycles) {
+  printf("%s,%u,%u,%lu\n", primitive, cores, size, cycles);
+}
+
+// Record whether a primitive gave the same result as single-core code.
+static void check(const char* primitive, uint cores, bool correct) {
+  if (!correct) {
+    fprintf(stderr, "%s on %u cores: wrong result\n", primitive, cores);
+    results_correct = false;
+  }
+}
+
+// Run a function on the first `cores` cores, and wait for all of them to
+// finish before starting the next measurement.
+static void run_on(uint cores, general_func func, const void* data,
+                   size_t data_size) {
+  distributed_func config = {
+    .cores     = cores,
+    .func      = func,
+    .data      = data,
+    .data_size = data_size
+  };
+  loki_execution handle = loki_execute_async(&config);
+  loki_execute_join(&handle);
+}
+
+static void do_nothing(const void* unused) {}
+static void do_nothing_iteration(int iteration, int core) {}
+static void do_nothing_stage(int iteration) {}
+
+
+//============================================================================//
+// Barriers
+//============================================================================//
+
+typedef struct {
+  uint cores;
+  bool tile;    // Use loki_tile_sync instead of loki_sync.
+} sync_args;
+
+static void sync_member(const void* data) {
+  const sync_args* args = data;
+
+  // Warm up the instruction caches.
+  if (args->tile) loki_tile_sync(args->cores);
+  else            loki_sync(args->cores);
+
+  unsigned long start = get_cycle_count();
+  int i;
+  for (i = 0; i < ITERATIONS; i++) {
+    if (args->tile) loki_tile_sync(args->cores);
+    else            loki_sync(args->cores);
+  }
+  unsigned long end = get_cycle_count();
+
+  if (get_tile_id() == int2tile(0) && get_core_id() == 0)
+    report(args->tile ? "loki_tile_sync" : "loki_sync", args->cores, 0,
+           (end - start) / ITERATIONS);
+}
+
+static void bench_sync(void) {
+  static const uint cores[] = {2, 4, 8, 16, 32, 64, 128};
+  uint i;
+
+  for (i = 0; i < sizeof(cores)/sizeof(cores[0]); i++) {
+    sync_args args = {.cores = cores[i], .tile = false};
+    run_on(cores[i], &sync_member, &args, sizeof(args));
+  }
+
+  for (i = 0; cores[i] <= CORES_PER_TILE; i++) {
+    sync_args args = {.cores = cores[i], .tile = true};
+    run_on(cores[i], &sync_member, &args, sizeof(args));
+  }
+}
+
+
+//============================================================================//
+// Atomics
+//============================================================================//
+
+enum atomic_kind {ATOMIC_COUNTER, ATOMIC_TICKET, ATOMIC_MCS, ATOMIC_BARRIER};
+
+typedef struct {
+  uint             cores;
+  enum atomic_kind kind;
+} atomic_args;
+
+static const char* atomic_names[] = {
+  "loki_atomic_fetch_add", "loki_ticket_lock", "loki_mcs_lock",
+  "loki_atomic_barrier"
+};
+
+static loki_atomic_counter atomic_counter;
+static loki_ticket_lock    ticket_lock;
+static loki_mcs_lock       mcs_lock;
+static loki_mcs_node       mcs_nodes[CORES_PER_TILE * COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS];
+static loki_atomic_barrier atomic_barrier;
+
+static void atomic_operation(enum atomic_kind kind, loki_mcs_node* node) {
+  switch (kind) {
+    case ATOMIC_COUNTER:
+      loki_atomic_fetch_add(&atomic_counter, 1);
+      break;
+    case ATOMIC_TICKET:
+      loki_ticket_lock_acquire(&ticket_lock);
+      loki_ticket_lock_release(&ticket_lock);
+      break;
+    case ATOMIC_MCS:
+      loki_mcs_lock_acquire(&mcs_lock, node);
+      loki_mcs_lock_release(&mcs_lock, node);
+      break;
+    case ATOMIC_BARRIER:
+      loki_atomic_barrier_wait(&atomic_barrier);
+      break;
+  }
+}
+
+// Every core performs the operation back-to-back, so all of them contend for
+// the same object the whole time.
+static void atomic_member(const void* data) {
+  const atomic_args* args = data;
+  loki_mcs_node* node =
+      &mcs_nodes[tile2int(get_tile_id()) * CORES_PER_TILE + get_core_id()];
+
+  atomic_operation(args->kind, node);
+  loki_sync(args->cores);
+
+  unsigned long start = get_cycle_count();
+  int i;
+  for (i = 0; i < ITERATIONS; i++)
+    atomic_operation(args->kind, node);
+  unsigned long end = get_cycle_count();
+
+  loki_sync(args->cores);
+
+  if (get_tile_id() == int2tile(0) && get_core_id() == 0)
+    report(atomic_names[args->kind], args->cores, 0, (end - start) / ITERATIONS);
+}
+
+// Each row is the average cost of one operation on one core, with every other
+// core doing the same. For the locks, one operation is an acquire and a release
+// with nothing in between.
+static void bench_atomics(void) {
+  static const uint cores[] = {1, 2, 8, 32, 128};
+  uint i, kind;
+
+  loki_atomic_init(&atomic_counter, 0);
+  loki_ticket_lock_init(&ticket_lock);
+  loki_mcs_lock_init(&mcs_lock);
+
+  for (kind = ATOMIC_COUNTER; kind <= ATOMIC_BARRIER; kind++) {
+    for (i = 0; i < sizeof(cores)/sizeof(cores[0]); i++) {
+      atomic_args args = {.cores = cores[i], .kind = kind};
+      loki_atomic_barrier_init(&atomic_barrier, cores[i]);
+      run_on(cores[i], &atomic_member, &args, sizeof(args));
+    }
+  }
+}
+
+
+//============================================================================//
+// Launch latency
+//============================================================================//
+
+// Both measurements include waiting for every core to finish, since that is
+// the only way to tell that they all started.
+static void bench_launch(void) {
+  static const uint cores[] = {2, 8, 32, 128};
+  uint i, j;
+
+  for (i = 0; i < sizeof(cores)/sizeof(cores[0]); i++) {
+    run_on(cores[i], &do_nothing, NULL, 0);
+
+    unsigned long start = get_cycle_count();
+    for (j = 0; j < ITERATIONS; j++)
+      run_on(cores[i], &do_nothing, NULL, 0);
+    unsigned long end = get_cycle_count();
+
+    report("loki_execute", cores[i], 0, (end - start) / ITERATIONS);
+  }
+
+  for (i = 0; i < sizeof(cores)/sizeof(cores[0]); i++) {
+    loop_config config = {
+      .cores      = cores[i],
+      .iterations = cores[i],
+      .iteration  = &do_nothing_iteration
+    };
+    simd_loop(&config);
+
+    unsigned long start = get_cycle_count();
+    for (j = 0; j < ITERATIONS; j++)
+      simd_loop(&config);
+    unsigned long end = get_cycle_count();
+
+    report("simd_loop", cores[i], 0, (end - start) / ITERATIONS);
+  }
+}
+
+
+//============================================================================//
+// Worker farm
+//============================================================================//
+
+static void bench_worker_farm(void) {
+  static const uint cores[] = {8, 32, 128};
+  uint i;
+
+  for (i = 0; i < sizeof(cores)/sizeof(cores[0]); i++) {
+    loop_config config = {
+      .cores      = cores[i],
+      .iterations = FARM_ITERATIONS,
+      .iteration  = &do_nothing_iteration
+    };
+    worker_farm(&config);
+
+    unsigned long start = get_cycle_count();
+    worker_farm(&config);
+    unsigned long end = get_cycle_count();
+
+    report("worker_farm", cores[i], FARM_ITERATIONS,
+           (end - start) / FARM_ITERATIONS);
+  }
+}
+
+
+//============================================================================//
+// Pipelines
+//============================================================================//
+
+static pipeline_func pipeline_stages[CORES_PER_TILE] = {
+  &do_nothing_stage, &do_nothing_stage, &do_nothing_stage, &do_nothing_stage,
+  &do_nothing_stage, &do_nothing_stage, &do_nothing_stage, &do_nothing_stage
+};
+
+static int dd_first_stage(int arg) {
+  return (arg == PIPELINE_ITERATIONS) ? END_OF_STREAM : arg;
+}
+
+static int dd_middle_stage(int arg) {
+  return arg;
+}
+
+// Data driven pipelines are also measured across several tiles.
+static dd_pipeline_func dd_stages[4 * CORES_PER_TILE] = {
+  [0] = &dd_first_stage,
+  [1 ... 4 * CORES_PER_TILE - 1] = &dd_middle_stage
+};
+
+static void bench_pipelines(void) {
+  static const uint cores[] = {2, 4, 8};
+  static const uint dd_cores[] = {2, 4, 8, 16, 32};
+  uint i;
+
+  for (i = 0; i < sizeof(cores)/sizeof(cores[0]); i++) {
+    pipeline_config config = {
+      .cores      = cores[i],
+      .iterations = PIPELINE_ITERATIONS,
+      .stage_func = pipeline_stages
+    };
+    pipeline_loop(&config);
+
+    unsigned long start = get_cycle_count();
+    pipeline_loop(&config);
+    unsigned long end = get_cycle_count();
+
+    report("pipeline_loop", cores[i], PIPELINE_ITERATIONS,
+           (end - start) / PIPELINE_ITERATIONS);
+  }
+
+  for (i = 0; i < sizeof(dd_cores)/sizeof(dd_cores[0]); i++) {
+    dd_pipeline_config config = {
+      .cores               = dd_cores[i],
+      .end_of_stream_token = END_OF_STREAM,
+      .stage_tasks         = dd_stages
+    };
+    dd_pipeline_loop(&config);
+
+    unsigned long start = get_cycle_count();
+    dd_pipeline_loop(&config);
+    unsigned long end = get_cycle_count();
+
+    report("dd_pipeline_loop", dd_cores[i], PIPELINE_ITERATIONS,
+           (end - start) / PIPELINE_ITERATIONS);
+  }
+}
+
+
+//============================================================================//
+// Dataflow
+//============================================================================//
+
+static dataflow_graph dataflow;
+static int dataflow_next;
+static int dataflow_sum;
+
+static bool dataflow_source(const int* inputs, int* outputs) {
+  if (dataflow_next == DATAFLOW_VALUES)
+    return false;
+  outputs[0] = dataflow_next++;
+  return true;
+}
+
+static bool dataflow_increment(const int* inputs, int* outputs) {
+  outputs[0] = inputs[0] + 1;
+  return true;
+}
+
+static bool dataflow_sink(const int* inputs, int* outputs) {
+  dataflow_sum += inputs[0];
+  return true;
+}
+
+// A chain of nodes which each add 1, from a source on core 1 to a sink on this
+// core. With more than one tile, the chain passes through core 0 of the other
+// tiles, which also receive the tokens joining the execution.
+static void bench_dataflow(void) {
+  static const uint cores[] = {4, 8, 16, 32};
+  uint i;
+
+  for (i = 0; i < sizeof(cores)/sizeof(cores[0]); i++) {
+    dataflow_graph_init(&dataflow, END_OF_STREAM);
+    dataflow_graph_add_function(&dataflow, &dataflow_sink, 1, 0);
+    dataflow_graph_add_function(&dataflow, &dataflow_source, 0, 1);
+
+    uint node;
+    for (node = 2; node < cores[i]; node++) {
+      dataflow_graph_add_function(&dataflow, &dataflow_increment, 1, 1);
+      dataflow_graph_connect(&dataflow, node - 1, 0, node, 0);
+    }
+    dataflow_graph_connect(&dataflow, cores[i] - 1, 0, 0, 0);
+
+    dataflow_next = 0;
+    dataflow_sum = 0;
+
+    unsigned long start = get_cycle_count();
+    dataflow_graph_run(&dataflow);
+    unsigned long end = get_cycle_count();
+
+    report("dataflow_graph_run", cores[i], DATAFLOW_VALUES,
+           (end - start) / DATAFLOW_VALUES);
+
+    // Each value passes through every node between the source and the sink.
+    const int increments = cores[i] - 2;
+    const int expected = DATAFLOW_VALUES * (DATAFLOW_VALUES - 1) / 2
+                       + DATAFLOW_VALUES * increments;
+    check("dataflow_graph_run", cores[i], dataflow_sum == expected);
+  }
+}
+
+
+//============================================================================//
+// Prefetching
+//============================================================================//
+
+#define STREAM_WORDS 8192
+
+static int stream_data[STREAM_WORDS];
+static int stream_sums[CORES_PER_TILE];
+
+static void stream_iteration(int iteration, int core) {
+  stream_sums[core] += stream_data[iteration];
+}
+
+// Each row is a distance in iterations; 0 is without prefetching. The array
+// is flushed and invalidated before each run so every line misses.
+static void bench_prefetch(void) {
+  static const int distances[] = {0, 8, 32, 128};
+  uint i;
+
+  for (i = 0; i < sizeof(distances)/sizeof(distances[0]); i++) {
+    loop_config config = {
+      .cores      = CORES_PER_TILE,
+      .iterations = STREAM_WORDS,
+      .iteration  = &stream_iteration,
+      .schedule   = LOOP_SCHEDULE_BLOCKED,
+      .prefetch   = {{
+        .base     = (distances[i] > 0) ? stream_data : NULL,
+        .stride   = sizeof(int),
+        .distance = distances[i]
+      }}
+    };
+
+    loki_channel_flush_data(1, stream_data, sizeof(stream_data));
+    loki_channel_invalidate_data(1, stream_data, sizeof(stream_data));
+
+    unsigned long start = get_cycle_count();
+    simd_loop(&config);
+    unsigned long end = get_cycle_count();
+
+    report("simd_loop_prefetch", CORES_PER_TILE, distances[i],
+           (end - start) / STREAM_WORDS);
+  }
+}
+
+
+//============================================================================//
+// Algorithms
+//============================================================================//
+
+#define ALGORITHM_WORDS 16384
+#define HISTOGRAM_BINS 256
+
+static int32_t algorithm_input[ALGORITHM_WORDS] __attribute__((aligned(32)));
+static int32_t algorithm_output[ALGORITHM_WORDS] __attribute__((aligned(32)));
+static int32_t algorithm_scratch[ALGORITHM_WORDS] __attribute__((aligned(32)));
+static int32_t algorithm_expected[ALGORITHM_WORDS] __attribute__((aligned(32)));
+static uint32_t algorithm_counts[HISTOGRAM_BINS] __attribute__((aligned(32)));
+static uint32_t algorithm_expected_counts[HISTOGRAM_BINS];
+
+static int xor_combine(int a, int b) {
+  return a ^ b;
+}
+
+static int compare_ints(const void* a, const void* b) {
+  const int32_t x = *(const int32_t*)a, y = *(const int32_t*)b;
+  return (x > y) - (x < y);
+}
+
+// Fill `data` with pseudo-random values. `mask` limits their range.
+static void algorithm_fill(int32_t* data, uint32_t mask) {
+  uint32_t state = 12345;
+  int i;
+  for (i = 0; i < ALGORITHM_WORDS; i++) {
+    state = state * 1103515245 + 12345;
+    data[i] = (int32_t)(state & mask);
+  }
+}
+
+static void report_algorithm(const char* primitive, uint cores,
+                             unsigned long start, unsigned long end) {
+  report(primitive, cores, ALGORITHM_WORDS, (end - start) / ALGORITHM_WORDS);
+}
+
+static bool words_equal(const void* a, const void* b, size_t words) {
+  return memcmp(a, b, words * sizeof(int32_t)) == 0;
+}
+
+// Each algorithm is measured once on plain single-core code, then on 8, 32
+// and 128 cores. Rows give cycles per element. Every parallel result is
+// checked against the single-core one, which covers the paths which keep
+// memory coherent between tiles.
+static void bench_algorithms(void) {
+  static const uint cores[] = {8, 32, 128};
+  unsigned long start, end;
+  int32_t value = 0;
+  uint i;
+  int j;
+
+  // Reduction.
+  algorithm_fill(algorithm_input, 0xFFFF);
+  start = get_cycle_count();
+  for (j = 0; j < ALGORITHM_WORDS; j++)
+    value = xor_combine(value, algorithm_input[j]);
+  end = get_cycle_count();
+  asm ("" : : "r" (value));  // Keep the loop
+  report_algorithm("serial_reduce", 1, start, end);
+
+  for (i = 0; i < sizeof(cores)/sizeof(cores[0]); i++) {
+    start = get_cycle_count();
+    const int32_t result =
+        loki_parallel_reduce(cores[i], algorithm_input, ALGORITHM_WORDS,
+                             LOOP_REDUCE_CUSTOM, &xor_combine, 0);
+    end = get_cycle_count();
+    report_algorithm("loki_parallel_reduce", cores[i], start, end);
+    check("loki_parallel_reduce", cores[i], result == value);
+  }
+
+  // Prefix sum.
+  start = get_cycle_count();
+  value = 0;
+  for (j = 0; j < ALGORITHM_WORDS; j++) {
+    value += algorithm_input[j];
+    algorithm_expected[j] = value;
+  }
+  end = get_cycle_count();
+  report_algorithm("serial_scan", 1, start, end);
+
+  for (i = 0; i < sizeof(cores)/sizeof(cores[0]); i++) {
+    start = get_cycle_count();
+    const int32_t total =
+        loki_parallel_scan(cores[i], algorithm_output, algorithm_input,
+                           ALGORITHM_WORDS);
+    end = get_cycle_count();
+    report_algorithm("loki_parallel_scan", cores[i], start, end);
+    check("loki_parallel_scan", cores[i], total == value &&
+          words_equal(algorithm_output, algorithm_expected, ALGORITHM_WORDS));
+  }
+
+  // Histogram.
+  algorithm_fill(algorithm_input, HISTOGRAM_BINS - 1);
+  start = get_cycle_count();
+  for (j = 0; j < HISTOGRAM_BINS; j++)
+    algorithm_expected_counts[j] = 0;
+  for (j = 0; j < ALGORITHM_WORDS; j++)
+    algorithm_expected_counts[algorithm_input[j]]++;
+  end = get_cycle_count();
+  report_algorithm("serial_histogram", 1, start, end);
+
+  for (i = 0; i < sizeof(cores)/sizeof(cores[0]); i++) {
+    start = get_cycle_count();
+    loki_parallel_histogram(cores[i], algorithm_counts, HISTOGRAM_BINS,
+                            algorithm_input, ALGORITHM_WORDS);
+    end = get_cycle_count();
+    report_algorithm("loki_parallel_histogram", cores[i], start, end);
+    check("loki_parallel_histogram", cores[i],
+          words_equal(algorithm_counts, algorithm_expected_counts,
+                      HISTOGRAM_BINS));
+  }
+
+  // Sort. The input is refilled before each run.
+  algorithm_fill(algorithm_expected, 0xFFFFFFFF);
+  start = get_cycle_count();
+  qsort(algorithm_expected, ALGORITHM_WORDS, sizeof(int32_t), &compare_ints);
+  end = get_cycle_count();
+  report_algorithm("qsort", 1, start, end);
+
+  for (i = 0; i < sizeof(cores)/sizeof(cores[0]); i++) {
+    algorithm_fill(algorithm_output, 0xFFFFFFFF);
+    start = get_cycle_count();
+    loki_parallel_sort(cores[i], algorithm_output, algorithm_scratch,
+                       ALGORITHM_WORDS);
+    end = get_cycle_count();
+    report_algorithm("loki_parallel_sort", cores[i], start, end);
+    check("loki_parallel_sort", cores[i],
+          words_equal(algorithm_output, algorithm_expected, ALGORITHM_WORDS));
+  }
+}
+
+
+//============================================================================//
+// Network bandwidth
+//============================================================================//
+
+typedef struct {
+  uint bytes;
+  bool unaligned;   // Send with loki_send_data from a misaligned buffer.
+} transfer_args;
+
+static int transfer_buffer[MAX_TRANSFER_WORDS + 1];
+
+// Core 0 sends ITERATIONS back-to-back transfers to core 1, which sends a
+// token back once it has received them all.
+static void transfer_member(const void* data) {
+  const transfer_args* args = data;
+
+  if (get_core_id() == 0) {
+    const char* source = (const char*)transfer_buffer + (args->unaligned ? 1 : 0);
+    set_channel_map(2, loki_mcast_address(single_core_bitmask(1), 3, false));
+
+    unsigned long start = get_cycle_count();
+    int i;
+    for (i = 0; i < ITERATIONS; i++) {
+      if (args->unaligned)
+        loki_send_data(source, args->bytes, 2);
+      else
+        loki_send_words(transfer_buffer, args->bytes / 4, 2);
+    }
+    loki_receive_token(CH_REGISTER_3);
+    unsigned long end = get_cycle_count();
+
+    report(args->unaligned ? "loki_send_data" : "loki_send_words", 2,
+           args->bytes, (end - start) / ITERATIONS);
+  }
+  else {
+    int buffer[MAX_TRANSFER_WORDS];
+    int i;
+    for (i = 0; i < ITERATIONS; i++)
+      loki_receive_data(buffer, args->bytes, CH_REGISTER_3);
+
+    set_channel_map(2, loki_mcast_address(single_core_bitmask(0), 3, false));
+    loki_send_token(2);
+  }
+}
+
+static void bench_transfers(void) {
+  static const uint bytes[] = {32, 256, 4 * MAX_TRANSFER_WORDS};
+  uint i;
+
+  for (i = 0; i < sizeof(bytes)/sizeof(bytes[0]); i++) {
+    transfer_args args = {.bytes = bytes[i], .unaligned = false};
+    run_on(2, &transfer_member, &args, sizeof(args));
+
+    args.unaligned = true;
+    run_on(2, &transfer_member, &args, sizeof(args));
+  }
+}
+
+
+//============================================================================//
+// Cache reconfiguration
+//============================================================================//
+
+// All other cores are idle between measurements, as reconfiguration requires.
+static void bench_reconfigure(void) {
+  loki_memory_cache_reconfigure(loki_memory_cache_configuration_id8);
+
+  unsigned long start = get_cycle_count();
+  int i;
+  for (i = 0; i < ITERATIONS; i++)
+    loki_memory_cache_reconfigure(loki_memory_cache_configuration_id8);
+  unsigned long end = get_cycle_count();
+
+  report("loki_memory_cache_reconfigure", 1, 8, (end - start) / ITERATIONS);
+
+  // Alternate between 8 and 4 banks, so half of the cache is flushed and
+  // handed back each time.
+  start = get_cycle_count();
+  for (i = 0; i < ITERATIONS; i++)
+    loki_memory_cache_reconfigure((i & 1) ? loki_memory_cache_configuration_id8
+                                          : loki_memory_cache_configuration_id4);
+  end = get_cycle_count();
+
+  report("loki_memory_cache_reconfigure", 1, 4, (end - start) / ITERATIONS);
+
+  loki_memory_cache_reconfigure(loki_memory_cache_configuration_id8);
+}
+
+
+int main(void) {
+  loki_init_default(128, NULL);
+
+  printf("primitive,cores,size,cycles\n");
+
+  bench_sync();
+  bench_atomics();
+  bench_launch();
+  bench_worker_farm();
+  bench_pipelines();
+  bench_dataflow();
+  bench_prefetch();
+  bench_algorithms();
+  bench_transfers();
+  bench_reconfigure();
+
+  return results_correct ? 0 : 1;
+}
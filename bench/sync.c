@@ -0,0 +1,118 @@
+// Compare loki_sync's tree barrier against the linear token chain it replaced.
+//
+// Each configuration performs a number of back-to-back barriers on all cores,
+// and core 0 reports the average cost of one barrier in cycles.
+
+#include <loki/lokilib.h>
+#include <stdio.h>
+
+#define ITERATIONS 16
+
+typedef void (*sync_impl)(const uint cores);
+
+typedef struct {
+  const char *name;
+  sync_impl   sync;
+  uint        cores;
+} sync_bench;
+
+// The original barrier: core N waits for core N+1, and tile 0 then sends one
+// unicast token to each tile in turn.
+static void chain_sync_tiles(const uint tiles) {
+  uint tile = tile2int(get_tile_id());
+
+  if (tile < tiles-1)
+    loki_receive_token(CH_REGISTER_7);
+
+  if (tile > 0) {
+    int address = loki_core_address(int2tile(tile-1), 0, CH_REGISTER_7,
+                                    INFINITE_CREDIT_COUNT);
+    set_channel_map(2, address);
+    loki_send_token(2);
+    loki_receive_token(CH_REGISTER_7);
+  } else {
+    uint destination;
+    for (destination = 1; destination < tiles; destination++) {
+      int address = loki_core_address(int2tile(destination), 0, CH_REGISTER_7,
+                                      INFINITE_CREDIT_COUNT);
+      set_channel_map(2, address);
+      loki_send_token(2);
+    }
+  }
+}
+
+static void chain_sync(const uint cores) {
+  uint core = get_core_id();
+  uint coresThisTile = cores_this_tile(cores, get_tile_id(), tile_id(1, 1));
+
+  if (core < coresThisTile-1)
+    loki_receive_token(CH_REGISTER_3);
+
+  if (core > 0) {
+    int address = loki_mcast_address(single_core_bitmask(core-1),
+                                     CH_REGISTER_3, false);
+    set_channel_map(2, address);
+    loki_send_token(2);
+    loki_receive_token(CH_REGISTER_3);
+  } else {
+    if (cores > CORES_PER_TILE)
+      chain_sync_tiles(num_tiles(cores));
+
+    if (coresThisTile > 1) {
+      int address = loki_mcast_address(all_cores_except_0(coresThisTile),
+                                       CH_REGISTER_3, false);
+      set_channel_map(2, address);
+      loki_send_token(2);
+    }
+  }
+}
+
+static void tree_sync(const uint cores) {
+  loki_sync(cores);
+}
+
+static void run_bench(const void *data) {
+  const sync_bench *bench = data;
+
+  // Warm up the instruction caches.
+  bench->sync(bench->cores);
+
+  unsigned long start = get_cycle_count();
+  int i;
+  for (i = 0; i < ITERATIONS; i++)
+    bench->sync(bench->cores);
+  unsigned long end = get_cycle_count();
+
+  if (get_unique_core_id() == make_unique_core_id(tile_id(1, 1), 0))
+    printf("%s,%u,%lu\n", bench->name, bench->cores,
+           (end - start) / ITERATIONS);
+}
+
+int main(void) {
+  static const uint core_counts[] = {8, 32, 128};
+  static sync_bench benches[] = {
+    {.name = "chain", .sync = &chain_sync},
+    {.name = "tree",  .sync = &tree_sync}
+  };
+
+  loki_init_default(128, NULL);
+
+  printf("barrier,cores,cycles\n");
+
+  uint i, j;
+  for (i = 0; i < sizeof(core_counts)/sizeof(core_counts[0]); i++) {
+    for (j = 0; j < sizeof(benches)/sizeof(benches[0]); j++) {
+      benches[j].cores = core_counts[i];
+
+      distributed_func config = {
+        .cores     = core_counts[i],
+        .func      = &run_bench,
+        .data      = &benches[j],
+        .data_size = sizeof(sync_bench)
+      };
+      loki_execute(&config);
+    }
+  }
+
+  return 0;
+}
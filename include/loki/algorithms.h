@@ -0,0 +1,81 @@
+/*! \file algorithms.h
+ * \brief Parallel reduction, prefix sum, histogram and sort over arrays.
+ *
+ * Each algorithm is one or more \ref simd_loop phases. Every core takes one
+ * contiguous block of the input. Blocks are whole cache lines, and
+ * consecutive cores take consecutive blocks, so each tile works on one
+ * contiguous part of the array. Results from each core are combined in the
+ * network where they fit in one word, and otherwise through per-core tables
+ * that the next phase reads.
+ *
+ * When `cores` spans more than one tile, inputs are flushed to main memory
+ * first, other tiles refetch the blocks they read, and outputs are flushed
+ * back before the function returns. Output arrays must then be line-aligned
+ * so that no line is written by two tiles, and no tile other than this one
+ * may hold modified copies of any of the arrays.
+ *
+ * \warning All functions must be executed on core 0 of tile 0. They have the
+ * same channel map table requirements as \ref simd_loop, and allocate their
+ * tables with \ref loki_malloc.
+ */
+
+#ifndef LOKI_ALGORITHMS_H_
+#define LOKI_ALGORITHMS_H_
+
+#include <loki/patterns/loop.h>
+#include <loki/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//! \brief Combine all elements of an array.
+//!
+//! \param op \ref LOOP_REDUCE_SUM, \ref LOOP_REDUCE_MIN or \ref LOOP_REDUCE_MAX
+//!        use the vector_ops.h kernels. \ref LOOP_REDUCE_CUSTOM folds each
+//!        core's block with `combine`, then combines the cores' results in the
+//!        network.
+//! \param combine Associative and commutative function, for
+//!        \ref LOOP_REDUCE_CUSTOM.
+//! \param identity Value for which `combine(identity, x) == x`, for
+//!        \ref LOOP_REDUCE_CUSTOM. Returned for an empty array.
+int32_t loki_parallel_reduce(uint cores, const int32_t* a, size_t n,
+                             enum loop_reduce_op op, combine_func combine,
+                             int32_t identity);
+
+//! \brief Inclusive prefix sum: `dst[i] = a[0] + ... + a[i]`.
+//!
+//! Each core first sums its block. The sums are combined in the network to
+//! give the total, and core 0 computes each block's starting offset from
+//! them. Each core then scans its block from its offset. `dst` may be `a`.
+//!
+//! \return The sum of all elements.
+int32_t loki_parallel_scan(uint cores, int32_t* dst, const int32_t* a,
+                           size_t n);
+
+//! \brief Count the elements of an array with each value from 0 to `bins - 1`.
+//!
+//! Each core counts its block into a table of its own. Then the bins are
+//! divided between the cores, and each adds up its bins in every core's table.
+//! Values outside the range are ignored.
+//!
+//! \param counts Array of `bins` counters, overwritten with the result.
+void loki_parallel_histogram(uint cores, uint32_t* counts, uint bins,
+                             const int32_t* a, size_t n);
+
+//! \brief Sort an array into ascending order.
+//!
+//! Radix sort, 8 bits at a time. Each of the four passes has the cores count
+//! the digits in their blocks, convert the counts to positions (each core
+//! handling some of the digits), then move their elements to those positions.
+//! The sort is stable.
+//!
+//! \param data Array to sort in place.
+//! \param scratch Array of `n` elements which is overwritten.
+//!
+//! \remark When `cores` spans more than one tile, elements are written to
+//! their new positions with uncached stores, since every tile writes all over
+//! both arrays. `data` and `scratch` must then both be line-aligned, and no
+//! other data may share their last lines: a cached copy of a shared line
+//! would overwrite the elements stored there.
+void loki_parallel_sort(uint cores, int32_t* data, int32_t* scratch, size_t n);
+
+#endif
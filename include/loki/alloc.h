@@ -15,12 +15,89 @@ void loki_free(void* ptr);
 //! This version differs from the standard malloc in that it ensures that 
 //! no two allocations can ever share a cache line, reducing the risk of false
 //! sharing in Loki's incoherent memory system.
+//!
+//! Only safe on tile 0. Use \ref loki_private_malloc elsewhere.
 void* loki_malloc(size_t size);
 
 //! \brief Allocate and zero-initialise an array.
 void* loki_calloc (size_t num, size_t size);
 
 //! \brief Change the size of the memory block pointed to by `ptr`.
+//!
+//! The same pointer is returned if the block is already large enough.
+//! Otherwise, a new block is allocated with \ref loki_malloc, so is also
+//! line-aligned, and only the current contents of the block are copied to it.
 void* loki_realloc (void* ptr, size_t size);
 
+//! \brief Allocate a block of memory from this core's private heap.
+//!
+//! Each core is given a private region of `heap_size` bytes by \ref loki_init
+//! (see \ref init_config), so allocation is safe on any tile and needs no
+//! communication. `heap_size` must be non-zero: \ref loki_init_default
+//! reserves no heaps.
+//!
+//! Requests of up to 64 bytes are served from pools of 4, 8, 16, 32 and 64 byte
+//! objects. Objects smaller than a cache line share lines with each other, so
+//! must only be accessed by the allocating core. All other allocations are
+//! whole, aligned cache lines, and may be shared as safely as blocks from
+//! \ref loki_malloc.
+//!
+//! \return NULL if this core's heap has no space left.
+void* loki_private_malloc(size_t size);
+
+//! \brief Return a block allocated by \ref loki_private_malloc to this core's
+//! private heap.
+//!
+//! Must be executed by the core which allocated the block.
+void loki_private_free(void* ptr);
+
+//! \brief Change the size of a block allocated by \ref loki_private_malloc.
+//!
+//! Blocks of more than 64 bytes shrink in place, and grow in place when the
+//! following pages of the heap are free. Otherwise, only the current contents
+//! of the block are copied to the new one. Must be executed by the core which
+//! allocated the block.
+//!
+//! \return NULL if there was not enough space, in which case `ptr` is still
+//! valid.
+void* loki_private_realloc(void* ptr, size_t size);
+
+//! \brief A bump-pointer allocator for temporary data.
+//!
+//! Allocation just advances a pointer, and all allocations are released
+//! together by \ref loki_arena_reset. Useful for data which lives for one phase
+//! of a computation.
+typedef struct {
+  char *base;         //!< Start of the arena's memory.
+  char *next;         //!< Next free byte.
+  char *end;          //!< End of the arena's memory.
+} loki_arena;
+
+//! \brief Create an arena of `size` bytes in this core's private heap.
+//!
+//! \return 0 on success, or -1 if there was not enough space.
+int loki_arena_init(loki_arena* arena, size_t size);
+
+//! \brief Release an arena's memory back to this core's private heap.
+void loki_arena_free(loki_arena* arena);
+
+//! \brief Allocate `size` bytes, aligned to 8 bytes, from an arena.
+//!
+//! \return NULL if the arena is full.
+static inline void* loki_arena_alloc(loki_arena* arena, size_t size) {
+  char *result = arena->next;
+  size = (size + 7) & ~7;
+
+  if (size > (size_t)(arena->end - result))
+    return NULL;
+
+  arena->next = result + size;
+  return result;
+}
+
+//! \brief Release all allocations from an arena at once.
+static inline void loki_arena_reset(loki_arena* arena) {
+  arena->next = arena->base;
+}
+
 #endif
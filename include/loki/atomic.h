@@ -0,0 +1,244 @@
+/*! \file atomic.h
+ * \brief Locks, barriers and counters in memory, for any set of cores on any
+ * tiles.
+ *
+ * Every object here is accessed only with uncached memory operations, which go
+ * straight to main memory (see \ref loki_uncached_memory_channel), so they are
+ * coherent across the whole chip. None of them reserve channel map table
+ * entries or input channels: each operation borrows entry 2 and receives its
+ * result on `CH_REGISTER_2`, like any other memory access. Objects can
+ * therefore be used by arbitrary groups of cores, including cores on tiles
+ * running other patterns.
+ *
+ * Each object fills whole cache lines, and must never be accessed through a
+ * cache: a write-back of a stale copy would overwrite it.
+ *
+ * The objects only order their own accesses. Data which a lock or barrier
+ * protects, and which is cached on more than one tile, still needs the usual
+ * coherence steps: flush it before releasing the lock (or arriving at the
+ * barrier), and invalidate it after acquiring the lock (or leaving the
+ * barrier).
+ *
+ * Costs are given in uncached memory round trips, "R", which dominate
+ * everything else. `bench/primitives.c` measures them in cycles under
+ * contention.
+ */
+
+#ifndef LOKI_ATOMIC_H_
+#define LOKI_ATOMIC_H_
+
+#include <loki/channel_io.h>
+#include <loki/channel_map_table.h>
+#include <loki/control_registers.h>
+#include <loki/types.h>
+#include <stdbool.h>
+
+//! \brief A memory channel like entry 1, but which sends all requests straight
+//! to main memory, skipping the L1 and L2.
+static inline channel_t loki_uncached_memory_channel(void) {
+  return get_channel_map(1) | (1 << 14) | (1 << 13);
+}
+
+//! Wait for about `cycles` cycles without touching memory.
+static inline void loki_atomic_pause(const uint cycles) {
+  const uint until = get_cycle_count() + cycles;
+  while ((int)(get_cycle_count() - until) < 0)
+    ;
+}
+
+//============================================================================//
+// Counters
+//============================================================================//
+
+//! A word which is only ever accessed atomically.
+typedef struct {
+  volatile int value;
+} __attribute__((aligned(32))) loki_atomic_counter;
+
+//! \brief Read a counter.
+//!
+//! \remark 1R, whatever the contention.
+static inline int loki_atomic_load(loki_atomic_counter* counter) {
+  set_channel_map(2, loki_uncached_memory_channel());
+  loki_channel_load_word(2, (void*)&counter->value);
+  return loki_receive(CH_REGISTER_2);
+}
+
+//! \brief Write a counter.
+//!
+//! \remark Does not wait for the store to complete.
+static inline void loki_atomic_store(loki_atomic_counter* counter, int value) {
+  set_channel_map(2, loki_uncached_memory_channel());
+  loki_channel_store_word(2, (void*)&counter->value, value);
+}
+
+//! Set a counter's initial value. Equivalent to \ref loki_atomic_store.
+static inline void loki_atomic_init(loki_atomic_counter* counter, int value) {
+  loki_atomic_store(counter, value);
+}
+
+//! \brief Add to a counter, returning its previous value.
+//!
+//! \remark 1R. Memory serialises operations on one word, so `n` cores adding
+//! at once take about `n` times as long as one.
+static inline int loki_atomic_fetch_add(loki_atomic_counter* counter, int value) {
+  set_channel_map(2, loki_uncached_memory_channel());
+  loki_channel_load_and_add(2, (void*)&counter->value, value);
+  return loki_receive(CH_REGISTER_2);
+}
+
+//! \brief Bitwise-or into a counter, returning its previous value.
+//! \remark As for \ref loki_atomic_fetch_add.
+static inline int loki_atomic_fetch_or(loki_atomic_counter* counter, int value) {
+  set_channel_map(2, loki_uncached_memory_channel());
+  loki_channel_load_and_or(2, (void*)&counter->value, value);
+  return loki_receive(CH_REGISTER_2);
+}
+
+//! \brief Bitwise-and into a counter, returning its previous value.
+//! \remark As for \ref loki_atomic_fetch_add.
+static inline int loki_atomic_fetch_and(loki_atomic_counter* counter, int value) {
+  set_channel_map(2, loki_uncached_memory_channel());
+  loki_channel_load_and_and(2, (void*)&counter->value, value);
+  return loki_receive(CH_REGISTER_2);
+}
+
+//! \brief Bitwise-xor into a counter, returning its previous value.
+//! \remark As for \ref loki_atomic_fetch_add.
+static inline int loki_atomic_fetch_xor(loki_atomic_counter* counter, int value) {
+  set_channel_map(2, loki_uncached_memory_channel());
+  loki_channel_load_and_xor(2, (void*)&counter->value, value);
+  return loki_receive(CH_REGISTER_2);
+}
+
+//! \brief Replace a counter's value, returning its previous value.
+//! \remark As for \ref loki_atomic_fetch_add.
+static inline int loki_atomic_exchange(loki_atomic_counter* counter, int value) {
+  set_channel_map(2, loki_uncached_memory_channel());
+  loki_channel_exchange(2, (void*)&counter->value, value);
+  return loki_receive(CH_REGISTER_2);
+}
+
+//! \brief Change a counter from `expected` to `value`, if it holds `expected`.
+//!
+//! Uses load-linked and store-conditional, so may fail spuriously if another
+//! core writes the counter in between, even with the same value.
+//!
+//! \return Whether the counter was changed.
+//! \remark 2R if the counter holds `expected`, 1R otherwise.
+static inline bool loki_atomic_compare_exchange(loki_atomic_counter* counter,
+                                                int expected, int value) {
+  set_channel_map(2, loki_uncached_memory_channel());
+  loki_channel_load_linked(2, (void*)&counter->value);
+  if (loki_receive(CH_REGISTER_2) != expected)
+    return false;
+
+  loki_channel_store_conditional(2, (void*)&counter->value, value);
+  return loki_receive(CH_REGISTER_2) != 0;
+}
+
+//============================================================================//
+// Ticket lock
+//============================================================================//
+
+//! \brief A lock granted in the order it was requested.
+//!
+//! Zero-initialised memory is an unlocked lock.
+typedef struct {
+  loki_atomic_counter next;     //!< Next ticket to hand out.
+  loki_atomic_counter serving;  //!< Ticket which holds the lock.
+} loki_ticket_lock;
+
+//! Prepare a lock for use.
+static inline void loki_ticket_lock_init(loki_ticket_lock* lock) {
+  loki_atomic_store(&lock->next, 0);
+  loki_atomic_store(&lock->serving, 0);
+}
+
+//! \brief Acquire a lock, waiting for all earlier requests to be served.
+//!
+//! Waiting cores poll \ref loki_ticket_lock::serving, backing off in proportion
+//! to their place in the queue so that the memory is not flooded.
+//!
+//! \remark 2R when uncontended. With `n` cores waiting, each handover takes 1R
+//! plus the holder's critical section, but every waiter polls the same word.
+void loki_ticket_lock_acquire(loki_ticket_lock* lock);
+
+//! \brief Release a lock held by this core.
+//! \remark 1R.
+static inline void loki_ticket_lock_release(loki_ticket_lock* lock) {
+  loki_atomic_fetch_add(&lock->serving, 1);
+}
+
+//============================================================================//
+// Queue lock
+//============================================================================//
+
+//! \brief One core's place in the queue for a \ref loki_mcs_lock.
+//!
+//! Must stay valid, and in memory other tiles can reach, while the core holds
+//! or waits for the lock. Each acquisition needs a node of its own.
+typedef struct loki_mcs_node {
+  loki_atomic_counter locked;  //!< Non-zero while the owner must wait.
+  loki_atomic_counter next;    //!< Node of the core waiting behind this one.
+} loki_mcs_node;
+
+//! \brief A queue lock in the style of Mellor-Crummey and Scott.
+//!
+//! Waiting cores form a linked list, and each polls a flag in its own node, so
+//! contention does not concentrate on one word. Zero-initialised memory is an
+//! unlocked lock.
+typedef struct {
+  loki_atomic_counter tail;    //!< Node of the last core in the queue, or 0.
+} loki_mcs_lock;
+
+//! Prepare a lock for use.
+static inline void loki_mcs_lock_init(loki_mcs_lock* lock) {
+  loki_atomic_store(&lock->tail, 0);
+}
+
+//! \brief Acquire a lock, using `node` to wait in the queue.
+//!
+//! \remark 3R when uncontended, 4R plus the wait when queueing behind another
+//! core. Only the core's own node is polled.
+void loki_mcs_lock_acquire(loki_mcs_lock* lock, loki_mcs_node* node);
+
+//! \brief Release a lock acquired with `node`.
+//!
+//! \remark 2R with nobody waiting, 2R to hand over to the next core.
+void loki_mcs_lock_release(loki_mcs_lock* lock, loki_mcs_node* node);
+
+//============================================================================//
+// Barrier
+//============================================================================//
+
+//! \brief A sense-reversing barrier for a fixed number of cores.
+//!
+//! Any set of cores may take part, as long as exactly `cores` of them wait at
+//! each episode.
+typedef struct {
+  loki_atomic_counter remaining;  //!< Cores yet to arrive in this episode.
+  loki_atomic_counter sense;      //!< Flipped as each episode completes.
+  loki_atomic_counter cores;      //!< Number of cores taking part.
+} loki_atomic_barrier;
+
+//! Prepare a barrier for `cores` cores.
+static inline void loki_atomic_barrier_init(loki_atomic_barrier* barrier,
+                                            uint cores) {
+  loki_atomic_store(&barrier->remaining, cores);
+  loki_atomic_store(&barrier->sense, 0);
+  loki_atomic_store(&barrier->cores, cores);
+}
+
+//! \brief Wait until `cores` cores have called this function.
+//!
+//! Each core reads the sense of the current episode and counts itself in. The
+//! last to arrive resets the count and flips the sense, which releases the
+//! others.
+//!
+//! \remark 2R for each waiting core plus polling, and 4R for the last. Arrivals
+//! at the counter are serialised, so an episode of `n` cores takes about `n`
+//! times 1R before the last arrives.
+void loki_atomic_barrier_wait(loki_atomic_barrier* barrier);
+
+#endif
@@ -706,7 +706,7 @@ static inline void loki_channel_flush_data(
   while (cacheLine < endData) {
     loki_channel_load_word(channel, cacheLine);
     cacheLine += 32;
-    int tmp = loki_receive(2);
+    int tmp = loki_receive(CH_REGISTER_2);
     
     // Include some empty code which uses tmp, so it doesn't get optimised away.
     asm ("" : : "r" (tmp) : "memory");
@@ -1016,7 +1016,7 @@ static inline void loki_channel_memset_cache_line(
 static inline void loki_channel_memset_words(
   const int channel, void* address, int value, size_t size
 ) {
-  int* dataPtr = address;
+  int* dataPtr = (int*)address;
   int* endData = dataPtr + size;
   
   // Special case if everything fits entirely within one cache line.
@@ -1030,7 +1030,7 @@ static inline void loki_channel_memset_words(
       loki_channel_store_word(channel, dataPtr, value);
     
     // Set entire cache lines.
-    for ( ; dataPtr + 8 < endData; dataPtr += 8)
+    for ( ; dataPtr + 8 <= endData; dataPtr += 8)
       loki_channel_memset_cache_line(channel, dataPtr, value);
     
     // Store individual words for the final part of a cache line.
@@ -1532,22 +1532,7 @@ static inline void loki_connect_async_ex(
   , enum Channels const channel
   , bool const allow_multicast
 ) {
-  channel_t const c =
-    allow_multicast && (tile == get_tile_id()) ?
-      loki_mcast_address(
-          single_core_bitmask(core)
-        , channel
-        , false
-      )
-    :
-      loki_core_address(
-          tile
-        , core
-        , channel
-        , loki_default_credit_count(channel)
-      );
-
-  set_channel_map(id, c);
+  set_channel_map(id, loki_connection_address(tile, core, channel, allow_multicast));
 
   loki_connect_async_poll(id);
 }
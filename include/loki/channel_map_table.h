@@ -27,6 +27,8 @@
 
 #include <assert.h>
 #include <loki/chip.h>
+#include <loki/ids.h>
+#include <stdint.h>
 
 //! \brief Get an entry from the channel map table.
 static inline channel_t get_channel_map(int id) {
@@ -68,7 +70,7 @@ static inline void loki_connect_helix(int output, int offset, enum Channels chan
   if (next_core < 0)
     next_core += group_size;
   
-  channel_t address = loki_mcast_address(single_core_bitmask(next_core), channel, false);
+  channel_t address = loki_mcast_address(single_core_bitmask((enum Cores)next_core), channel, false);
   set_channel_map(output, address);
 }
 
@@ -117,4 +119,166 @@ static inline channel_t channel_map_swap(int id, channel_t value) {
   return result;
 }
 
+//============================================================================//
+// Entry management
+//
+// Entries 0 and 1 hold the instruction and data memory channels, and the
+// library's patterns freely clobber entries 2 and 3. The remaining entries can
+// be handed out by a per-core allocator instead of using fixed numbers, so
+// that code using them can be composed: an allocated entry's previous contents
+// are saved, and restored when it is freed. The patterns take the fixed
+// entries they need through the same allocator, with \ref channel_map_reserve.
+//
+// The allocator also keeps a cache of connections made with
+// \ref channel_map_connect, so that repeatedly sending to the same core
+// reuses the same entry without another connection procedure, or even another
+// `setchmap`.
+//============================================================================//
+
+//! Number of entries in each core's channel map table.
+#define CHANNEL_MAP_ENTRIES 15
+
+//! Lowest entry handed out by \ref channel_map_alloc.
+#define CHANNEL_MAP_FIRST_MANAGED 4
+
+//! Entries which may be handed out by \ref channel_map_alloc.
+#define CHANNEL_MAP_MANAGED \
+  (((1 << CHANNEL_MAP_ENTRIES) - 1) & ~((1 << CHANNEL_MAP_FIRST_MANAGED) - 1))
+
+//! \brief Entries which the library's patterns reserve while they run.
+//!
+//! \ref channel_map_alloc hands these out last. An entry held when a pattern
+//! needs it is an error, and an idle cached connection in it is disconnected.
+#define CHANNEL_MAP_PATTERN_ENTRIES \
+  (((1 << CHANNEL_MAP_ENTRIES) - 1) & ~((1 << 8) - 1))
+
+//! One core's record of the entries it has handed out.
+typedef struct {
+  uint16_t      allocated;  //!< Entries reserved by \ref channel_map_alloc or \ref channel_map_reserve.
+  uint16_t      connected;  //!< Entries holding cached connections.
+  unsigned char users[CHANNEL_MAP_ENTRIES];        //!< Unreleased \ref channel_map_connect calls for each connection.
+  unsigned char victim;                            //!< Where to start looking for a connection to evict.
+  channel_t     saved[CHANNEL_MAP_ENTRIES];        //!< Contents of each entry before it was handed out.
+  channel_t     destination[CHANNEL_MAP_ENTRIES];  //!< Address each cached connection was made with.
+} __attribute__((aligned(32))) channel_map_state;
+
+//! Allocator state of every core on the chip, indexed by `tile * CORES_PER_TILE + core`.
+extern channel_map_state channel_map_states[CORES_PER_TILE * COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS];
+
+//! This core's allocator state.
+static inline channel_map_state* channel_map_this_core(void) {
+  return &channel_map_states[tile2int(get_tile_id()) * CORES_PER_TILE + get_core_id()];
+}
+
+//! \brief Reserve a free entry, saving its current contents.
+//!
+//! \return An entry between \ref CHANNEL_MAP_FIRST_MANAGED and 14. Higher
+//! entries are handed out first, except that \ref CHANNEL_MAP_PATTERN_ENTRIES
+//! are only used once all others are taken. If every entry is in use, an idle cached
+//! connection is disconnected to make room; otherwise, this is an error.
+//!
+//! \remark About 20 cycles, plus the cost of any disconnection.
+int channel_map_alloc(void);
+
+//! \brief Reserve a particular entry, saving its current contents.
+//!
+//! For code which must use a fixed entry, such as hand-written packets. The
+//! entry must be managed, and must not already be reserved. An idle cached
+//! connection in the entry is disconnected first.
+void channel_map_reserve(int id);
+
+//! \brief Give back an entry from \ref channel_map_alloc or \ref
+//! channel_map_reserve, restoring its previous contents.
+void channel_map_free(int id);
+
+//! Connect a free entry to `address`. Use \ref channel_map_connect instead.
+int channel_map_connect_new(channel_t address);
+
+//! \brief Get an entry connected to an input channel of a core, reusing a
+//! cached connection if there is one.
+//!
+//! \param tile The tile holding the core.
+//! \param core The core to connect to.
+//! \param channel The destination channel to connect to.
+//! \param allow_multicast Allow the use of a multicast address for cores on
+//!        this tile, as in \ref loki_connect_async_ex.
+//! \return The entry to send on. It remains connected, and is not reused for
+//!         anything else, until released with \ref channel_map_release.
+//!
+//! The connection stays in the cache after it is released, until its entry is
+//! needed for something else or \ref channel_map_flush_connections is called.
+//!
+//! \remark About 10 cycles for a cached connection, plus 5 cycles for each
+//! other cached connection. A new connection costs one entry allocation and
+//! a connection procedure as in \ref loki_connect_ex.
+//!
+//! \warning A cached core-to-core connection holds its destination channel,
+//! so no other core can connect to it. Call \ref channel_map_flush_connections
+//! before another core needs the destination.
+static inline int channel_map_connect(tile_id_t const tile,
+                                      enum Cores const core,
+                                      enum Channels const channel,
+                                      bool const allow_multicast) {
+  const channel_t address =
+      loki_connection_address(tile, core, channel, allow_multicast);
+  channel_map_state* state = channel_map_this_core();
+
+  uint connected = state->connected;
+  while (connected != 0) {
+    const int id = __builtin_ctz(connected);
+    if (state->destination[id] == address) {
+      state->users[id]++;
+      return id;
+    }
+    connected &= connected - 1;
+  }
+
+  return channel_map_connect_new(address);
+}
+
+//! \brief Finish using an entry from \ref channel_map_connect.
+//!
+//! The connection is kept for later calls to \ref channel_map_connect.
+static inline void channel_map_release(int id) {
+  channel_map_state* state = channel_map_this_core();
+  assert((state->connected & (1 << id)) && state->users[id] > 0);
+  state->users[id]--;
+}
+
+//! \brief Disconnect all cached connections which have been released, and
+//! restore their entries.
+//!
+//! \remark Waits for each connection to have no data in flight, as \ref
+//! loki_disconnect does.
+void channel_map_flush_connections(void);
+
+//! \brief Execute `statement` with the entry `id` known at compile time.
+//!
+//! Functions which take an entry as a parameter, such as \ref loki_send, select
+//! an instruction with a large `switch` whenever the entry is not a constant.
+//! `statement` is compiled once for each managed entry, with the enum constant
+//! `CHANNEL_MAP_ENTRY` equal to `id`, so that one `switch` selects a whole loop
+//! instead of a single instruction:
+//!
+//!     CHANNEL_MAP_DISPATCH(entry,
+//!       for (i = 0; i < n; i++) loki_send(CHANNEL_MAP_ENTRY, data[i]));
+//!
+//! `id` must be a managed entry.
+#define CHANNEL_MAP_DISPATCH(id, statement) do { \
+  switch (id) { \
+  case 4:  { enum { CHANNEL_MAP_ENTRY = 4 };  statement; break; } \
+  case 5:  { enum { CHANNEL_MAP_ENTRY = 5 };  statement; break; } \
+  case 6:  { enum { CHANNEL_MAP_ENTRY = 6 };  statement; break; } \
+  case 7:  { enum { CHANNEL_MAP_ENTRY = 7 };  statement; break; } \
+  case 8:  { enum { CHANNEL_MAP_ENTRY = 8 };  statement; break; } \
+  case 9:  { enum { CHANNEL_MAP_ENTRY = 9 };  statement; break; } \
+  case 10: { enum { CHANNEL_MAP_ENTRY = 10 }; statement; break; } \
+  case 11: { enum { CHANNEL_MAP_ENTRY = 11 }; statement; break; } \
+  case 12: { enum { CHANNEL_MAP_ENTRY = 12 }; statement; break; } \
+  case 13: { enum { CHANNEL_MAP_ENTRY = 13 }; statement; break; } \
+  case 14: { enum { CHANNEL_MAP_ENTRY = 14 }; statement; break; } \
+  default: assert(0); __builtin_unreachable(); \
+  } \
+} while (0)
+
 #endif
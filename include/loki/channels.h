@@ -211,7 +211,7 @@ static inline channel_t loki_core_address_ex(
   , const enum Channels   channel
 ) {
   if (core < 8)
-    return loki_mcast_address(single_core_bitmask(core), channel, false);
+    return loki_mcast_address(single_core_bitmask((enum Cores)core), channel, false);
   else
     return loki_core_address(
         get_unique_core_id_tile(core)
@@ -221,6 +221,26 @@ static inline channel_t loki_core_address_ex(
       );
 }
 
+//! \brief Form the channel address used to connect to an input channel of a
+//! core.
+//! \param tile The tile holding the core.
+//! \param core The core to connect to.
+//! \param channel The destination channel to connect to.
+//! \param allow_multicast Use a multicast address if the core is on this tile.
+//!
+//! This is the address \ref loki_connect_async_ex puts in the channel map table.
+static inline channel_t loki_connection_address(
+    tile_id_t const     tile
+  , enum Cores const    core
+  , enum Channels const channel
+  , bool const          allow_multicast
+) {
+  return allow_multicast && (tile == get_tile_id()) ?
+      loki_mcast_address(single_core_bitmask(core), channel, false)
+    :
+      loki_core_address(tile, core, channel, loki_default_credit_count(channel));
+}
+
 //! \brief Extract the group size from a memory chnanel.
 //! \param channel The channel value to extract from. This must be a memory
 //!        channel.
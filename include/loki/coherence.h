@@ -0,0 +1,97 @@
+/*! \file coherence.h
+ * \brief Regions of memory shared between tiles, with per-line tracking of
+ * which parts need to be made coherent.
+ *
+ * Caches are only coherent within a tile. To share data with another tile, a
+ * writer must flush the lines it changed, and a reader must invalidate any
+ * stale copies. A \ref loki_region keeps a bitmap with one bit per cache line
+ * of a buffer: writers mark each range they write, and \ref
+ * loki_region_publish then flushes only those lines. Readers mark the ranges
+ * they are about to read (for example, those the writer reports having
+ * changed), and \ref loki_region_acquire invalidates only those lines.
+ *
+ * A region descriptor and its bitmap are private to one core.
+ */
+
+#ifndef LOKI_COHERENCE_H_
+#define LOKI_COHERENCE_H_
+
+#include <assert.h>
+#include <loki/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//! \brief Number of `uint32_t` words of bitmap needed for a region of `size`
+//! bytes, whatever its alignment.
+#define LOKI_REGION_BITMAP_WORDS(size) (((size) + 31) / (32 * 32) + 2)
+
+//! A buffer whose changed cache lines are tracked.
+typedef struct {
+  char     *base;   //!< Start of the first cache line of the buffer.
+  size_t    lines;  //!< Number of cache lines covered.
+  uint32_t *marked; //!< One bit per line, set for lines needing attention.
+} loki_region;
+
+//! \brief Start tracking a buffer.
+//!
+//! \param region Descriptor to initialise.
+//! \param base Start of the buffer.
+//! \param size Size of the buffer in bytes.
+//! \param bitmap Storage for at least \ref LOKI_REGION_BITMAP_WORDS(size)
+//!        words, which must stay valid while the region is used.
+//!
+//! No lines are initially marked.
+void loki_region_init(loki_region* region, void* base, size_t size,
+                      uint32_t* bitmap);
+
+//! \brief Mark the cache lines covering `size` bytes at `address`.
+//!
+//! \remark A few cycles, plus one cycle per 32 lines for large ranges.
+static inline void loki_region_mark(loki_region* region, const void* address,
+                                    size_t size) {
+  if (size == 0)
+    return;
+
+  size_t first = ((uintptr_t)address - (uintptr_t)region->base) >> 5;
+  size_t last = ((uintptr_t)address + size - 1 - (uintptr_t)region->base) >> 5;
+  assert((const char*)address >= region->base && last < region->lines);
+
+  size_t word = first / 32;
+  size_t last_word = last / 32;
+  uint32_t head = ~0u << (first % 32);
+  uint32_t tail = ~0u >> (31 - last % 32);
+
+  if (word == last_word) {
+    region->marked[word] |= head & tail;
+    return;
+  }
+
+  region->marked[word++] |= head;
+  for ( ; word < last_word; word++)
+    region->marked[word] = ~0u;
+  region->marked[word] |= tail;
+}
+
+//! Mark every line of the region.
+static inline void loki_region_mark_all(loki_region* region) {
+  if (region->lines > 0)
+    loki_region_mark(region, region->base, region->lines * 32);
+}
+
+//! \brief Flush all marked lines to the next level of the memory hierarchy,
+//! and unmark them.
+//!
+//! Flushes are sent back to back. Then one request is sent to each cache bank
+//! which received a flush, and the function waits for its reply, so it returns
+//! once all the data has left the tile.
+//!
+//! \remark Reads the channel map table to determine cache configuration.
+void loki_region_publish(loki_region* region);
+
+//! \brief Invalidate all marked lines, so they are fetched again when next
+//! accessed, and unmark them.
+//!
+//! \warning Any data in these lines which has not been flushed will be lost.
+void loki_region_acquire(loki_region* region);
+
+#endif
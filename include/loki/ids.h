@@ -35,7 +35,7 @@ static inline core_id_t make_unique_core_id(tile_id_t tile, enum Cores core) {
 
 //! \brief Extract the core part of a global core id.
 static inline enum Cores get_unique_core_id_core(core_id_t id) {
-  return id & 0x7;
+  return (enum Cores)(id & 0x7);
 }
 
 //! \brief Extract the tile part of a global core id.
@@ -93,7 +93,7 @@ static inline enum MulticastDestinations all_cores(uint num_cores) {
 //!
 //! The result is in the format required by \ref loki_mcast_address.
 static inline enum MulticastDestinations all_cores_except_0(uint num_cores) {
-  return all_cores(num_cores) & ~MULTICAST_CORE_0;
+  return (enum MulticastDestinations)(all_cores(num_cores) & ~MULTICAST_CORE_0);
 }
 
 //! \brief Generate a bitmask representing the first `num_cores` cores on the
@@ -102,7 +102,8 @@ static inline enum MulticastDestinations all_cores_except_0(uint num_cores) {
 //!
 //! The result is in the format required by \ref loki_mcast_address.
 static inline enum MulticastDestinations all_cores_except_current(uint num_cores) {
-  return all_cores(num_cores) & ~single_core_bitmask(get_core_id());
+  return (enum MulticastDestinations)(all_cores(num_cores) &
+                                      ~single_core_bitmask(get_core_id()));
 }
 
 //! \brief Compute the minimum number of tiles required to hold the given number
@@ -153,13 +154,13 @@ static inline core_id_t group_core_id(
   if (CORES_PER_TILE > first_core + index) {
     return make_unique_core_id(
         get_unique_core_id_tile(first_core_id)
-      , first_core + index
+      , (enum Cores)(first_core + index)
     );
   }
 
   return make_unique_core_id(
       int2tile(first_tile + (index + first_core) / CORES_PER_TILE)
-    , (first_core + index) % CORES_PER_TILE
+    , (enum Cores)((first_core + index) % CORES_PER_TILE)
   );
 }
 
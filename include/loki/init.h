@@ -21,6 +21,7 @@ typedef struct {
   channel_t  inst_mem;      //!< Input. Address/configuration of instruction memory.
   channel_t  data_mem;      //!< Input. Address/configuration of data memory.
   setup_func config_func;   //!< Input. Function which performs any program-specific setup (optional).
+  size_t     heap_size;     //!< Input. Size of each core's private heap, or 0 for none (see \ref loki_private_malloc).
 } init_config;
 
 //! \brief Prepare cores for execution.
@@ -42,19 +43,45 @@ typedef struct {
 //! where this is usually done by the bootloader.
 //!
 //! The function `config->config_func` is run on each core. This is optional, set to
-//! `NULL` to skip.
+//! `NULL` to skip. All initialised cores synchronise before this function returns.
+//!
+//! Tiles are started in a binomial tree: each tile's core 0 starts further tiles
+//! before its own cores, so startup takes O(log tiles) steps.
+//!
+//! If `config->heap_size` is non-zero, a private heap of that many bytes is
+//! reserved for each core, for use by \ref loki_private_malloc. This must be
+//! executed on tile 0. Code which fills in `config` one field at a time must
+//! set `heap_size` too: 0 reserves nothing, as before the field existed.
 //!
 //! \warning This function must be executed before any other function in this
 //! library. It may overwrite any channel map table entry on any core, and
 //! generate network traffic.
 void loki_init(init_config* config);
 
+//! \brief Prepare cores on an arbitrary set of tiles for execution.
+//! \param num_tiles number of tiles in `tile_ids`.
+//! \param tile_ids tiles to initialise. Must include the current tile.
+//! \param config as for \ref loki_init. `config->cores` is distributed across
+//!        the tiles in the order given, with the current tile taking the first
+//!        share. Core 0 of every listed tile is always started.
+//!
+//! Behaves as \ref loki_init, but the stack of the tile at position `n` in the
+//! list starts `n * CORES_PER_TILE * stack_size` bytes below
+//! `config->stack_pointer`. All initialised cores synchronise before this
+//! function returns. No private heaps are reserved.
+//!
+//! \warning It may overwrite any channel map table entry on any core, and
+//! generate network traffic.
+void loki_init_tiles(int num_tiles, tile_id_t* tile_ids, init_config* config);
+
 //! \brief Wrapper for loki_init which provides sensible defaults.
 //! \param cores value to set `config->cores` to.
 //! \param setup value to set `config->config_func` to.
 //!
 //! `config->stack_size` is set to to 0x12000.
 //!
+//! `config->heap_size` is set to 0, so no private heaps are reserved.
+//!
 //! `config->inst_mem` and `config->data_mem` are set to the bootloader's defaults.
 //!
 //! `config->mem_config` is set to `loki_mem_config(ASSOCIATIVITY_1, LINESIZE_32, CACHE, GROUPSIZE_8)`.
@@ -0,0 +1,583 @@
+/*! \file loki.hpp
+ * \brief C++ bindings: channels as template parameters, channel map guards and
+ * lambda-based loops and pipelines.
+ *
+ * The C functions in channel_io.h take the channel map table entry as an
+ * argument, and select the instruction for it with a switch, because the entry
+ * is encoded in the instruction itself. That switch disappears when the call
+ * is inlined with a constant entry, but costs a jump table whenever it isn't.
+ * Here, the entry is a template parameter instead: `loki::channel<2>::send(x)`
+ * is always the single instruction `addu.eop r0, x, r0 -> 2`.
+ *
+ * The loop and pipeline wrappers take lambdas, and compile them into their
+ * worker loops, rather than calling a function pointer for every iteration as
+ * \ref simd_loop and \ref pipeline_loop do.
+ *
+ * Requires C++11. Include this instead of lokilib.h.
+ */
+
+#ifndef LOKI_LOKI_HPP_
+#define LOKI_LOKI_HPP_
+
+extern "C" {
+#include <loki/lokilib.h>
+}
+
+namespace loki {
+
+//============================================================================//
+// Channels
+//============================================================================//
+
+// Memory operations which only differ in their opcode. The instruction must be
+// a string literal, so can't be a function argument.
+#define LOKI_HPP_LOAD(opcode, address) \
+  asm ("fetchr 0f\n" opcode " -> %1\n0:\n" \
+       : : "r"(address), "n"(N) : "memory")
+#define LOKI_HPP_UPDATE(opcode, address, value) \
+  asm ("fetchr 0f\n" opcode " %1, %0, 0 -> %2\n0:\n" \
+       : : "r"(address), "r"(value), "n"(N) : "memory")
+
+//! \brief Operations on channel map table entry `N`.
+//!
+//! Each function is equivalent to the C function of the same name with the
+//! `loki_`/`loki_channel_` prefix, but compiles to one fixed instruction.
+template <int N>
+struct channel {
+  static_assert(N >= 0 && N < CHANNEL_MAP_ENTRIES,
+                "channel map table entries are 0 to 14");
+
+  //! Read this entry. As \ref get_channel_map.
+  static channel_t get() {
+    return get_channel_map(N);
+  }
+
+  //! Write this entry. As \ref set_channel_map.
+  static void set(channel_t value) {
+    asm volatile (
+      "fetchr 0f\n"
+      "setchmapi %1, %0\n"
+      "nor.eop r0, r0, r0\n0:\n"
+      :
+      : "r"(value), "n"(N)
+    );
+  }
+
+  //! Send a value. As \ref loki_send.
+  static void send(int value) {
+    asm (
+      "fetchr 0f\n"
+      "addu.eop r0, %0, r0 -> %1\n0:\n"
+      :
+      : "r"(value), "n"(N)
+    );
+  }
+
+  //! Send a token (0). As \ref loki_send_token.
+  static void send_token() {
+    send(0);
+  }
+
+  //! Send an interrupt to a core's IPK FIFO. As \ref loki_send_interrupt.
+  static void send_interrupt() {
+    asm (
+      "fetchr 0f\n"
+      "rmtnxipk.eop -> %0\n0:\n"
+      :
+      : "n"(N)
+    );
+  }
+
+  //! Send a connection request. As \ref loki_channel_acquire.
+  static void acquire() {
+    int temp;
+    asm volatile (
+      "fetchr 0f\n"
+      "cregrdi %0, 1\n"
+      "lui %0, %1\n"
+      "sendconfig.eop %0, %2 -> %1\n0:\n"
+      : "=&r"(temp)
+      : "n"(N), "n"(SC_UNACQUIRED | SC_ALLOCATE | SC_EOP)
+    );
+  }
+
+  //! Release a connection. As \ref loki_channel_release.
+  static void release() {
+    sendconfig<SC_ACQUIRED | SC_ALLOCATE | SC_EOP>(nullptr);
+  }
+
+  //! Wait until `Credits` credits have returned. Use \ref wait_empty unless
+  //! the entry's credit count is known.
+  template <int Credits>
+  static void wait_credits() {
+    asm (
+      "fetchr 0f\n"
+      "woche.eop %0 -> %1\n0:\n"
+      :
+      : "n"(Credits), "n"(N)
+      : "memory"
+    );
+  }
+
+  //! \brief Wait for the entry's default number of credits to return. As
+  //! \ref loki_channel_wait_empty.
+  //!
+  //! Reads the entry to find its credit count; the choice is a single branch.
+  static void wait_empty() {
+    switch (loki_channel_default_credit_count(get())) {
+      case DEFAULT_CREDIT_COUNT:
+        wait_credits<DEFAULT_CREDIT_COUNT>();
+        return;
+      case DEFAULT_IPK_FIFO_CREDIT_COUNT:
+        wait_credits<DEFAULT_IPK_FIFO_CREDIT_COUNT>();
+        return;
+      default:
+        assert(0); __builtin_unreachable();
+    }
+  }
+
+  //! Load a word. The result arrives on `CH_REGISTER_2`.
+  static void load_word(const void* address) {
+    LOKI_HPP_LOAD("ldw.eop 0(%0)", address);
+  }
+
+  //! Load a word, and reserve it for \ref store_conditional.
+  static void load_linked(const void* address) {
+    LOKI_HPP_LOAD("ldl.eop %0, 0", address);
+  }
+
+  //! Load an unsigned half word.
+  static void load_half_word(const void* address) {
+    LOKI_HPP_LOAD("ldhwu.eop 0(%0)", address);
+  }
+
+  //! Load an unsigned byte.
+  static void load_byte(const void* address) {
+    LOKI_HPP_LOAD("ldbu.eop 0(%0)", address);
+  }
+
+  //! Store a word.
+  static void store_word(void* address, int value) {
+    asm (
+      "fetchr 0f\n"
+      "stw.eop %1, 0(%0) -> %2\n0:\n"
+      :
+      : "r"(address), "r"(value), "n"(N)
+      : "memory"
+    );
+  }
+
+  //! Store a half word.
+  static void store_half_word(void* address, int value) {
+    asm (
+      "fetchr 0f\n"
+      "sthw.eop %1, 0(%0) -> %2\n0:\n"
+      :
+      : "r"(address), "r"(value), "n"(N)
+      : "memory"
+    );
+  }
+
+  //! Store a byte.
+  static void store_byte(void* address, int value) {
+    asm (
+      "fetchr 0f\n"
+      "stb.eop %1, 0(%0) -> %2\n0:\n"
+      :
+      : "r"(address), "r"(value), "n"(N)
+      : "memory"
+    );
+  }
+
+  //! Store a word if it is still reserved by \ref load_linked. The memory
+  //! returns non-zero on `CH_REGISTER_2` if the store succeeded.
+  static void store_conditional(void* address, int value) {
+    LOKI_HPP_UPDATE("stc.eop", address, value);
+  }
+
+  //! Add to a word, returning its previous value on `CH_REGISTER_2`.
+  static void load_and_add(void* address, int value) {
+    LOKI_HPP_UPDATE("ldadd.eop", address, value);
+  }
+
+  //! Bitwise-or into a word, returning its previous value.
+  static void load_and_or(void* address, int value) {
+    LOKI_HPP_UPDATE("ldor.eop", address, value);
+  }
+
+  //! Bitwise-and into a word, returning its previous value.
+  static void load_and_and(void* address, int value) {
+    LOKI_HPP_UPDATE("ldand.eop", address, value);
+  }
+
+  //! Bitwise-xor into a word, returning its previous value.
+  static void load_and_xor(void* address, int value) {
+    LOKI_HPP_UPDATE("ldxor.eop", address, value);
+  }
+
+  //! Replace a word, returning its previous value.
+  static void exchange(void* address, int value) {
+    LOKI_HPP_UPDATE("exchange.eop", address, value);
+  }
+
+  //! Fetch a cache line without returning any data.
+  static void prefetch_cache_line(const void* address) {
+    sendconfig<SC_PREFETCH_LINE>(address);
+  }
+
+  //! Mark a cache line as valid without fetching it.
+  static void validate_cache_line(void* address) {
+    sendconfig<SC_VALIDATE_LINE>(address);
+  }
+
+  //! Write a cache line back to the next level of memory.
+  static void flush_cache_line(const void* address) {
+    sendconfig<SC_FLUSH_LINE>(address);
+  }
+
+  //! Discard a cache line.
+  static void invalidate_cache_line(void* address) {
+    sendconfig<SC_INVALIDATE_LINE>(address);
+  }
+
+  //! Change a directory entry. As \ref loki_channel_update_directory_entry.
+  static void update_directory_entry(void* address, int value) {
+    sendconfig2<SC_UPDATE_DIRECTORY_ENTRY>(address, value);
+  }
+
+  //! Change a directory mask. As \ref loki_channel_update_directory_mask.
+  static void update_directory_mask(void* address, int value) {
+    sendconfig2<SC_UPDATE_DIRECTORY_MASK>(address, value);
+  }
+
+private:
+  template <int Flags>
+  static void sendconfig(const void* value) {
+    asm (
+      "fetchr 0f\n"
+      "sendconfig.eop %0, %1 -> %2\n0:\n"
+      :
+      : "r"(value), "n"(Flags), "n"(N)
+      : "memory"
+    );
+  }
+
+  template <int Flags>
+  static void sendconfig2(const void* head, int payload) {
+    asm (
+      "fetchr 0f\n"
+      "sendconfig %0, %2 -> %4\n"
+      "sendconfig.eop %1, %3 -> %4\n0:\n"
+      :
+      : "r"(head), "r"(payload), "n"(Flags), "n"(SC_PAYLOAD | 1), "n"(N)
+      : "memory"
+    );
+  }
+};
+
+#undef LOKI_HPP_LOAD
+#undef LOKI_HPP_UPDATE
+
+//! \brief One of the register-mapped input channels, `CH_REGISTER_2` to
+//! `CH_REGISTER_7`.
+template <int R>
+struct input {
+  static_assert(R >= CH_REGISTER_2 && R <= CH_REGISTER_7,
+                "register-mapped inputs are r2 to r7");
+
+  //! Receive a value. As \ref loki_receive.
+  static int receive() {
+    int value;
+    asm volatile (
+      "fetchr 0f\n"
+      "addu.eop %0, r%1, r0\n0:\n"
+      : "=r"(value)
+      : "n"(R)
+    );
+    return value;
+  }
+
+  //! Receive a token, and discard it. As \ref loki_receive_token.
+  static void receive_token() {
+    receive();
+  }
+
+  //! Whether any data is waiting. As \ref loki_test_channel.
+  static bool test() {
+    int result;
+    asm volatile (
+      "fetchr 0f\n"
+      "tstchi.eop %0, %1\n0:\n"
+      : "=r"(result)
+      : "n"(R - CH_REGISTER_2)
+    );
+    return result != 0;
+  }
+};
+
+//! \brief Replaces a channel map table entry for as long as it is in scope, and
+//! restores the previous value afterwards. As \ref channel_map_swap and
+//! \ref channel_map_restore.
+class channel_map_guard {
+public:
+  channel_map_guard(int id, channel_t value) :
+      id_(id),
+      saved_(channel_map_swap(id, value)) {}
+
+  ~channel_map_guard() {
+    channel_map_restore(id_, saved_);
+  }
+
+  //! The value which will be restored.
+  channel_t saved() const { return saved_; }
+
+  channel_map_guard(const channel_map_guard&) = delete;
+  channel_map_guard& operator=(const channel_map_guard&) = delete;
+
+private:
+  const int       id_;
+  const channel_t saved_;
+};
+
+//! \brief Reserves a channel map table entry through the allocator for as long
+//! as it is in scope, and frees it afterwards. As \ref channel_map_reserve
+//! and \ref channel_map_free.
+class channel_map_reservation {
+public:
+  channel_map_reservation(int id, channel_t value) : id_(id) {
+    channel_map_reserve(id);
+    set_channel_map(id, value);
+  }
+
+  ~channel_map_reservation() {
+    channel_map_free(id_);
+  }
+
+  channel_map_reservation(const channel_map_reservation&) = delete;
+  channel_map_reservation& operator=(const channel_map_reservation&) = delete;
+
+private:
+  const int id_;
+};
+
+//============================================================================//
+// Loops
+//============================================================================//
+
+//! \brief A loop for \ref loki::simd_loop. Mirrors \ref loop_config.
+//!
+//! `Body` is called as `body(iteration, core)`, like \ref iteration_func. It is
+//! copied to every tile, so must be safe to copy with `memcpy`, and anything it
+//! refers to must be visible to the other tiles, as for \ref loki_execute.
+template <typename Body>
+struct loop {
+  int                cores;       //!< Number of cores
+  int                iterations;  //!< Number of iterations
+  Body               body;        //!< Executes one iteration
+  enum loop_schedule schedule;    //!< Striped, blocked or chunked
+  int                chunk_size;  //!< Chunk size for \ref LOOP_SCHEDULE_CHUNKED
+};
+
+//! Build a \ref loki::loop, deducing the type of the lambda.
+template <typename Body>
+loop<Body> make_loop(int cores, int iterations, Body body,
+                     enum loop_schedule schedule = LOOP_SCHEDULE_STRIPED,
+                     int chunk_size = 1) {
+  return loop<Body>{cores, iterations, body, schedule, chunk_size};
+}
+
+namespace detail {
+
+// What each core of a loop::simd_loop is given: the loop itself, and the tile
+// its cores are numbered from.
+template <typename Body>
+struct loop_launch {
+  loop<Body> config;
+  tile_id_t  first_tile;
+};
+
+// Executed by every core of a loop::simd_loop. The body's calls are compiled
+// into each of these loops.
+template <typename Body>
+void simd_member(const void* data) {
+  const loop_launch<Body>& launch = *static_cast<const loop_launch<Body>*>(data);
+  const loop<Body>& config = launch.config;
+  const int core = (tile2int(get_tile_id()) - tile2int(launch.first_tile))
+                       * CORES_PER_TILE + get_core_id();
+  const int cores = config.cores;
+  const int iterations = config.iterations;
+
+  switch (config.schedule) {
+    case LOOP_SCHEDULE_STRIPED:
+      for (int i = core; i < iterations; i += cores)
+        config.body(i, core);
+      break;
+
+    case LOOP_SCHEDULE_BLOCKED: {
+      const int quotient = iterations / cores;
+      const int remainder = iterations % cores;
+      const int start = core * quotient + (core < remainder ? core : remainder);
+      const int end = start + quotient + (core < remainder ? 1 : 0);
+      for (int i = start; i < end; i++)
+        config.body(i, core);
+      break;
+    }
+
+    case LOOP_SCHEDULE_CHUNKED: {
+      const int chunk = (config.chunk_size > 0) ? config.chunk_size : 1;
+      for (int first = core * chunk; first < iterations; first += cores * chunk) {
+        const int end = (first + chunk < iterations) ? first + chunk : iterations;
+        for (int i = first; i < end; i++)
+          config.body(i, core);
+      }
+      break;
+    }
+
+    default:
+      // Guided scheduling needs the counters inside simd_loop.
+      assert(0); __builtin_unreachable();
+  }
+}
+
+} // namespace detail
+
+//! \brief Execute a loop in parallel, and wait for all cores to finish.
+//!
+//! As \ref simd_loop, but each core's share of the iterations is a loop around
+//! the inlined body. Reductions, prefetching and guided scheduling need
+//! \ref simd_loop itself.
+//!
+//! \warning Must be executed on core 0 of the first tile. Has the same
+//! requirements as \ref loki_execute_async.
+template <typename Body>
+void simd_loop(const loop<Body>& config) {
+  const detail::loop_launch<Body> launch = {config, get_tile_id()};
+  distributed_func execution = {
+    (uint)config.cores,
+    &detail::simd_member<Body>,
+    &launch,
+    sizeof(launch)
+  };
+  loki_execution handle = loki_execute_async(&execution);
+  loki_execute_join(&handle);
+}
+
+
+//============================================================================//
+// Pipelines
+//============================================================================//
+
+//! \brief The stages of a \ref loki::pipeline, one per core. Built by
+//! \ref loki::make_pipeline.
+template <typename... Stages>
+struct stage_list;
+
+template <>
+struct stage_list<> {};
+
+template <typename First, typename... Rest>
+struct stage_list<First, Rest...> {
+  First               first;
+  stage_list<Rest...> rest;
+};
+
+//! \brief A pipeline for \ref loki::pipeline_loop. Mirrors \ref pipeline_config.
+//!
+//! Stage `n` runs on core `n` of this tile, and is called as `stage(iteration)`,
+//! like \ref pipeline_func. Each iteration of a stage starts once the previous
+//! stage has finished it.
+template <typename... Stages>
+struct pipeline {
+  int                   iterations;  //!< Number of iterations to run
+  stage_list<Stages...> stages;      //!< One function per core
+};
+
+namespace detail {
+
+inline stage_list<> make_stages() {
+  return stage_list<>{};
+}
+
+template <typename First, typename... Rest>
+stage_list<First, Rest...> make_stages(First first, Rest... rest) {
+  return stage_list<First, Rest...>{first, make_stages(rest...)};
+}
+
+// Run one stage: wait for the predecessor to finish each iteration on
+// CH_REGISTER_4, and tell the successor through entry 8.
+template <typename Stage>
+void pipeline_stage(const Stage& stage, int iterations, int index, int stages) {
+  const bool have_predecessor = (index > 0);
+  const bool have_successor = (index < stages - 1);
+  const int successor = have_successor ? index + 1 : 0;
+  channel_map_reservation next(8, loki_mcast_address(
+      single_core_bitmask((enum Cores)successor), CH_REGISTER_4, false));
+
+  for (int i = 0; i < iterations; i++) {
+    if (have_predecessor)
+      input<CH_REGISTER_4>::receive_token();
+
+    stage(i);
+
+    if (have_successor)
+      channel<8>::send_token();
+  }
+}
+
+// Find this core's stage. The recursion is resolved at compile time, leaving a
+// chain of comparisons.
+inline void pipeline_dispatch(const stage_list<>&, int, int, int, int) {
+  __builtin_unreachable();
+}
+
+template <typename First, typename... Rest>
+void pipeline_dispatch(const stage_list<First, Rest...>& stages, int iterations,
+                       int index, int target, int count) {
+  if (index == target)
+    pipeline_stage(stages.first, iterations, index, count);
+  else
+    pipeline_dispatch(stages.rest, iterations, index + 1, target, count);
+}
+
+template <typename... Stages>
+void pipeline_member(const void* data) {
+  const pipeline<Stages...>& config =
+      *static_cast<const pipeline<Stages...>*>(data);
+  pipeline_dispatch(config.stages, config.iterations, 0, get_core_id(),
+                    sizeof...(Stages));
+}
+
+} // namespace detail
+
+//! Build a \ref loki::pipeline, deducing the types of the lambdas.
+template <typename... Stages>
+pipeline<Stages...> make_pipeline(int iterations, Stages... stages) {
+  return pipeline<Stages...>{iterations, detail::make_stages(stages...)};
+}
+
+//! \brief Run a pipeline on the first cores of this tile, and wait for every
+//! stage to finish.
+//!
+//! As \ref pipeline_loop, but every stage's calls are compiled into its loop.
+//!
+//! \warning Must be executed on core 0 of the first tile. Reserves and restores
+//! channel map table entry 8, and uses `CH_REGISTER_4`. Has the same
+//! requirements as \ref loki_execute_async.
+template <typename... Stages>
+void pipeline_loop(const pipeline<Stages...>& config) {
+  static_assert(sizeof...(Stages) > 0 && sizeof...(Stages) <= CORES_PER_TILE,
+                "a pipeline has one stage per core of a tile");
+
+  distributed_func execution = {
+    sizeof...(Stages),
+    &detail::pipeline_member<Stages...>,
+    &config,
+    sizeof(config)
+  };
+  loki_execution handle = loki_execute_async(&execution);
+  loki_execute_join(&handle);
+}
+
+} // namespace loki
+
+#endif
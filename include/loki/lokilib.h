@@ -30,12 +30,17 @@
 //============================================================================//
 
 #include <loki/alloc.h>
+#include <loki/atomic.h>
 #include <loki/barrier.h>
 #include <loki/channels.h>
+#include <loki/coherence.h>
 #include <loki/control_registers.h>
 #include <loki/memory.h>
+#include <loki/placement.h>
+#include <loki/queue.h>
 #include <loki/syscall.h>
 #include <loki/vector.h>
+#include <loki/vector_ops.h>
 
 //============================================================================//
 // Execution patterns
@@ -47,6 +52,9 @@
 #include <loki/patterns/dataflow.h>
 #include <loki/patterns/loop.h>
 #include <loki/patterns/pipeline.h>
+#include <loki/patterns/tasks.h>
+
+#include <loki/algorithms.h>
 
 //============================================================================//
 // Scratchpad access
@@ -59,6 +67,8 @@
 //============================================================================//
 
 #include <loki/lokisim.h>
+#include <loki/profile.h>
+#include <loki/trace.h>
 
 #include <loki/deprecated.h>
 	
@@ -178,6 +178,44 @@ void loki_memory_cache_reconfigure(
 	  loki_memory_cache_configuration_t const value
 );
 
+//! \brief Reconfigure only the parts of a tile's caches which change.
+//!
+//! \param value The new configuration of the memory system. If the
+//! configuration is impossible, the behaviour of this method is undefined.
+//!
+//! Compares `value` with the tile's last configuration (see \ref
+//! loki_memory_cache_current). Only the banks used by a core whose channels
+//! change are flushed and invalidated, and only cores whose channels change are
+//! given new ones. Cores which use none of those banks may keep running
+//! throughout. \ref loki_memory_cache_reconfigure_affected gives the cores
+//! which must be idle.
+//!
+//! If the current configuration is unknown, or this core's own caches are
+//! affected, this does the same as \ref loki_memory_cache_reconfigure.
+//!
+//! \warning All cores returned by \ref loki_memory_cache_reconfigure_affected
+//! must be idle when this method is run.
+//! \warning Overwrites channel map table entries 2 and 3, and uses
+//! `CH_REGISTER_2` (and, on the cores which change, `CH_REGISTER_3`). Falling
+//! back to \ref loki_memory_cache_reconfigure has its requirements.
+void loki_memory_cache_reconfigure_partial(
+	  loki_memory_cache_configuration_t const value
+);
+
+//! \brief The cores which must be idle while \ref
+//! loki_memory_cache_reconfigure_partial changes to `value`.
+//!
+//! These are the cores whose channels change, and any others using a bank
+//! which must be cleaned. Returns \ref MULTICAST_CORE_ALL if the current
+//! configuration is unknown.
+enum MulticastDestinations loki_memory_cache_reconfigure_affected(
+	  loki_memory_cache_configuration_t const value
+);
+
+//! \brief The cache configuration this tile was last given by this library, or
+//! NULL if it has not been reconfigured.
+loki_memory_cache_configuration_t const* loki_memory_cache_current(void);
+
 //! Memory configuration for a shared L1 icache and dcache of 8 banks.
 static loki_memory_cache_configuration_t const loki_memory_cache_configuration_id8 = {
 	  .banks = {
@@ -16,6 +16,7 @@
 #define LOKI_PATTERN_DATAFLOW_H_
 
 #include <loki/types.h>
+#include <stdbool.h>
 
 //! Function to run for a dataflow.
 typedef void (*dataflow_func)(void);
@@ -88,4 +89,138 @@ void end_parallel_section(void);
   :outputs:inputs:clobbered\
 )
 
+
+//============================================================================//
+// Dataflow graphs
+//
+//   A graph of nodes connected by edges, which the library places onto cores
+//   (across several tiles if necessary) and routes automatically.
+//============================================================================//
+
+//! Maximum number of nodes in a \ref dataflow_graph. Each node uses one core.
+#define DATAFLOW_MAX_NODES (CORES_PER_TILE * COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS)
+//! Maximum number of edges in a \ref dataflow_graph.
+#define DATAFLOW_MAX_EDGES (2 * DATAFLOW_MAX_NODES)
+//! Maximum number of input ports of one node.
+#define DATAFLOW_MAX_INPUTS 3
+//! \brief Input channel a node receives from on input `port`.
+//!
+//! Ports start after `CH_REGISTER_3` and stop before `CH_REGISTER_7`, which
+//! carry the tokens joining the graph's execution on core 0 of each tile.
+#define DATAFLOW_INPUT_CHANNEL(port) (CH_REGISTER_4 + (port))
+//! Maximum number of output ports of one node.
+#define DATAFLOW_MAX_OUTPUTS 4
+//! \brief Maximum number of routes leaving one function node.
+//!
+//! All of a port's destinations on the node's own tile which use the same
+//! input port share one multicast route. Every other destination needs a
+//! route of its own.
+#define DATAFLOW_MAX_ROUTES 10
+//! \brief Channel map table entry a packet node uses to send on output `port`.
+//!
+//! A packet node's port must have a single route: all of its destinations must
+//! be on the node's tile, and use the same input port.
+#define DATAFLOW_OUTPUT_ENTRY(port) (4 + (port))
+
+//! \brief Function executed each time a node fires.
+//!
+//! \param inputs One value received from each input port.
+//! \param outputs Space for one value to send from each output port.
+//! \return False to stop the node. Nodes with no inputs (sources) fire until
+//!         they return false; other nodes usually stop when their inputs end.
+typedef bool (*dataflow_node_func)(const int* inputs, int* outputs);
+
+//! Kinds of node in a \ref dataflow_graph.
+enum dataflow_node_kind {
+  DATAFLOW_NODE_FUNCTION, //!< A C function, called once per set of inputs.
+  DATAFLOW_NODE_PACKET    //!< A function built around \ref DATAFLOW_PACKET.
+};
+
+//! One node of a \ref dataflow_graph.
+typedef struct {
+  enum dataflow_node_kind kind;     //!< How the node executes.
+  dataflow_node_func      function; //!< Function for \ref DATAFLOW_NODE_FUNCTION.
+  dataflow_func           packet;   //!< Function for \ref DATAFLOW_NODE_PACKET.
+  unsigned char           inputs;   //!< Number of input ports.
+  unsigned char           outputs;  //!< Number of output ports.
+} dataflow_node;
+
+//! One edge of a \ref dataflow_graph.
+typedef struct {
+  unsigned char from;        //!< Source node.
+  unsigned char output;      //!< Output port of the source node.
+  unsigned char to;          //!< Destination node.
+  unsigned char input;       //!< Input port of the destination node.
+} dataflow_edge;
+
+//! \brief A dataflow graph. Build with \ref dataflow_graph_init and the
+//! functions which follow it.
+//!
+//! An output port may have any number of edges (fan-out): each value is sent
+//! along all of them. An input port may have any number of edges (fan-in):
+//! values from all of them are merged in the order they arrive. A node fires
+//! once it has a value on each of its input ports.
+//!
+//! Nodes are placed on consecutive cores in the order they are added, starting
+//! with core 0 of the current tile, so nodes which communicate most should be
+//! added close together.
+typedef struct {
+  int           end_of_stream;   //!< Value which marks the end of a stream.
+  uint          nodes;           //!< Number of nodes.
+  uint          edges;           //!< Number of edges.
+  uint          packets;         //!< Number of packet nodes.
+  tile_id_t     first_tile;      //!< Tile holding node 0. Set when run.
+  dataflow_node node[DATAFLOW_MAX_NODES];
+  dataflow_edge edge[DATAFLOW_MAX_EDGES];
+} dataflow_graph;
+
+//! \brief Prepare an empty graph.
+//!
+//! \param end_of_stream Special value which marks the end of a stream. It must
+//!        never be sent as ordinary data.
+void dataflow_graph_init(dataflow_graph* graph, int end_of_stream);
+
+//! \brief Add a node which executes a C function.
+//! \return The new node's id.
+int dataflow_graph_add_function(dataflow_graph* graph, dataflow_node_func func,
+                                int inputs, int outputs);
+
+//! \brief Add a node which executes a looping instruction packet.
+//!
+//! `func` must use \ref DATAFLOW_PACKET (or a variant), receiving from input
+//! port `n` on register `4 + n` and sending from output port `n` on channel map
+//! table entry \ref DATAFLOW_OUTPUT_ENTRY(n). Packet nodes know nothing of the
+//! end of the stream: they are stopped once every function node has
+//! finished. Any function node fed by a packet node must therefore still
+//! receive the end-of-stream value, for example by the packet passing it on
+//! unchanged.
+//!
+//! \return The new node's id.
+int dataflow_graph_add_packet(dataflow_graph* graph, dataflow_func func,
+                              int inputs, int outputs);
+
+//! Send values from output port `output` of node `from` to input port `input`
+//! of node `to`.
+void dataflow_graph_connect(dataflow_graph* graph, int from, int output,
+                            int to, int input);
+
+//! \brief Execute a graph to completion.
+//!
+//! Each function node stops when it returns false, or when every edge into one
+//! of its input ports has delivered the end of the stream. It then discards
+//! any remaining input until all of its input edges have ended, and sends the
+//! end of the stream along each of its output edges. So once its sources
+//! stop, an acyclic graph drains completely, leaving no data in any channel.
+//! Packet nodes are then stopped, and this function returns.
+//!
+//! Node 0 runs on this core, and must be a function node.
+//!
+//! \warning Overwrites channel map table entries 2 and 3 on every core used,
+//! and takes its routes from \ref channel_map_alloc (packet nodes use \ref
+//! channel_map_reserve).
+//! Uses `CH_REGISTER_3` to `CH_REGISTER_7`. Has the same requirements as
+//! \ref loki_execute_async. Only one graph containing packet nodes may run at
+//! a time.
+void dataflow_graph_run(dataflow_graph* graph);
+
 #endif
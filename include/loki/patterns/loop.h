@@ -18,6 +18,82 @@ typedef void (*helper_func)(void);
 typedef void (*tidy_func)(int cores, int iterations, int coreid);
 //! Function to combine parallel results.
 typedef void (*reduce_func)(int cores);
+//! Function returning one core's partial result, for in-network reduction.
+typedef int (*partial_func)(int coreid);
+//! \brief Function combining two partial results, for in-network reduction.
+//! Both arguments and the result hold 32-bit values of the reduction's type.
+typedef int (*combine_func)(int a, int b);
+
+//! Ways of dividing the iterations of a \ref simd_loop between cores.
+enum loop_schedule {
+  //! Core n executes iterations n, n+cores, n+2*cores, ... (default).
+  LOOP_SCHEDULE_STRIPED = 0,
+  //! Each core executes a single contiguous block of iterations. Blocks differ
+  //! in size by at most one iteration.
+  LOOP_SCHEDULE_BLOCKED,
+  //! Blocks of `chunk_size` consecutive iterations are dealt out to the cores
+  //! in turn.
+  LOOP_SCHEDULE_CHUNKED,
+  //! Each tile receives a contiguous block of iterations, and its cores claim
+  //! chunks from that block as they become free. Chunks start large and shrink
+  //! towards `chunk_size` (minimum 1) as the block is used up.
+  LOOP_SCHEDULE_GUIDED
+};
+
+//! Operations available for in-network reduction of a \ref simd_loop.
+enum loop_reduce_op {
+  LOOP_REDUCE_NONE = 0,   //!< No in-network reduction (default).
+  LOOP_REDUCE_SUM,        //!< Sum of all partial results.
+  LOOP_REDUCE_MIN,        //!< Minimum of all partial results.
+  LOOP_REDUCE_MAX,        //!< Maximum of all partial results.
+  LOOP_REDUCE_CUSTOM      //!< Combine partial results with a user function.
+};
+
+//! Types of value which can be reduced in the network. All fill one word.
+enum loop_reduce_type {
+  LOOP_REDUCE_INT = 0,    //!< `int`
+  LOOP_REDUCE_FLOAT,      //!< `float`
+  LOOP_REDUCE_V2INT16,    //!< `v2int16_t`, reduced element-wise.
+  LOOP_REDUCE_V4INT8      //!< `v4int8_t`, reduced element-wise.
+};
+
+//! \brief Description of a reduction performed as cores finish a \ref
+//! simd_loop.
+//!
+//! Each core's partial result is passed up a log-depth tree of cores along
+//! with the completion signal, and combined at each step. Core 0 receives the
+//! final value. Partial results never pass through memory, so no reads of
+//! other cores' data (or flushes between tiles) are needed.
+//!
+//! The combining operation must be associative and commutative: partial
+//! results may be combined in any order.
+typedef struct {
+  enum loop_reduce_op   op;           //!< Operation to apply
+  enum loop_reduce_type type;         //!< Type of the partial results (ignored for \ref LOOP_REDUCE_CUSTOM)
+  partial_func          partial;      //!< Function returning each core's partial result
+  combine_func          combine;      //!< Combining function for \ref LOOP_REDUCE_CUSTOM
+  int*                  result;       //!< Where core 0 stores the final value (optional)
+} loop_reduction;
+
+//! Number of streams \ref simd_loop can prefetch for.
+#define LOOP_PREFETCH_STREAMS 2
+
+//! \brief An array read by a \ref simd_loop, for prefetching.
+//!
+//! Iteration `i` is assumed to read the cache line holding
+//! `base + i * stride`. Each core prefetches the line its own iteration
+//! `distance` iterations ahead will read, whenever that is a new line, so
+//! misses overlap with the computation of earlier iterations. Prefetches do
+//! not run past the end of a core's block or chunk.
+//!
+//! The best distance depends on the cost of an iteration: enough iterations to
+//! cover a miss, but few enough that lines are not evicted before use. Wrap the
+//! loop in \ref LOKI_PROF_BEGIN / \ref LOKI_PROF_END and compare distances.
+typedef struct {
+  const void* base;      //!< Address read by iteration 0 (NULL: no prefetching)
+  int         stride;    //!< Bytes between the data of consecutive iterations
+  int         distance;  //!< Iterations ahead to prefetch (default: 4 cache lines' worth)
+} loop_prefetch;
 
 //! Information required to describe the parallel execution of a loop.
 typedef struct {
@@ -29,21 +105,57 @@ typedef struct {
   helper_func         helper;         //!< Function to execute data-independent code (optional)
   tidy_func           tidy;           //!< Function run on each core after the loop finishes (optional)
   reduce_func         reduce;         //!< Function which combines all partial results (optional)
+  enum loop_schedule  schedule;       //!< Mapping of iterations to cores in \ref simd_loop (optional)
+  int                 chunk_size;     //!< Chunk size for chunked and guided schedules, or block size for \ref worker_farm
+  loop_reduction      reduction;      //!< In-network reduction performed by \ref simd_loop (optional)
+  loop_prefetch       prefetch[LOOP_PREFETCH_STREAMS]; //!< Arrays for \ref simd_loop to prefetch (optional)
 } loop_config;
 
 //! \brief Run a loop described by config, with a fixed mapping of iterations to
 //! cores.
 //!
-//! \warning Overwrites channel map table entries 2, 3, replaces and restores 8 and uses `CH_REGISTER_3`.
+//! `config->schedule` selects how iterations are divided between cores. Any
+//! division required is done once per core (or once per chunk for guided
+//! scheduling), so the inner loop is as tight as the default striped loop.
+//! Schedules other than \ref LOOP_SCHEDULE_STRIPED may not be combined with a
+//! `helper` function.
+//!
+//! If `config->reduction` is set, it is completed before `config->reduce` is
+//! called. In-network reduction may not be combined with a `helper` function.
+//!
+//! Streams in `config->prefetch` are prefetched into the L1 ahead of each
+//! core's iterations (see \ref loop_prefetch). They are ignored if there is a
+//! `helper` function.
+//!
+//! \warning Overwrites channel map table entries 2, 3, reserves and restores 8 and uses `CH_REGISTER_3`
+//! (and `CH_REGISTER_7` on core 0 of each tile when using multiple tiles).
 void simd_loop(const loop_config* config);
 
 //! \brief Run a loop described by config, dynamically allocating iterations to
 //! cores as they become available.
 //!
-//! `config->cores` must be at least 2 and at most 6.
+//! `config->cores` must be at least 2, and may span multiple tiles. Core 0 of
+//! each tile acts as a sub-master: it claims blocks of `config->chunk_size`
+//! iterations (default 4 per worker on the tile) from a counter shared by all
+//! tiles, and hands them out one at a time to the other cores on its tile.
+//! Workers are numbered consecutively from 0, skipping the sub-masters, and
+//! `config->reduce` receives the number of workers. `config->schedule` is
+//! ignored, as is `config->reduction`.
+//!
+//! Each worker is always granted one iteration ahead of the one it is
+//! executing, so short iterations need not wait for a round trip to the
+//! sub-master. When a worker is told to stop, it reports back once its last
+//! iteration has finished, so `config->reduce` runs only after every
+//! iteration.
 //!
-//! \warning Overwrites channel map table entries 2, 3 and uses `CH_REGISTER_3`,
-//! `CH_REGISTER_4`, `CH_REGISTER_5`, `CH_REGISTER_6`, `CH_REGISTER_7`.
+//! \warning Overwrites channel map table entries 2, 3, reserves and restores 8
+//! to 14 and uses `CH_REGISTER_3` and `CH_REGISTER_7`.
 void worker_farm(const loop_config* config);
 
+//! \brief Average number of cycles that each iteration of the most recent
+//! \ref worker_farm spent waiting to be dispatched to a worker.
+//!
+//! Only valid on the core which called \ref worker_farm.
+uint worker_farm_dispatch_cycles(void);
+
 #endif
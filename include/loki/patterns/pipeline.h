@@ -9,12 +9,20 @@
  * pipeline stages, instead of requiring an intermediate buffer. Exactly one
  * core must execute the end_parallel_section function when all results have
  * been produced.
+ *
+ * A data driven pipeline may also carry items of several words, send several
+ * items in each network transfer, and run a slow stage on several cores. Items
+ * are dealt out to a replicated stage's cores in turn, a batch at a time, and
+ * the next stage collects their results in the same order, so the stream is
+ * never reordered. Once the first stage ends the stream, the last stage ends
+ * the parallel section itself.
  */
 
 #ifndef LOKI_PATTERN_PIPELINE_H_
 #define LOKI_PATTERN_PIPELINE_H_
 
 #include <loki/types.h>
+#include <stdbool.h>
 
 //! Function to run once to on each core to initialise a stage.
 typedef void (*pipeline_init_func)(void);
@@ -24,6 +32,14 @@ typedef void (*pipeline_func)(int iteration);
 //!
 //! The first stage always gets an incrementing value at the input.
 typedef int  (*dd_pipeline_func)(int arg);
+//! \brief Function to execute a data driven stage on one multi-word item.
+//!
+//! \param index Position of the item in the stream.
+//! \param input The item, of `payload_words` words. NULL for the first stage.
+//! \param output Space for the `payload_words` words to pass on.
+//! \return For the first stage, false if there are no more items. Ignored for
+//!         all other stages.
+typedef bool (*dd_pipeline_item_func)(int index, const int* input, int* output);
 //! Function to tidy after each stage.
 typedef void (*pipeline_tidy_func)(void);
 
@@ -34,25 +50,69 @@ typedef struct {
   pipeline_init_func* initialise;     //!< Array of initialisation functions for each stage (optional).
   pipeline_func*      stage_func;     //!< A function for each pipeline stage
   pipeline_tidy_func* tidy;           //!< Array of tidy up functions for each stage (optional).
+  int                 max_run_ahead;  //!< Number of iterations a stage may get ahead of the next one (optional).
 } pipeline_config;
 
-//! Start a pipeline pattern with the given config.
+//! \brief Start a pipeline pattern with the given config.
+//!
+//! Stage `n` runs on core `n % CORES_PER_TILE` of the `n / CORES_PER_TILE`th
+//! tile after the current one, so a pipeline of more than \ref CORES_PER_TILE
+//! stages spans several tiles.
+//!
+//! Pipelines which span several tiles, or which set `max_run_ahead`, connect
+//! neighbouring stages with credit-based core-to-core channels: a stage may
+//! then start an iteration once its predecessor has finished it, and while
+//! its successor is fewer than `max_run_ahead` iterations behind (default
+//! \ref CORE_INPUT_BUFFER_DEPTH). Each stage's progress is reported in counts
+//! rather than one token per iteration, so a stage may run ahead by more than
+//! the channel can buffer. These pipelines are started using \ref
+//! loki_execute_async, and the arrays of functions must already be visible
+//! to all tiles (for example, initialised statically, or flushed).
 //!
-//! \warning Overwrites channel map table entries 2, 3, replaces and restores 8 and uses `CH_REGISTER_3`.
+//! \warning Overwrites channel map table entries 2, 3, reserves and restores 8 and uses `CH_REGISTER_3`.
+//! Pipelines which span several tiles or set `max_run_ahead` also reserve and
+//! restore entry 9, and use `CH_REGISTER_4`. Tiles must be initialised with
+//! \ref loki_init.
 void pipeline_loop(const pipeline_config* config);
 
-//! Information required to describe a data driven pipeline with one core per stage.
+//! \brief Information required to describe a data driven pipeline.
+//!
+//! By default there is one core per stage, and each item is a single `int`
+//! sent on its own. The optional fields at the end change this; leaving them
+//! all zero gives the original behaviour.
 typedef struct {
   int                 cores;               //!< Number of cores.
   int                 end_of_stream_token; //!< Special return value which will signal the end of the pipeline.
   pipeline_init_func* initialise;          //!< Array of initialisation functions for each stage (optional).
   dd_pipeline_func*   stage_tasks;         //!< A function for each pipeline stage
   pipeline_tidy_func* tidy;                //!< Array of tidy up functions for each stage (optional).
+
+  int                    payload_words;    //!< Words per item. If non-zero, `stage_items` is used instead of `stage_tasks` (optional).
+  dd_pipeline_item_func* stage_items;      //!< A function for each stage, for multi-word items.
+  int                    batch_size;       //!< Items sent in each network transfer (optional).
+  int                    stages;           //!< Number of stages, if `replicas` is given.
+  const int*             replicas;         //!< Number of cores running each stage, which must add up to `cores` (optional). The first stage must have one core, and no stage may follow one with more than 5 (3 if the pipeline spans several tiles).
 } dd_pipeline_config;
 
 //! Start a data driven pipeline pattern with the given config.
 //!
-//! \warning Overwrites channel map table entries 2, 3, replaces and restores 8 and uses `CH_REGISTER_3`.
+//! Cores are numbered as the stages of \ref pipeline_loop, so a pipeline of
+//! more than \ref CORES_PER_TILE cores spans several tiles. Its cores are then
+//! started using \ref loki_execute_async, with the same requirements as a
+//! \ref pipeline_loop spanning several tiles, and neighbouring cores are
+//! connected with credit-based core-to-core channels.
+//!
+//! With any of the optional fields set, or on several tiles, a batch of items
+//! is sent to a stage on the input channel numbered 3 (4 on several tiles)
+//! plus the position of the sending core within its own stage, and the buffers
+//! for one batch are held on each core's stack.
+//!
+//! \warning Overwrites channel map table entries 2, 3, reserves and restores 8 and uses `CH_REGISTER_3`.
+//! With any of the optional fields set, or on several tiles, each core takes
+//! one entry from \ref channel_map_alloc for each core of the next stage
+//! instead of entry 8. With replicated stages, `CH_REGISTER_4` to
+//! `CH_REGISTER_7` may also be used; on several tiles, `CH_REGISTER_4` to
+//! `CH_REGISTER_6` are used, and tiles must be initialised with \ref loki_init.
 void dd_pipeline_loop(const dd_pipeline_config* config);
 
 #include <loki/patterns/dataflow.h> // For end_parallel_section.
@@ -0,0 +1,66 @@
+/*! \file tasks.h
+ * \brief Header file for the work-stealing task pattern.
+ *
+ * Suitable for recursive, divide-and-conquer workloads. Any task may spawn
+ * further tasks, and later wait for them to complete. Each core keeps its own
+ * tasks in a deque in its tile's memory. Idle cores steal the oldest task from
+ * other cores on their own tile, and then from tasks which busy cores have
+ * offered to other tiles.
+ *
+ * Tasks receive their arguments by value and return a single word, so they may
+ * be executed on any tile. Any other memory written by a task is subject to
+ * the usual coherence rules: it must be flushed before the task returns if
+ * another tile needs to see it.
+ */
+
+#ifndef LOKI_PATTERN_TASKS_H_
+#define LOKI_PATTERN_TASKS_H_
+
+#include <loki/types.h>
+
+//! Number of argument words copied into each task.
+#define LOKI_TASK_ARGS 4
+
+//! Function executed by a task. `args` holds \ref LOKI_TASK_ARGS words.
+typedef int (*loki_task_func)(const int* args);
+
+//! Handle for a spawned task, used to wait for its result.
+typedef uint loki_task;
+
+//! \brief Run `root` on a work-stealing scheduler of `cores` cores, and return
+//! its result.
+//!
+//! All cores other than the caller look for tasks to steal until `root`
+//! returns. The scheduler is started with \ref loki_execute_async, so the cores
+//! used are from core 0 of the current tile onwards.
+//!
+//! \param cores Number of cores in the scheduler.
+//! \param root The first task.
+//! \param args \ref LOKI_TASK_ARGS words of arguments for `root`.
+//!
+//! \warning Must be executed on core 0.
+//! \warning Overwrites channel map table entry 2, reserves and restores 8 on
+//! all cores and uses `CH_REGISTER_3` and `CH_REGISTER_7`.
+int loki_tasks_run(const uint cores, loki_task_func root, const int* args);
+
+//! \brief Create a task which may be executed by any core in the scheduler.
+//!
+//! At most 16 tasks spawned by one core may be waiting to be synchronised.
+//!
+//! \param func Function to execute.
+//! \param args \ref LOKI_TASK_ARGS words of arguments, which are copied.
+//! \return A handle to pass to \ref loki_task_sync.
+//!
+//! \warning May only be called from within a task.
+loki_task loki_task_spawn(loki_task_func func, const int* args);
+
+//! \brief Wait for a spawned task to complete, and return its result.
+//!
+//! If the task has not been stolen, it is executed immediately by this core.
+//! Otherwise, this core executes other tasks until the thief has finished.
+//! Tasks must be synchronised in the reverse of the order they were spawned.
+//!
+//! \warning May only be called from within the task which spawned `task`.
+int loki_task_sync(loki_task task);
+
+#endif
@@ -0,0 +1,100 @@
+/*! \file placement.h
+ * \brief Homing data on a chosen tile's L2, by redirecting spare directory
+ * entries.
+ *
+ * A compute tile configured with \ref loki_memory_cache_configuration_l2 can
+ * serve as an L2 cache for the other tiles. Rather than reconfiguring whole
+ * directories, this layer takes entries which the program never otherwise
+ * uses, and points each of them at one L2 tile. Data placed on that tile is
+ * then accessed through an *alias*: its address with the directory bits (see
+ * memory.h) replaced by the entry's index. The directory forwards misses on
+ * the alias to the L2 tile, restoring the original bits, so the L2 caches the
+ * data under its real address and fetches it from main memory as usual.
+ *
+ * One entry serves every range on the same L2 tile with the same original
+ * directory bits, so a program whose data sits in one directory segment needs
+ * one entry per L2 tile.
+ *
+ * The placement table is kept by core 0 of the first tile, which makes all
+ * placements, like \ref loki_malloc.
+ */
+
+#ifndef LOKI_PLACEMENT_H_
+#define LOKI_PLACEMENT_H_
+
+#include <loki/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//! Description of the directories and tiles available for placement.
+typedef struct {
+  //! Directory `mask_index` in effect on every tile (see
+  //! \ref loki_memory_directory_configuration_t).
+  unsigned char mask_index;
+  //! One bit per directory entry which may be redirected. Addresses selecting
+  //! these entries must not otherwise be accessed on any tile.
+  uint16_t      entries;
+  //! Number of compute tiles, starting at global tile 0, whose cores may
+  //! access placed data. Their directories are all updated.
+  uint          tiles;
+  //! One bit per global tile number of the tiles configured as L2s, for
+  //! \ref loki_alloc_near.
+  uint16_t      l2_tiles;
+} loki_placement_config;
+
+//! \brief Start a new placement table, forgetting all previous placements.
+//!
+//! Entries redirected by earlier placements are not restored.
+//!
+//! \warning Must be executed on core 0 of the first tile.
+void loki_placement_init(const loki_placement_config* config);
+
+//! \brief Have a range of memory served by `tile`'s L2.
+//!
+//! \param ptr Start of the range.
+//! \param len Size of the range in bytes. The range must lie within one
+//!        aligned block of `1 << mask_index` bytes.
+//! \param tile The L2 tile to serve the range.
+//! \return The alias through which the range must now be accessed, on every
+//!         tile. `ptr` itself continues to bypass the L2.
+//!
+//! Reuses the entry of an earlier placement on the same tile if it has the
+//! same directory bits; otherwise, redirects a new entry on every tile, using
+//! core 0 of each other tile. Lines of the range in this tile's L1 are flushed
+//! and invalidated first.
+//!
+//! \warning Must be executed on core 0 of the first tile, with the other tiles'
+//! core 0 idle. No other tile may hold modified copies of the range. Overwrites
+//! channel map table entry 2, and uses `CH_REGISTER_3` on other tiles.
+void* loki_place_range(void* ptr, size_t len, tile_id_t tile);
+
+//! \brief Allocate memory served by `tile`'s L2.
+//!
+//! As \ref loki_malloc followed by \ref loki_place_range, except that the
+//! block is guaranteed to lie within one block of `1 << mask_index` bytes.
+//!
+//! \return The alias of the block, to be freed with \ref loki_free_placed, or
+//!         NULL if there was not enough memory.
+//!
+//! \warning Has the same requirements as \ref loki_place_range.
+void* loki_alloc_on_tile(size_t size, tile_id_t tile);
+
+//! \brief Allocate memory served by the L2 tile nearest to `user`.
+//!
+//! "Nearest" counts network hops between tiles. Use the tile of the cores
+//! which will access the data most, so each one's misses have a short trip.
+//!
+//! \warning Has the same requirements as \ref loki_place_range.
+void* loki_alloc_near(size_t size, tile_id_t user);
+
+//! The L2 tile nearest to `user`, from those in the placement configuration.
+tile_id_t loki_nearest_l2(tile_id_t user);
+
+//! \brief Free a block from \ref loki_alloc_on_tile or \ref loki_alloc_near.
+//!
+//! The directory entry stays in place for other placements.
+//!
+//! \warning Must be executed on core 0 of the first tile.
+void loki_free_placed(void* alias);
+
+#endif
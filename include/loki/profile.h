@@ -0,0 +1,126 @@
+/*! \file profile.h
+ * \brief Lightweight profiling of code regions on each core.
+ *
+ * Wrap a region of code in \ref LOKI_PROF_BEGIN and \ref LOKI_PROF_END with the
+ * same id. Each core accumulates the cycles (COUNT0) and instructions (COUNT1)
+ * spent in the region, and how many times it was entered. Regions with
+ * different ids may nest freely; re-entering a region which is already active
+ * on the same core (e.g. through recursion) is only measured once, at the
+ * outermost level.
+ *
+ * Counters live in a block of cache lines private to each core, so they stay
+ * in the L1 and cause no memory traffic until \ref loki_prof_report.
+ *
+ * The macros only do anything when `LOKI_PROFILE` is defined. The library's
+ * own patterns are instrumented with the built-in ids below, so build the
+ * library with `make PROFILE=1` to measure them.
+ *
+ * \warning Assumes that COUNT0 is dedicated to counting cycles and COUNT1 to
+ * counting instructions, as \ref get_cycle_count and \ref
+ * get_instruction_count do.
+ */
+
+#ifndef LOKI_PROFILE_H_
+#define LOKI_PROFILE_H_
+
+#include <loki/control_registers.h>
+#include <loki/ids.h>
+#include <loki/types.h>
+
+//! Regions measured by the library itself. Other ids are free for programs.
+enum loki_prof_id {
+  LOKI_PROF_LAUNCH = 0,  //!< Starting cores in parallel patterns.
+  LOKI_PROF_BARRIER,     //!< Synchronisation and joins.
+  LOKI_PROF_REDUCE,      //!< Combining results as cores finish.
+  LOKI_PROF_DISPATCH,    //!< Handing out work in farms, task pools and schedulers.
+  LOKI_PROF_USER         //!< First id available to programs.
+};
+
+//! Number of region ids available.
+#define LOKI_PROF_IDS 16
+
+//! Accumulated measurements of one region on one core.
+typedef struct {
+  uint depth;              //!< Number of active entries to the region.
+  uint calls;              //!< Number of times the region was entered.
+  uint cycles;             //!< Total cycles spent in the region.
+  uint instructions;       //!< Total instructions executed in the region.
+  uint start_cycles;       //!< COUNT0 when the region was entered.
+  uint start_instructions; //!< COUNT1 when the region was entered.
+} loki_prof_counter;
+
+//! All of one core's counters, on cache lines of their own.
+typedef struct {
+  loki_prof_counter counters[LOKI_PROF_IDS];
+} __attribute__((aligned(32))) loki_prof_core;
+
+//! Counters of every core on the chip, indexed by `tile * CORES_PER_TILE + core`.
+extern loki_prof_core loki_prof_cores[CORES_PER_TILE * COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS];
+
+//! This core's counter for region `id`.
+static inline loki_prof_counter* loki_prof_counter_get(const uint id) {
+  const uint core = tile2int(get_tile_id()) * CORES_PER_TILE + get_core_id();
+  return &loki_prof_cores[core].counters[id];
+}
+
+//! Enter region `id`. Use \ref LOKI_PROF_BEGIN instead.
+static inline void loki_prof_begin(const uint id) {
+  loki_prof_counter* counter = loki_prof_counter_get(id);
+  counter->calls++;
+
+  if (counter->depth++ == 0) {
+    start_counting_cycles();
+    start_counting_instructions();
+    counter->start_instructions = get_control_register(CR_COUNT1);
+    counter->start_cycles = get_control_register(CR_COUNT0);
+  }
+}
+
+//! Leave region `id`. Use \ref LOKI_PROF_END instead.
+static inline void loki_prof_end(const uint id) {
+  const uint cycles = get_control_register(CR_COUNT0);
+  const uint instructions = get_control_register(CR_COUNT1);
+  loki_prof_counter* counter = loki_prof_counter_get(id);
+
+  if (--counter->depth == 0) {
+    counter->cycles += cycles - counter->start_cycles;
+    counter->instructions += instructions - counter->start_instructions;
+  }
+}
+
+#ifdef LOKI_PROFILE
+//! \brief Start measuring region `id` on this core.
+//!
+//! \remark About 20 cycles, most of which are not attributed to the region.
+#define LOKI_PROF_BEGIN(id) loki_prof_begin(id)
+//! \brief Stop measuring region `id` on this core.
+//!
+//! \remark About 15 cycles, most of which are not attributed to the region.
+#define LOKI_PROF_END(id) loki_prof_end(id)
+#else
+#define LOKI_PROF_BEGIN(id) ((void)0)
+#define LOKI_PROF_END(id) ((void)0)
+#endif
+
+//! \brief Give region `id` a name to use in \ref loki_prof_report.
+//!
+//! `name` is not copied. Must be executed on the core which will call \ref
+//! loki_prof_report.
+void loki_prof_name(uint id, const char* name);
+
+//! Clear all of this core's counters.
+void loki_prof_reset(void);
+
+//! \brief Gather every core's counters and print a table of them.
+//!
+//! Each of the first `cores` cores flushes its counters (using
+//! \ref loki_execute_async), then this core reads them back and prints, for
+//! every region entered at least once: the total number of calls, cycles and
+//! instructions across all cores, the average cycles per call, and the largest
+//! number of cycles spent by any one core.
+//!
+//! \warning Must be executed on core 0 of the first tile, with all of the
+//! other cores idle. Has the same requirements as \ref loki_execute_async.
+void loki_prof_report(uint cores);
+
+#endif
@@ -0,0 +1,168 @@
+/*! \file queue.h
+ * \brief Queues which stream data between tiles without a round trip to main
+ * memory.
+ *
+ * Each message occupies one cache line: \ref LOKI_QUEUE_PAYLOAD_WORDS words of
+ * payload followed by a sequence number. Producers write messages straight
+ * into the consumer's L1 with \ref loki_memory_push_cache_line, and the
+ * consumer polls the sequence number of the next line, which is an L1 hit, to
+ * see when it has arrived.
+ *
+ * Flow control is the only traffic to main memory: the consumer publishes how
+ * many messages it has received every half-queue, and a producer only reads
+ * this back when it believes the queue is full. In a multi-producer queue,
+ * producers also reserve each message's position with an atomic increment.
+ *
+ * Pushes are routed using a directory entry on the producer's tile, which
+ * \ref loki_queue_producer_init redirects to the consumer's tile. That entry
+ * must be reserved for the queue: any other access from the producer's tile to
+ * addresses which select it will also be sent to the consumer's tile.
+ */
+
+#ifndef LOKI_QUEUE_H_
+#define LOKI_QUEUE_H_
+
+#include <loki/channels.h>
+#include <loki/types.h>
+#include <stdbool.h>
+
+//! Number of words of payload carried by each message.
+#define LOKI_QUEUE_PAYLOAD_WORDS 7
+
+//! One message, occupying a single cache line.
+typedef struct {
+  int           payload[LOKI_QUEUE_PAYLOAD_WORDS]; //!< Message contents.
+  volatile uint sequence; //!< One more than the message's position in the stream.
+} __attribute__((aligned(32))) loki_queue_slot;
+
+//! \brief Description of a queue, shared by its producers and consumer.
+//!
+//! Create using \ref loki_queue_init. The counters are on separate cache lines
+//! and are only ever accessed uncached, so they are coherent across tiles.
+typedef struct {
+  loki_queue_slot         *slots;          //!< Ring of `capacity` messages.
+  uint                     capacity;       //!< Number of slots. A power of two.
+  tile_id_t                consumer_tile;  //!< Tile whose L1 receives pushes.
+  enum Memories            group_start;    //!< Consumer's L1 data configuration.
+  enum MemConfigGroupSize  group_size;     //!< Consumer's L1 data configuration.
+  bool                     multi_producer; //!< Whether producers reserve positions.
+  int                      padding[2];
+
+  volatile uint            reserved __attribute__((aligned(32))); //!< Next position to hand out (multi-producer only).
+  int                      padding1[7];
+  volatile uint            consumed __attribute__((aligned(32))); //!< Messages received, published periodically.
+  int                      padding2[7];
+} __attribute__((aligned(32))) loki_queue;
+
+//! State private to one producer.
+typedef struct {
+  loki_queue     *queue;           //!< Queue being written.
+  uint            next;            //!< Next position to write (single producer only).
+  uint            limit;           //!< Positions below this are known to be free.
+  unsigned char   mask_index;      //!< Producer tile's directory mask index.
+  unsigned char   directory_index; //!< Directory entry routing to the consumer.
+} loki_queue_producer;
+
+//! State private to the consumer.
+typedef struct {
+  loki_queue     *queue;           //!< Queue being read.
+  uint            next;            //!< Next position to read.
+} loki_queue_consumer;
+
+//! \brief Prepare a queue.
+//!
+//! \param queue Queue to initialise.
+//! \param slots Line-aligned storage for `capacity` messages. It must lie
+//!        entirely within one directory segment (see memory.h), and must not
+//!        be used for anything else while the queue exists.
+//! \param capacity Number of messages which can be in flight. Must be a power
+//!        of two, and at least 2.
+//! \param consumer_tile Tile on which the consumer will run.
+//! \param consumer_memory The consumer's data memory channel (usually its
+//!        channel map table entry 1), from which the L1 group configuration
+//!        is taken. Pass 0 to use this core's entry 1.
+//! \param multi_producer Whether more than one core will send to the queue.
+//!
+//! May be executed on any tile. The queue descriptor and slots are flushed to
+//! main memory, so they must then be passed to the consumer and producers
+//! before they use the queue.
+//!
+//! \warning Overwrites channel map table entry 2.
+void loki_queue_init(loki_queue* queue, loki_queue_slot* slots, uint capacity,
+                     tile_id_t consumer_tile, channel_t consumer_memory,
+                     bool multi_producer);
+
+//! \brief Prepare to send to a queue from this core.
+//!
+//! Redirects entry `directory_index` of this tile's directory to the consumer's
+//! tile, so that pushed lines arrive at the right address in the consumer's L1.
+//! All producers on one tile which send to the same consumer tile may share an
+//! entry.
+//!
+//! \param producer State to initialise.
+//! \param queue Queue to send to.
+//! \param mask_index The directory mask index currently used on this tile (see
+//!        \ref loki_memory_directory_configuration_t).
+//! \param directory_index A directory entry reserved for the queue. No other
+//!        data accessed from this tile may map to it.
+//!
+//! \warning Changes this tile's directory, which affects all cores on the
+//! tile. Restore the entry with \ref loki_memory_directory_l1_entry_update
+//! once the queue is no longer needed.
+void loki_queue_producer_init(loki_queue_producer* producer, loki_queue* queue,
+                              unsigned char mask_index,
+                              unsigned char directory_index);
+
+//! \brief Prepare to receive from a queue on this core.
+//!
+//! Discards any stale copies of the queue from this tile's L1.
+//!
+//! \warning Must be executed on the queue's `consumer_tile`, before any
+//! producer sends to the queue.
+void loki_queue_consumer_init(loki_queue_consumer* consumer, loki_queue* queue);
+
+//! \brief Send one message, waiting until there is space in the queue.
+//!
+//! \param payload \ref LOKI_QUEUE_PAYLOAD_WORDS words to send.
+//!
+//! \warning Overwrites channel map table entry 2.
+void loki_queue_send(loki_queue_producer* producer, const int* payload);
+
+//! \brief Receive the next message, if one has arrived.
+//!
+//! \param payload Receives \ref LOKI_QUEUE_PAYLOAD_WORDS words.
+//! \return Whether a message was received.
+//!
+//! \warning Overwrites channel map table entry 2.
+bool loki_queue_try_receive(loki_queue_consumer* consumer, int* payload);
+
+//! \brief Receive the next message, waiting until it arrives.
+//!
+//! \param payload Receives \ref LOKI_QUEUE_PAYLOAD_WORDS words.
+//!
+//! \warning Overwrites channel map table entry 2.
+static inline void loki_queue_receive(loki_queue_consumer* consumer,
+                                      int* payload) {
+  while (!loki_queue_try_receive(consumer, payload))
+    ;
+}
+
+//! \brief Send a single word.
+//!
+//! \warning Overwrites channel map table entry 2.
+static inline void loki_queue_send_word(loki_queue_producer* producer,
+                                        int value) {
+  int payload[LOKI_QUEUE_PAYLOAD_WORDS] = {value};
+  loki_queue_send(producer, payload);
+}
+
+//! \brief Receive a single word sent with \ref loki_queue_send_word.
+//!
+//! \warning Overwrites channel map table entry 2.
+static inline int loki_queue_receive_word(loki_queue_consumer* consumer) {
+  int payload[LOKI_QUEUE_PAYLOAD_WORDS];
+  loki_queue_receive(consumer, payload);
+  return payload[0];
+}
+
+#endif
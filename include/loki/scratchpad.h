@@ -19,6 +19,7 @@
 #define LOKI_SCRATCHPAD_H_
 
 #include <assert.h>
+#include <loki/channel_io.h>
 #include <loki/types.h>
 #include <string.h>
 
@@ -50,6 +51,29 @@ static inline void scratchpad_write(unsigned int address, int value) {
   );
 }
 
+//! \brief Read 4 words from the core's local scratchpad. Unrolled version of
+//! \ref scratchpad_read_words.
+static inline void scratchpad_read_words4(int *data, unsigned int address) {
+  data[0] = scratchpad_read(address);
+  data[1] = scratchpad_read(address + 1);
+  data[2] = scratchpad_read(address + 2);
+  data[3] = scratchpad_read(address + 3);
+}
+
+//! \brief Read 8 words from the core's local scratchpad. Unrolled version of
+//! \ref scratchpad_read_words.
+static inline void scratchpad_read_words8(int *data, unsigned int address) {
+  scratchpad_read_words4(data, address);
+  scratchpad_read_words4(data + 4, address + 4);
+}
+
+//! \brief Read 16 words from the core's local scratchpad. Unrolled version of
+//! \ref scratchpad_read_words.
+static inline void scratchpad_read_words16(int *data, unsigned int address) {
+  scratchpad_read_words8(data, address);
+  scratchpad_read_words8(data + 8, address + 8);
+}
+
 //! \brief Read multiple words from the core's local scratchpad. The scratchpad
 //! is word-addressed.
 //! \param data Pointer to the buffer
@@ -59,7 +83,10 @@ static inline void scratchpad_write(unsigned int address, int value) {
 //! The order of arguments for these methods is designed to mimic memcpy.
 static inline void scratchpad_read_words(int *data, unsigned int address, size_t len) {
   size_t i;
-  for (i = 0; i != len; i++) {
+  for (i = 0; i + 4 <= len; i += 4) {
+    scratchpad_read_words4(data + i, address + i);
+  }
+  for (; i != len; i++) {
     data[i] = scratchpad_read(address + i);
   }
 }
@@ -84,6 +111,29 @@ static inline void scratchpad_read_bytes(void *data, unsigned int address, size_
   }
 }
 
+//! \brief Store 4 words in the core's local scratchpad. Unrolled version of
+//! \ref scratchpad_write_words.
+static inline void scratchpad_write_words4(unsigned int address, const int *data) {
+  scratchpad_write(address, data[0]);
+  scratchpad_write(address + 1, data[1]);
+  scratchpad_write(address + 2, data[2]);
+  scratchpad_write(address + 3, data[3]);
+}
+
+//! \brief Store 8 words in the core's local scratchpad. Unrolled version of
+//! \ref scratchpad_write_words.
+static inline void scratchpad_write_words8(unsigned int address, const int *data) {
+  scratchpad_write_words4(address, data);
+  scratchpad_write_words4(address + 4, data + 4);
+}
+
+//! \brief Store 16 words in the core's local scratchpad. Unrolled version of
+//! \ref scratchpad_write_words.
+static inline void scratchpad_write_words16(unsigned int address, const int *data) {
+  scratchpad_write_words8(address, data);
+  scratchpad_write_words8(address + 8, data + 8);
+}
+
 //! \brief Store multiple words in the core's local scratchpad. The scratchpad
 //! is word-addressed.
 //! \param address The position in the core's local scratchpad file to store the first value
@@ -93,7 +143,10 @@ static inline void scratchpad_read_bytes(void *data, unsigned int address, size_
 //! The order of arguments for these methods is designed to mimic memcpy.
 static inline void scratchpad_write_words(unsigned int address, const int *data, size_t len) {
   size_t i;
-  for (i = 0; i != len; i++) {
+  for (i = 0; i + 4 <= len; i += 4) {
+    scratchpad_write_words4(address + i, data + i);
+  }
+  for (; i != len; i++) {
     scratchpad_write(address + i, data[i]);
   }
 }
@@ -124,4 +177,119 @@ static inline void scratchpad_write_bytes(unsigned int address, const void *data
   }
 }
 
+//! \brief Scratchpad word holding the allocator's next free address. It is
+//! never handed out by \ref scratchpad_alloc.
+#define SCRATCHPAD_ALLOC_WORD (SCRATCHPAD_NUM_WORDS - 1)
+
+//! \brief Release all scratchpad allocations on this core.
+//!
+//! \ref loki_init does this on every core it initialises, so this is only
+//! needed to discard allocations which were never released.
+static inline void scratchpad_alloc_reset(void) {
+  scratchpad_write(SCRATCHPAD_ALLOC_WORD, 0);
+}
+
+//! \brief Reserve a region of this core's scratchpad.
+//!
+//! Allocations are made from the bottom of the scratchpad upwards. They can be
+//! released in reverse order by passing the result of \ref scratchpad_alloc_mark
+//! to \ref scratchpad_alloc_release.
+//!
+//! \param words The number of words to reserve.
+//! \return The word address of the first word in the region, or -1 if there
+//! is not enough space.
+static inline int scratchpad_alloc(unsigned int words) {
+  unsigned int next = scratchpad_read(SCRATCHPAD_ALLOC_WORD);
+
+  if (words > SCRATCHPAD_ALLOC_WORD - next)
+    return -1;
+
+  scratchpad_write(SCRATCHPAD_ALLOC_WORD, next + words);
+  return next;
+}
+
+//! \brief Return a value which can later be passed to
+//! \ref scratchpad_alloc_release to free all subsequent allocations.
+static inline unsigned int scratchpad_alloc_mark(void) {
+  return scratchpad_read(SCRATCHPAD_ALLOC_WORD);
+}
+
+//! \brief Free all allocations made since `mark` was obtained from
+//! \ref scratchpad_alloc_mark.
+static inline void scratchpad_alloc_release(unsigned int mark) {
+  assert(mark <= (unsigned int)scratchpad_read(SCRATCHPAD_ALLOC_WORD));
+  scratchpad_write(SCRATCHPAD_ALLOC_WORD, mark);
+}
+
+//! \brief A single-producer, single-consumer queue of words held in the
+//! scratchpad.
+//!
+//! Both ends of the queue belong to the same core, so it is useful for staging
+//! data received from the network until it can be processed. The indices live
+//! in this structure (usually in registers), and only the data lives in the
+//! scratchpad.
+typedef struct {
+  unsigned int base;  //!< Scratchpad address of the first slot.
+  unsigned int mask;  //!< Capacity - 1. Capacity is a power of two.
+  unsigned int head;  //!< Number of words ever pushed.
+  unsigned int tail;  //!< Number of words ever popped.
+} scratchpad_ring;
+
+//! \brief Allocate a ring buffer in the scratchpad using \ref scratchpad_alloc.
+//!
+//! \param ring The ring buffer to initialise.
+//! \param capacity The number of words the buffer can hold. Must be a power of
+//! two.
+//! \return 0 on success, or -1 if there is not enough scratchpad space.
+static inline int scratchpad_ring_init(scratchpad_ring *ring, unsigned int capacity) {
+  assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+  int base = scratchpad_alloc(capacity);
+  if (base < 0)
+    return -1;
+
+  ring->base = base;
+  ring->mask = capacity - 1;
+  ring->head = 0;
+  ring->tail = 0;
+  return 0;
+}
+
+//! \brief Return the number of words currently held in the ring buffer.
+static inline unsigned int scratchpad_ring_count(const scratchpad_ring *ring) {
+  return ring->head - ring->tail;
+}
+
+//! \brief Return whether the ring buffer holds no words.
+static inline bool scratchpad_ring_empty(const scratchpad_ring *ring) {
+  return ring->head == ring->tail;
+}
+
+//! \brief Return whether the ring buffer has no space for another word.
+static inline bool scratchpad_ring_full(const scratchpad_ring *ring) {
+  return scratchpad_ring_count(ring) > ring->mask;
+}
+
+//! \brief Add a word to the ring buffer. The buffer must not be full.
+static inline void scratchpad_ring_push(scratchpad_ring *ring, int value) {
+  assert(!scratchpad_ring_full(ring));
+  scratchpad_write(ring->base + (ring->head & ring->mask), value);
+  ring->head++;
+}
+
+//! \brief Remove the oldest word from the ring buffer. The buffer must not be
+//! empty.
+static inline int scratchpad_ring_pop(scratchpad_ring *ring) {
+  assert(!scratchpad_ring_empty(ring));
+  int value = scratchpad_read(ring->base + (ring->tail & ring->mask));
+  ring->tail++;
+  return value;
+}
+
+//! \brief Receive a word from an input channel and add it to the ring buffer.
+//! The buffer must not be full.
+static inline void scratchpad_ring_receive(scratchpad_ring *ring, enum Channels channel) {
+  scratchpad_ring_push(ring, loki_receive(channel));
+}
+
 #endif
@@ -21,21 +21,61 @@ typedef struct {
 //!
 //! The cores used are from core 0 of the current tile onwards.
 //!
+//! Core 0 of each other tile receives `config` and, if it is no larger than
+//! 128 bytes, a copy of `data` directly over the network, and its tile's
+//! cores are given a pointer to that copy. Larger data is flushed to main
+//! memory and fetched by each tile. If `data_size` is 0, every core is given
+//! `data` itself, which must then be coherent some other way.
+//!
 //! \param config A closure containing a function to execute and all necessary
 //! context.
 //!
 //! \warning Must be executed on core 0 of the first tile in the group.
 //!
 //! \warning No synchronisation is provided. Core 0 will continue to execute
-//! the following statements as soon as its task is completed.
+//! the following statements as soon as its task is completed. Use
+//! \ref loki_execute_async to find out when all cores have finished.
 //!
 //! \warning Overwrites channel map table entry 2 and uses `CH_REGISTER_3`.
 void loki_execute(const distributed_func* config);
 
+//! Handle for an execution started by \ref loki_execute_async.
+typedef struct {
+  uint       cores;       //!< Number of cores executing the function.
+  tile_id_t  first_tile;  //!< Tile on which the execution was started.
+} loki_execution;
+
+//! \brief Have all cores execute the same function simultaneously, and track
+//! when they have all finished.
+//!
+//! As \ref loki_execute, but each core reports when it has finished. Reports
+//! are combined in a tree (all cores of a tile report to core 0, which reports
+//! up the tree of \ref loki_sync_tiles), and are collected by
+//! \ref loki_execute_join. Returns once core 0's own share of the work is done.
+//!
+//! \warning Must be executed on core 0 of the first tile in the group.
+//!
+//! \warning Overwrites channel map table entry 2 and uses `CH_REGISTER_3`
+//! (and `CH_REGISTER_7` on core 0 of each tile when using multiple tiles).
+loki_execution loki_execute_async(const distributed_func* config);
+
+//! \brief Wait for all cores started by \ref loki_execute_async to finish.
+//!
+//! After this returns, the `config` and `data` passed to
+//! \ref loki_execute_async may safely be deallocated.
+//!
+//! \warning Must be executed on the core which called \ref loki_execute_async.
+//!
+//! \warning Overwrites channel map table entry 2 and uses `CH_REGISTER_3`
+//! (and `CH_REGISTER_7` when using multiple tiles).
+void loki_execute_join(loki_execution* handle);
+
 //! \brief Wait for all tiles between 0 and `tiles-1` to reach this point before
 //! continuing.
 //!
-//! This function may only be executed on core 0 of each tile.
+//! This function may only be executed on core 0 of each tile. Tokens are
+//! combined in a tree which first gathers along each row of tiles and then
+//! along the first column, so the cost grows with log(tiles).
 //!
 //! \warning Overwrites channel map table entry 2 and uses `CH_REGISTER_7`.
 void loki_sync_tiles(const uint tiles);
@@ -45,6 +85,10 @@ void loki_sync_tiles(const uint tiles);
 //! \param cores Total number of cores participating in sync.
 //! \param first_tile First tile participating in sync.
 //!
+//! Within each tile, all cores report directly to core 0, which releases them
+//! with a single multicast. Core 0 of each tile synchronises with the others as
+//! in \ref loki_sync_tiles.
+//!
 //! \warning Quite expensive/slow. Use sparingly.
 //!
 //! \warning Overwrites channel map table entry 2 and uses `CH_REGISTER_3` and
@@ -79,6 +123,9 @@ void loki_tile_sync(const uint cores);
 //! currently limited to having a maximum of five arguments.
 //! For the moment, "another core" is always core 1.
 //!
+//! \deprecated Use \ref loki_task_dispatch, which chooses a free core and has
+//! no limit on the size of the arguments.
+//!
 //! This core will not wait for the remote function to complete, and will
 //! continue immediately.
 //!
@@ -86,6 +133,65 @@ void loki_tile_sync(const uint cores);
 //! `CH_REGISTER_3`.
 void loki_spawn(void* func, const channel_t return_address, const int argc, ...);
 
+//! A function executed by the task pool. Returns a value for the task's future.
+typedef int (*task_func)(const void* args);
+
+//! \brief The result of a task dispatched with \ref loki_task_dispatch.
+//!
+//! Both words share a cache line (and so a memory bank), so `value` is always
+//! written before `ready` becomes visible.
+typedef struct {
+  volatile int ready;   //!< Non-zero once the task has completed.
+  int          value;   //!< The task's return value.
+} __attribute__((aligned(8))) loki_future;
+
+//! \brief Return whether the task associated with a future has completed.
+static inline bool loki_future_ready(const loki_future* future) {
+  return future->ready;
+}
+
+//! \brief Wait for the task associated with a future to complete, and return
+//! its result.
+static inline int loki_future_wait(const loki_future* future) {
+  while (!future->ready)
+    ;
+  return future->value;
+}
+
+//! \brief Start a pool of cores on this tile which wait to execute tasks.
+//!
+//! Cores 1 to `cores-1` wait in a loop for tasks sent by
+//! \ref loki_task_dispatch, so a dispatch needs no remote execution setup: only
+//! the function, future and arguments are sent. The cores remain in the pool
+//! until \ref loki_task_pool_stop.
+//!
+//! \warning Must be executed on core 0. Cores in the pool may not be used for
+//! anything else.
+//! \warning Overwrites channel map table entry 2. Pool cores use
+//! `CH_REGISTER_3`.
+void loki_task_pool_start(const uint cores);
+
+//! \brief Wait for all tasks to complete, then release the pool's cores.
+//!
+//! \warning Must be executed on core 0 of the tile which started the pool.
+//! \warning Overwrites channel map table entry 2.
+void loki_task_pool_stop(void);
+
+//! \brief Execute `func` on a free core of this tile's task pool.
+//!
+//! Waits until a core in the pool is free. The arguments are copied into the
+//! network, so `args` may be reused as soon as this function returns.
+//!
+//! \param func Function to execute.
+//! \param args Arguments to pass to `func`. Must be word-aligned.
+//! \param arg_size Size of `args` in bytes.
+//! \param future Location to receive the result (optional).
+//!
+//! \warning Must be executed on core 0 of the tile which started the pool.
+//! \warning Overwrites channel map table entry 2.
+void loki_task_dispatch(task_func func, const void* args, size_t arg_size,
+                        loki_future* future);
+
 //! \brief Execute function on another core.
 //!
 //! Assumes that the remote core has already been initialised using \ref
@@ -0,0 +1,91 @@
+/*! \file trace.h
+ * \brief Per-core buffers of timestamped events, for building timelines.
+ *
+ * \ref LOKI_TRACE_EVENT records the current cycle count, an event id and one
+ * argument in a ring buffer private to the executing core. Only the most
+ * recent \ref LOKI_TRACE_EVENTS events on each core are kept. Buffers are
+ * line-aligned, and each core only ever writes its own, so recording an event
+ * is a handful of instructions which hit in the L1. Nothing is printed until
+ * \ref loki_trace_dump is called at the end of a run.
+ *
+ * The library's patterns record the built-in events below. The macro only does
+ * anything when `LOKI_TRACING` is defined, so build the library with
+ * `make TRACE=1` to record them.
+ */
+
+#ifndef LOKI_TRACE_H_
+#define LOKI_TRACE_H_
+
+#include <loki/control_registers.h>
+#include <loki/ids.h>
+#include <loki/types.h>
+
+//! Events recorded by the library itself. Other ids are free for programs.
+enum loki_trace_id {
+  LOKI_TRACE_BARRIER_ENTER = 0, //!< Arrived at a barrier. Argument: cores (or tiles, between tiles) taking part.
+  LOKI_TRACE_BARRIER_EXIT,      //!< Left a barrier. Argument: as for \ref LOKI_TRACE_BARRIER_ENTER.
+  LOKI_TRACE_LAUNCH,            //!< Started other cores. Argument: cores taking part.
+  LOKI_TRACE_GRANT_SENT,        //!< Farm sub-master sent work. Argument: iteration (-1 to stop).
+  LOKI_TRACE_GRANT_RECEIVED,    //!< Farm worker received work. Argument: iteration (-1 to stop).
+  LOKI_TRACE_TOKEN_SENT,        //!< Pipeline stage passed on an iteration. Argument: iteration, or value for data-driven pipelines.
+  LOKI_TRACE_TOKEN_RECEIVED,    //!< Pipeline stage received an iteration. Argument: as for \ref LOKI_TRACE_TOKEN_SENT.
+  LOKI_TRACE_USER = 16          //!< First id available to programs.
+};
+
+#ifndef LOKI_TRACE_EVENTS
+//! Number of events kept per core. Must be a power of two.
+#define LOKI_TRACE_EVENTS 64
+#endif
+
+//! One recorded event.
+typedef struct {
+  uint cycle;  //!< Value of the cycle counter when the event was recorded.
+  uint event;  //!< Event id in the top 8 bits, argument in the low 24 bits.
+} loki_trace_entry;
+
+//! One core's ring buffer of events.
+typedef struct {
+  uint             recorded;  //!< Total events recorded since the last reset.
+  uint             padding[7];
+  loki_trace_entry entries[LOKI_TRACE_EVENTS]; //!< Event `n` is in entry `n % LOKI_TRACE_EVENTS`.
+} __attribute__((aligned(32))) loki_trace_core;
+
+//! Buffers of every core on the chip, indexed by `tile * CORES_PER_TILE + core`.
+extern loki_trace_core loki_trace_cores[CORES_PER_TILE * COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS];
+
+//! Record an event on this core. Use \ref LOKI_TRACE_EVENT instead.
+static inline void loki_trace_record(const uint id, const int arg) {
+  loki_trace_core* trace =
+      &loki_trace_cores[tile2int(get_tile_id()) * CORES_PER_TILE + get_core_id()];
+  loki_trace_entry* entry = &trace->entries[trace->recorded++ % LOKI_TRACE_EVENTS];
+
+  entry->cycle = get_cycle_count();
+  entry->event = (id << 24) | (arg & 0xFFFFFF);
+}
+
+#ifdef LOKI_TRACING
+//! \brief Record event `id` with argument `arg` in this core's buffer.
+//!
+//! Ids must be below 256, and only the low 24 bits of the argument are kept.
+//!
+//! \remark About 10 cycles.
+#define LOKI_TRACE_EVENT(id, arg) loki_trace_record(id, arg)
+#else
+#define LOKI_TRACE_EVENT(id, arg) ((void)0)
+#endif
+
+//! Discard all of this core's events.
+void loki_trace_reset(void);
+
+//! \brief Gather every core's events and print them.
+//!
+//! Each of the first `cores` cores makes its buffer visible to this core (using
+//! \ref loki_execute_async), then each core's events are printed oldest first,
+//! one per line, as CSV: `tile,core,cycle,event,arg`. The argument is
+//! sign-extended from 24 bits.
+//!
+//! \warning Must be executed on core 0 of the first tile, with all of the
+//! other cores idle. Has the same requirements as \ref loki_execute_async.
+void loki_trace_dump(uint cores);
+
+#endif
@@ -4,6 +4,7 @@
 #ifndef LOKI_VECTOR_H_
 #define LOKI_VECTOR_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <loki/channel_io.h>
 #include <loki/sendconfig.h>
@@ -1259,4 +1260,31 @@ static inline v8uint32_t loki_load_v8uint32_t(
 	return result;
 }
 
+// Bulk memory operations.
+
+//! \brief Copy `size` bytes from `src` to `dst`, which must not overlap.
+//!
+//! Behaves as the standard `memcpy`. Each cache line of the destination is
+//! written with a single store cache line operation, so is never fetched from
+//! memory first. Ragged ends are copied a word at a time where the alignment
+//! of `src` and `dst` allows, otherwise a byte at a time.
+//!
+//! \return `dst`.
+void* loki_memcpy(void* dst, const void* src, size_t size);
+
+//! \brief Copy `size` bytes from `src` to `dst`, which may overlap.
+//!
+//! Behaves as the standard `memmove`, with the performance of \ref loki_memcpy.
+//!
+//! \return `dst`.
+void* loki_memmove(void* dst, const void* src, size_t size);
+
+//! \brief Set `size` bytes starting at `dst` to `(unsigned char)value`.
+//!
+//! Behaves as the standard `memset`. Whole cache lines are set with a single
+//! memset cache line operation each.
+//!
+//! \return `dst`.
+void* loki_memset(void* dst, int value, size_t size);
+
 #endif
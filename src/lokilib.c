@@ -1,6 +1,7 @@
 #include <loki/lokilib.h>
 #include <loki/sendconfig.h>
 #include <assert.h>
+#include <malloc.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -10,28 +11,181 @@
 //   Various helper functions used by the parallel implementations.
 //============================================================================//
 
-static void init_run_config(setup_func func, unsigned int cores) {
+// Defined in the memory section.
+static void private_heap_reserve(uint cores, size_t size);
+
+// A memory channel like entry 1, but which sends all requests straight to main
+// memory (skipping L1 and L2; see loki_mem_address). Data accessed only through
+// such a channel is coherent across all tiles.
+static inline channel_t uncached_memory_channel(void) {
+  return loki_uncached_memory_channel();
+}
+
+// Start `func` on core 0 of another tile, and have it sleep when `func`
+// returns. Anything `func` receives from r3 can then be sent using
+// remote_stream_send. This lets small arguments be copied straight into the
+// remote core's stack, rather than being flushed to main memory and fetched
+// back again by every tile.
+static void remote_stream_start(const tile_id_t tile, void (*func)(void)) {
+  channel_t inst_fifo = loki_core_address(tile, 0, 0, INFINITE_CREDIT_COUNT);
+  channel_t data_input = loki_core_address(tile, 0, 3, INFINITE_CREDIT_COUNT);
+
+  set_channel_map(2, data_input);
+  loki_send(2, (int)&loki_sleep);          // send function pointers
+  loki_send(2, (int)func);
+
+  // The function must start before the arguments are sent, or they could
+  // fill the network while the instructions wait behind them.
+  set_channel_map(2, inst_fifo);
+  asm volatile (
+    "fetchr 0f\n"
+    "rmtexecute -> 2\n"         // begin remote execution
+    "addu r10, r3, r0\n"        // set return address
+    "fetch.eop r3\n"            // fetch function to execute
+    "0:\n"
+    // No clobbers because this is all executed remotely.
+  );
+
+  set_channel_map(2, data_input);
+}
+
+// Send `size` bytes to the core started by remote_stream_start, as
+// (size + 3) / 4 words. Nothing beyond `size` is read: a partial final word is
+// padded with zeros. Data which is not word-aligned is copied a word at a time
+// with memcpy, which is slower.
+static inline void remote_stream_send(const void* data, const size_t size) {
+  const size_t whole = size / sizeof(int);
+  uint i;
+
+  if (((int)data & (sizeof(int) - 1)) == 0) {
+    const int* words = data;
+    for (i = 0; i < whole; i++)
+      loki_send(2, words[i]);
+  }
+  else {
+    for (i = 0; i < whole; i++) {
+      int word;
+      memcpy(&word, (const char*)data + i * sizeof(int), sizeof(int));
+      loki_send(2, word);
+    }
+  }
+
+  if (size > whole * sizeof(int)) {
+    int word = 0;
+    memcpy(&word, (const char*)data + whole * sizeof(int),
+           size - whole * sizeof(int));
+    loki_send(2, word);
+  }
+}
+
+// Receive `size` bytes sent with remote_stream_send. `data` must have room
+// for a whole number of words.
+static inline void remote_stream_receive(void* data, const size_t size) {
+  int* words = data;
+  uint i;
+  for (i = 0; i < (size + sizeof(int) - 1) / sizeof(int); i++)
+    words[i] = loki_receive(3);
+}
+
+// The set of tiles being brought up by loki_init or loki_init_tiles. Tiles are
+// initialised in a binomial tree rooted at position 0, and each tile's core 0
+// is given the position of a tile to start by reading this from memory.
+typedef struct {
+  const init_config *config;
+  uint               num_tiles;
+  tile_id_t          tiles[COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS];
+} init_group;
+
+// Defined in the synchronisation section.
+static inline void sync_tile_gather(const uint cores);
+static inline void sync_tile_release(const uint cores);
+static void sync_group(const uint tiles, const uint index,
+                       const tile_id_t* list, const uint first_tile);
+
+// Position of this tile within the group.
+static uint init_group_index(const init_group* group) {
+  tile_id_t tile = get_tile_id();
+  uint index;
+
+  for (index = 0; index < group->num_tiles; index++)
+    if (group->tiles[index] == tile)
+      return index;
+
+  assert(false && "Tile is not part of the initialisation group");
+  return 0;
+}
+
+// Number of cores to start on the tile at a given position in the group. Core
+// 0 of every tile in the group is always used.
+static inline uint init_group_cores(const init_group* group, const uint index) {
+  uint cores = group->config->cores;
+
+  if (cores <= (index + 1) * CORES_PER_TILE)
+    return (cores > index * CORES_PER_TILE) ? cores - index * CORES_PER_TILE : 1;
+  else
+    return CORES_PER_TILE;
+}
+
+// Synchronise core 0 of all tiles in the group.
+static inline void init_group_sync(const init_group* group) {
+  if (group->num_tiles > 1)
+    sync_group(group->num_tiles, init_group_index(group), group->tiles, 0);
+}
+
+static void init_run_config(setup_func func, unsigned int cores,
+                            const init_group* group) {
   func();
   // Ensure all cores (across all tiles) are done with the config func before returning.
   // This ensures no race conditions exist with configuration functions.
-  loki_sync(cores);
+  sync_tile_gather(cores);
+  if (get_core_id() == 0)
+    init_group_sync(group);
+  sync_tile_release(cores);
 }
 
-// More flexible core initialisation. To be executed by core 0 of any tile.
-static void init_local_tile(const init_config* config) {
-  uint tile = get_tile_id();
-  uint cores = cores_this_tile(config->cores, tile, tile_id(1, 1));
+static void init_remote_tile(const init_group* group, const uint index);
+
+// More flexible core initialisation. To be executed by core 0 of any tile in
+// the group.
+static void init_local_tile(const init_group* group) {
+  const init_config* config = group->config;
+  uint index = init_group_index(group);
+
+  // The group arrives as an argument, so is already up to date, but the
+  // configuration it points to may be stale from an earlier initialisation.
+  if (index != 0)
+    loki_channel_invalidate_data(1, config, sizeof(init_config));
+  uint cores = init_group_cores(group, index);
+
+  // Start this tile's children in the broadcast tree before its own cores, so
+  // the rest of the group is brought up in O(log tiles) steps. Tile n is the
+  // parent of n + 2^k for every 2^k below n's lowest set bit. Larger subtrees
+  // are started first since they take longest to complete.
+  uint stride;
+  if (index == 0)
+    for (stride = 1; stride < group->num_tiles; stride *= 2);
+  else
+    stride = index & -index;
+
+  for (stride /= 2; stride > 0; stride /= 2)
+    if (index + stride < group->num_tiles)
+      init_remote_tile(group, index + stride);
+
+  // Every core starts with an empty scratchpad allocator. The other cores do
+  // the same below.
+  scratchpad_alloc_reset();
 
   if (cores <= 1) {
     if (config->config_func != NULL)
       config->config_func();
+    init_group_sync(group);
     return;
   }
 
   int inst_mem = config->inst_mem;
   int data_mem = config->data_mem;
   uint stack_size = config->stack_size;
-  uint stack_pointer = (uint)config->stack_pointer - tile2int(tile)*CORES_PER_TILE*stack_size;
+  uint stack_pointer = (uint)config->stack_pointer - index*CORES_PER_TILE*stack_size;
   channel_t inst_mcast = loki_mcast_address(all_cores_except_0(cores), 0, false);
   channel_t data_mcast = loki_mcast_address(all_cores_except_0(cores), 2, false);
 
@@ -53,17 +207,22 @@ static void init_local_tile(const init_config* config) {
     "addu r18, r2, r23\n"       // combine port with received data_mem
     "setchmapi 0, r17\n"
     "setchmapi 1, r18\n"
+    "lli r23, %0\n"             // reset the scratchpad allocator
+    "scratchwr r0, r23\n"
     "or r8, r2, r0\n"           // receive stack pointer
     "mullw r14, r2, r11\n"      // multiply core ID by stack size
     "subu r8, r8, r14\n"
     "or.eop r9, r8, r0\n"       // frame pointer = stack pointer
     "0:\n"
+    :
+    : "n" (SCRATCHPAD_ALLOC_WORD)
   );
 
   if (config->config_func != NULL) {
     loki_send(3, (int)&loki_sleep); // return address
     loki_send(3, (int)config->config_func); // arg1
-    loki_send(3, (int)config->cores); // arg2
+    loki_send(3, (int)cores); // arg2
+    loki_send(3, (int)group); // arg3
     loki_send(3, (int)&init_run_config); // function
 
     asm volatile (
@@ -72,26 +231,31 @@ static void init_local_tile(const init_config* config) {
       "or r10, r2, r0\n"        // set return address
       "or r13, r2, r0\n"        // set arg1
       "or r14, r2, r0\n"        // set arg2
+      "or r15, r2, r0\n"        // set arg3
       "fetch.eop r2\n"          // fetch function to perform further init
       "0:\n"
     );
 
     // run the same code as other cores.
-    init_run_config(config->config_func, config->cores);
+    init_run_config(config->config_func, cores, group);
   } else {
     // Since there is no config func, all cores are ready at this point. Just need a tile to tile sync.
-    loki_sync_tiles(num_tiles(config->cores));
+    init_group_sync(group);
   }
 }
 
-static inline void init_remote_tile(const tile_id_t tile, const init_config* config) {
+// Start core 0 of the tile at a given position in the group, and have it
+// initialise its part of the broadcast tree.
+static void init_remote_tile(const init_group* group, const uint index) {
+  const init_config* config = group->config;
+  tile_id_t tile = group->tiles[index];
 
   // Send initial configuration.
   int data_input = loki_core_address(tile, 0, 3, INFINITE_CREDIT_COUNT);
   set_channel_map(2, data_input);
   loki_send(2, config->inst_mem);
   loki_send(2, config->data_mem);
-  loki_send(2, (int)config->stack_pointer - tile2int(tile)*CORES_PER_TILE*config->stack_size);
+  loki_send(2, (int)config->stack_pointer - index*CORES_PER_TILE*config->stack_size);
 
   // Send some instructions to execute.
   int inst_fifo = loki_core_address(tile, 0, 0, INFINITE_CREDIT_COUNT);
@@ -110,13 +274,14 @@ static inline void init_remote_tile(const tile_id_t tile, const init_config* con
     "0:\n"
   );
 
-  // Have the remote core initialise the rest of its tile. (config has already
-  // been flushed in loki_init.)
-  loki_remote_execute(tile, 0, &init_local_tile, (void*)config, sizeof(init_config));
+  // Have the remote core initialise the rest of its subtree. (config and group
+  // have already been flushed by the tile at the root.)
+  loki_remote_execute(tile, 0, &init_local_tile, (void*)group, sizeof(init_group));
 
 }
 
-void loki_init(init_config* config) {
+// Fill in defaults for any unspecified fields of the configuration.
+static void init_defaults(init_config* config) {
   assert(config->cores > 0);
 
   if (config->stack_pointer == 0) {
@@ -133,16 +298,34 @@ void loki_init(init_config* config) {
   // Data channel
   if (config->data_mem == 0)
     config->data_mem = get_channel_map(1);
+}
+
+// Bring up every tile in the group, starting from this one (which must be at
+// position 0).
+static void init_group_start(init_group* group) {
+  loki_channel_flush_data(1, group->config, sizeof(init_config));
+  loki_channel_flush_data(1, group, sizeof(init_group));
+  init_local_tile(group);
+}
+
+void loki_init(init_config* config) {
+  init_defaults(config);
+
+  if (config->heap_size > 0)
+    private_heap_reserve(config->cores, config->heap_size);
 
   // Give each core connections to memory and a stack.
   if (config->cores > 1) {
-    loki_channel_flush_data(1, config, sizeof(init_config));
+    init_group group;
+    group.config = config;
+    group.num_tiles = num_tiles(config->cores);
+    assert(group.num_tiles <= COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS);
+
     unsigned int tile;
-    for (tile = 1; tile*CORES_PER_TILE < config->cores; tile++) {
-      init_remote_tile(int2tile(tile), config);
-    }
+    for (tile = 0; tile < group.num_tiles; tile++)
+      group.tiles[tile] = int2tile(tile);
 
-    init_local_tile(config);
+    init_group_start(&group);
   }
   else if (config->config_func != NULL)
     config->config_func();
@@ -150,22 +333,32 @@ void loki_init(init_config* config) {
 
 // Initialise a particular set of tiles.
 void loki_init_tiles(int num_tiles, tile_id_t* tile_ids, init_config* config) {
-  bool init_self = false;
+  assert(num_tiles > 0);
+  assert(num_tiles <= COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS);
+
+  init_defaults(config);
 
-  for (unsigned int tile = 0; tile < num_tiles; tile++) {
+  // The calling tile is the root of the broadcast, so it is moved to the front
+  // and the others keep their relative order.
+  init_group group;
+  group.config = config;
+  group.num_tiles = num_tiles;
+
+  unsigned int tile;
+  unsigned int position = 1;
+  bool init_self = false;
+  for (tile = 0; tile < num_tiles; tile++) {
     if (tile_ids[tile] == get_tile_id()) {
+      group.tiles[0] = tile_ids[tile];
       init_self = true;
-      continue;
     }
-    else
-      init_remote_tile(tile_ids[tile], config);
+    else if (position < num_tiles)
+      group.tiles[position++] = tile_ids[tile];
   }
 
-  if (init_self)
-    init_local_tile(config);
+  assert(init_self && "loki_init_tiles must be run on one of the tiles");
 
-  // FIXME: these initialisation functions include a synchronisation, but don't
-  // know which tiles to synchronise.
+  init_group_start(&group);
 }
 
 // A wrapper for loki_init which fills in most of the values with sensible
@@ -178,6 +371,7 @@ void loki_init_default(const uint cores, const setup_func setup) {
   config->inst_mem = 0;
   config->data_mem = 0;
   config->config_func = setup;
+  config->heap_size = 0;
 
   loki_init(config);
 
@@ -249,79 +443,126 @@ static inline void loki_memory_reconfigure_send_directory_entries(
   }
 }
 
-// Send the new instruction and data channels to each core.
-static inline void loki_memory_reconfigure_send_channels(
-  loki_memory_cache_configuration_t const value
+// The banks a core uses for its icache or dcache in a configuration.
+static inline uint loki_memory_cache_banks(
+  loki_memory_cache_configuration_t const* value
+, enum Cores const core
+, bool const icache
+) {
+  uint banks = 0;
+  for (int j = 0; j < BANKS_PER_TILE; j++) {
+    enum MulticastDestinations const users =
+      icache ? value->banks[j].icache : value->banks[j].dcache;
+    if (users & single_core_bitmask(core))
+      banks |= 1 << j;
+  }
+  return banks;
+}
+
+// Compute a core's instruction and data channels in a configuration.
+static void loki_memory_cache_channels(
+  loki_memory_cache_configuration_t const* value
+, enum Cores const i
+, channel_t* dmem_out
+, channel_t* imem_out
 ) {
   assert(BANKS_PER_TILE == 8);
 
-  for (int i = 0; i < CORES_PER_TILE; i++) {
-    channel_t address =
-      loki_mcast_address(single_core_bitmask(i), CH_REGISTER_3, false);
-    set_channel_map(4, address);
+  // Make a bitmask of banks used by this core for icache and dcache, repeated
+  // so groups may wrap around.
+  int dbitmask = loki_memory_cache_banks(value, i, false) * 0x101;
+  int ibitmask = loki_memory_cache_banks(value, i, true) * 0x101;
 
-    // Make a bitmask of banks used by this core for icache and dcache.
-    int dbitmask = 0;
-    int ibitmask = 0;
-    for (int j = 0; j < BANKS_PER_TILE; j++) {
-      if (value.banks[j].dcache & single_core_bitmask(i))
-        dbitmask |= 0x101 << j;
-      if (value.banks[j].icache & single_core_bitmask(i))
-        ibitmask |= 0x101 << j;
-    }
+  channel_t dmem, imem;
 
-    channel_t dmem, imem;
+  // Default to discard addresses.
+  dmem = loki_mcast_address(0, CH_REGISTER_2, false);
+  imem = loki_mcast_address(0, CH_IPK_CACHE, false);
 
-    // Default to discard addresses.
-    dmem = loki_mcast_address(0, CH_REGISTER_2, false);
-    imem = loki_mcast_address(0, CH_IPK_CACHE, false);
-
-    enum MemConfigGroupSize group_size;
-    int gs;
-
-    // Detect the group size and start for dcache.
-    for (gs = 8, group_size = GROUPSIZE_8; gs > 0; gs /= 2, group_size--) {
-      for (int j = 0; j < BANKS_PER_TILE; j++) {
-        if (((dbitmask >> j) & ((1 << gs) - 1)) == ((1 << gs) - 1)) {
-          dmem = loki_mem_address(
-              j, i, CH_REGISTER_2, group_size
-            , value.dcache_skip_l1 & single_core_bitmask(i)
-            , value.dcache_skip_l2 & single_core_bitmask(i)
-            , false
-            );
-          gs = 1;
-          break;
-        }
+  enum MemConfigGroupSize group_size;
+  int gs;
+
+  // Detect the group size and start for dcache.
+  for (gs = 8, group_size = GROUPSIZE_8; gs > 0; gs /= 2, group_size--) {
+    for (int j = 0; j < BANKS_PER_TILE; j++) {
+      if (((dbitmask >> j) & ((1 << gs) - 1)) == ((1 << gs) - 1)) {
+        dmem = loki_mem_address(
+            j, i, CH_REGISTER_2, group_size
+          , value->dcache_skip_l1 & single_core_bitmask(i)
+          , value->dcache_skip_l2 & single_core_bitmask(i)
+          , false
+          );
+        gs = 1;
+        break;
       }
     }
+  }
 
-    // Detect the group size and start for icache.
-    for (gs = 8, group_size = GROUPSIZE_8; gs > 0; gs /= 2, group_size--) {
-      for (int j = 0; j < BANKS_PER_TILE; j++) {
-        if (((ibitmask >> j) & ((1 << gs) - 1)) == ((1 << gs) - 1)) {
-          imem = loki_mem_address(
-              j, i, CH_IPK_CACHE, group_size
-            , value.icache_skip_l1 & single_core_bitmask(i)
-            , value.icache_skip_l2 & single_core_bitmask(i)
-            , false
-            );
-          gs = 1;
-          break;
-        }
+  // Detect the group size and start for icache.
+  for (gs = 8, group_size = GROUPSIZE_8; gs > 0; gs /= 2, group_size--) {
+    for (int j = 0; j < BANKS_PER_TILE; j++) {
+      if (((ibitmask >> j) & ((1 << gs) - 1)) == ((1 << gs) - 1)) {
+        imem = loki_mem_address(
+            j, i, CH_IPK_CACHE, group_size
+          , value->icache_skip_l1 & single_core_bitmask(i)
+          , value->icache_skip_l2 & single_core_bitmask(i)
+          , false
+          );
+        gs = 1;
+        break;
       }
     }
+  }
+
+  *dmem_out = dmem;
+  *imem_out = imem;
+}
+
+// Send the new instruction and data channels to each core.
+static inline void loki_memory_reconfigure_send_channels(
+  loki_memory_cache_configuration_t const value
+) {
+  for (int i = 0; i < CORES_PER_TILE; i++) {
+    channel_t address =
+      loki_mcast_address(single_core_bitmask(i), CH_REGISTER_3, false);
+    set_channel_map(4, address);
+
+    channel_t dmem, imem;
+    loki_memory_cache_channels(&value, i, &dmem, &imem);
 
     loki_send(4, dmem);
     loki_send(4, imem);
   }
 }
 
+// The cache configuration of each tile, as last set by this library. Each
+// tile only accesses its own entry, which has cache lines to itself.
+static struct {
+  loki_memory_cache_configuration_t value;
+  bool                              known;
+} __attribute__((aligned(32)))
+  loki_memory_cache_state[COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS];
+
+static inline void loki_memory_cache_record(
+  loki_memory_cache_configuration_t const value
+) {
+  loki_memory_cache_state[tile2int(get_tile_id())].value = value;
+  loki_memory_cache_state[tile2int(get_tile_id())].known = true;
+}
+
+loki_memory_cache_configuration_t const* loki_memory_cache_current(void) {
+  const uint tile = tile2int(get_tile_id());
+  return loki_memory_cache_state[tile].known
+       ? &loki_memory_cache_state[tile].value : NULL;
+}
+
 // Change all cores caches simultaneously.
 void loki_memory_cache_reconfigure(
   loki_memory_cache_configuration_t const value
 ) {
   channel_t address;
 
+  loki_memory_cache_record(value);
   loki_memory_reconfigure_setup();
   loki_memory_reconfigure_send_channels(value);
 
@@ -469,6 +710,7 @@ void loki_memory_tile_reconfigure(
 ) {
   channel_t address;
 
+  loki_memory_cache_record(cache);
   loki_memory_reconfigure_setup();
   loki_memory_reconfigure_send_directory_entries(directory);
   loki_memory_reconfigure_send_channels(cache);
@@ -561,6 +803,154 @@ void loki_memory_tile_reconfigure(
   );
 }
 
+// Find the banks which must be flushed and invalidated to change from
+// `current` to `target`, and the cores whose channels change. Returns the
+// cores which must be idle: those which change, and any using the banks.
+static enum MulticastDestinations loki_memory_cache_difference(
+  loki_memory_cache_configuration_t const* current
+, loki_memory_cache_configuration_t const* target
+, uint* banks_out
+, enum MulticastDestinations* changed_out
+) {
+  uint banks = 0;
+  uint changed = 0;
+
+  for (int i = 0; i < CORES_PER_TILE; i++) {
+    channel_t dold, iold, dnew, inew;
+    loki_memory_cache_channels(current, i, &dold, &iold);
+    loki_memory_cache_channels(target, i, &dnew, &inew);
+
+    if (dold != dnew) {
+      changed |= single_core_bitmask(i);
+      banks |= loki_memory_cache_banks(current, i, false)
+             | loki_memory_cache_banks(target, i, false);
+    }
+    if (iold != inew) {
+      changed |= single_core_bitmask(i);
+      banks |= loki_memory_cache_banks(current, i, true)
+             | loki_memory_cache_banks(target, i, true);
+    }
+  }
+
+  uint idle = changed;
+  for (int i = 0; i < CORES_PER_TILE; i++) {
+    uint const used = loki_memory_cache_banks(current, i, false)
+                    | loki_memory_cache_banks(current, i, true)
+                    | loki_memory_cache_banks(target, i, false)
+                    | loki_memory_cache_banks(target, i, true);
+    if (used & banks)
+      idle |= single_core_bitmask(i);
+  }
+
+  *banks_out = banks;
+  *changed_out = (enum MulticastDestinations)changed;
+  return (enum MulticastDestinations)idle;
+}
+
+enum MulticastDestinations loki_memory_cache_reconfigure_affected(
+  loki_memory_cache_configuration_t const value
+) {
+  loki_memory_cache_configuration_t const* current = loki_memory_cache_current();
+  if (current == NULL)
+    return MULTICAST_CORE_ALL;
+
+  uint banks;
+  enum MulticastDestinations changed;
+  return loki_memory_cache_difference(current, &value, &banks, &changed);
+}
+
+// Send a request on entry 3 which returns to r2, and wait for the reply, so
+// that everything sent on entry 3 beforehand has been handled.
+static inline void loki_memory_bank_ping(void) {
+  asm volatile (
+    "sendconfig r0, %0 -> 3\n"
+    "fetchr 0f\n"
+    "or.eop r0, r2, r0\n"
+    "0:\n"
+    :
+    : "n" (SC_RETURN_TO_R2 | SC_L1_SCRATCHPAD | SC_LOAD_WORD)
+    : "memory"
+  );
+}
+
+// Change only the parts of the tile's caches which differ.
+void loki_memory_cache_reconfigure_partial(
+  loki_memory_cache_configuration_t const value
+) {
+  loki_memory_cache_configuration_t const* current = loki_memory_cache_current();
+  uint banks;
+  enum MulticastDestinations changed;
+
+  // Without a known starting point, or if this core's own caches are
+  // affected, everything must be done at once.
+  if (current == NULL ||
+      (loki_memory_cache_difference(current, &value, &banks, &changed)
+       & single_core_bitmask(get_core_id()))) {
+    loki_memory_cache_reconfigure(value);
+    return;
+  }
+
+  // All users of these banks are idle, so the banks can be cleaned one at a
+  // time: flush them all, wait, then invalidate them all and wait again.
+  for (int j = 0; j < BANKS_PER_TILE; j++) {
+    if (!(banks & (1 << j)))
+      continue;
+    set_channel_map(3, loki_cache_address(j, get_core_id(), CH_REGISTER_2,
+                                          GROUPSIZE_1));
+    loki_channel_flush_all_lines(3, 0);
+  }
+  for (int j = 0; j < BANKS_PER_TILE; j++) {
+    if (!(banks & (1 << j)))
+      continue;
+    set_channel_map(3, loki_cache_address(j, get_core_id(), CH_REGISTER_2,
+                                          GROUPSIZE_1));
+    loki_memory_bank_ping();
+  }
+  for (int j = 0; j < BANKS_PER_TILE; j++) {
+    if (!(banks & (1 << j)))
+      continue;
+    set_channel_map(3, loki_cache_address(j, get_core_id(), CH_REGISTER_2,
+                                          GROUPSIZE_1));
+    loki_channel_invalidate_all_lines(3, 0);
+    loki_memory_bank_ping();
+  }
+
+  if (changed != MULTICAST_CORE_NONE) {
+    // Each changed core receives its new channels, then where to go next.
+    for (int i = 0; i < CORES_PER_TILE; i++) {
+      if (!(changed & single_core_bitmask(i)))
+        continue;
+
+      channel_t dmem, imem;
+      loki_memory_cache_channels(&value, i, &dmem, &imem);
+
+      set_channel_map(3, loki_mcast_address(single_core_bitmask(i),
+                                            CH_REGISTER_3, false));
+      loki_send(3, dmem);
+      loki_send(3, imem);
+      loki_send(3, (int)&loki_sleep);
+    }
+
+    // The cores are idle, so fetch nothing until the new instruction channel
+    // is in place.
+    set_channel_map(2, loki_mcast_address(changed, CH_IPK_FIFO, false));
+    asm volatile (
+      "fetchr 0f\n"
+      "rmtexecute -> 2\n"
+      "setchmapi 1, r3\n" // Data channel.
+      "setchmapi 0, r3\n" // Instruction channel.
+      "nor r0, r0, r0\n"
+      "fetch.eop r3\n"
+      "0:\n"
+      :
+      :
+      : "memory"
+    );
+  }
+
+  loki_memory_cache_record(value);
+}
+
 // Signal that all required results have been produced by the parallel execution
 // pattern, and that we may now break the cores from their infinite loops.
 void end_parallel_section() {
@@ -573,85 +963,179 @@ void end_parallel_section() {
 
 }
 
-// Only continue after all tiles have executed this function. Tokens from each
-// tile are collected, then redistributed to show when all have been received.
-void loki_sync_tiles(const uint tiles) {
-  if (tiles <= 1)
-    return;
+// Radix of the tree used to combine tokens between tiles. Tiles are numbered
+// row-major, so with one digit per row the first level of the tree gathers
+// tokens along each row of the chip, and the second level gathers the row
+// leaders along the first column. A tile never waits for more than
+// COMPUTE_TILE_COLUMNS-1 + COMPUTE_TILE_ROWS-1 tokens.
+#define SYNC_TILE_RADIX COMPUTE_TILE_COLUMNS
+
+// Collect a token from every other core on this tile at core 0. The local
+// network allows all cores to send to core 0 directly, so a single-level tree
+// is the shallowest possible; tokens which don't fit in core 0's input buffer
+// just wait in the network until it catches up.
+static inline void sync_tile_gather(const uint cores) {
+  uint core = get_core_id();
 
-  assert(get_core_id() == 0);
-  uint tile = tile2int(get_tile_id());
+  if (core == 0) {
+    uint received;
+    for (received = 1; received < cores; received++)
+      loki_receive_token(CH_REGISTER_3);
+  }
+  else {
+    int address = loki_mcast_address(single_core_bitmask(0), CH_REGISTER_3,
+                                     false);
+    set_channel_map(2, address);
+    loki_send_token(2);
+  }
+}
 
-  // All tiles except the final one wait until they receive a token from their
-  // neighbour. (A tree structure would be more efficient, but there isn't much
-  // difference with so few tiles.)
-  if (tile < tiles-1)
-    loki_receive_token(CH_REGISTER_7);
+// Core 0 notifies all other cores on this tile that synchronisation has
+// finished, using a single multicast token.
+static inline void sync_tile_release(const uint cores) {
+  if (get_core_id() == 0) {
+    // A tile with only core 0 taking part has nobody to notify.
+    if (cores <= 1)
+      return;
 
-  // All tiles except the first one send a token to their other neighbour
-  // (after setting up a connection).
-  if (tile > 0) {
-    int address = loki_core_address(int2tile(tile-1), 0, CH_REGISTER_7,
-                                    INFINITE_CREDIT_COUNT);
+    int bitmask = all_cores_except_0(cores);
+    int address = loki_mcast_address(bitmask, CH_REGISTER_3, false);
     set_channel_map(2, address);
     loki_send_token(2);
+  }
+  else
+    loki_receive_token(CH_REGISTER_3);
+}
+
+// The tile at a given position in a group: either `list[index]`, or if there
+// is no list, the global tile number `first_tile + index`.
+static inline tile_id_t sync_group_member(const tile_id_t* list,
+                                          const uint first_tile,
+                                          const uint index) {
+  return (list == NULL) ? int2tile(first_tile + index) : list[index];
+}
+
+// Send a token to core 0 of the tile at a given position in the group.
+static inline void sync_tiles_send(const tile_id_t* list, const uint first_tile,
+                                   const uint index) {
+  int address = loki_core_address(sync_group_member(list, first_tile, index), 0,
+                                  CH_REGISTER_7, INFINITE_CREDIT_COUNT);
+  set_channel_map(2, address);
+  loki_send_token(2);
+}
+
+// Combine tokens from core 0 of a group of `tiles` tiles at the first tile of
+// the group. This tile is at position `index`. Tiles are arranged in a tree of
+// radix SYNC_TILE_RADIX: a tile is a child of the tile obtained by clearing its
+// lowest non-zero digit. Returns the stride of the level at which this tile is
+// a child (at least `tiles` for the first tile).
+static uint sync_group_gather(const uint tiles, const uint index,
+                              const tile_id_t* list, const uint first_tile) {
+  uint stride;
+  uint digit;
+
+  // Wait for all children at each level until reaching the level at which
+  // this tile is itself a child. The tokens can be received in any order.
+  for (stride = 1; stride < tiles; stride *= SYNC_TILE_RADIX) {
+    if ((index / stride) % SYNC_TILE_RADIX != 0)
+      break;
+
+    for (digit = 1; digit < SYNC_TILE_RADIX; digit++) {
+      if (index + digit*stride >= tiles)
+        break;
+      loki_receive_token(CH_REGISTER_7);
+    }
+  }
+
+  // Tell the parent that this whole subtree has arrived.
+  if (index != 0) {
+    uint parent = index - ((index / stride) % SYNC_TILE_RADIX) * stride;
+    sync_tiles_send(list, first_tile, parent);
+  }
+
+  return stride;
+}
+
+// Synchronise core 0 of a group of `tiles` tiles, where this tile is at
+// position `index`. The group is either `list`, or if that is NULL, the
+// consecutive tiles starting at global tile number `first_tile`. Tokens are
+// combined up the tree of sync_group_gather, then redistributed down it, so
+// both phases take O(log tiles) hops.
+static void sync_group(const uint tiles, const uint index,
+                       const tile_id_t* list, const uint first_tile) {
+  uint stride = sync_group_gather(tiles, index, list, first_tile);
+  uint digit;
+
+  // Wait to be told that everyone else has arrived too.
+  if (index != 0)
     loki_receive_token(CH_REGISTER_7);
-  } else {
-    // All tokens have now been received, so notify all tiles.
-    assert(tile == 0);
-    int destination;
-    for (destination = 1; destination < tiles; destination++) {
-      int address = loki_core_address(int2tile(destination), 0, CH_REGISTER_7,
-                                      INFINITE_CREDIT_COUNT);
-      set_channel_map(2, address);
-      loki_send_token(2);
+
+  // Release children, largest subtrees first.
+  while (stride > 1) {
+    stride /= SYNC_TILE_RADIX;
+
+    for (digit = 1; digit < SYNC_TILE_RADIX; digit++) {
+      if (index + digit*stride >= tiles)
+        break;
+      sync_tiles_send(list, first_tile, index + digit*stride);
     }
   }
 }
 
+// Gather phase of sync_tiles_ex only.
+static inline uint sync_tiles_gather(const uint tiles, const uint first_tile) {
+  const uint index = tile2int(get_tile_id()) - first_tile;
+  return sync_group_gather(tiles, index, NULL, first_tile);
+}
+
+// Synchronise core 0 of `tiles` consecutive tiles, starting at global tile
+// number `first_tile`.
+static inline void sync_tiles_ex(const uint tiles, const uint first_tile) {
+  const uint index = tile2int(get_tile_id()) - first_tile;
+  sync_group(tiles, index, NULL, first_tile);
+}
+
+// Only continue after all tiles have executed this function. Tokens from each
+// tile are combined in a tree, then redistributed to show when all have been
+// received.
+void loki_sync_tiles(const uint tiles) {
+  if (tiles <= 1)
+    return;
+
+  assert(get_core_id() == 0);
+  assert(tiles <= COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS);
+
+  LOKI_PROF_BEGIN(LOKI_PROF_BARRIER);
+  LOKI_TRACE_EVENT(LOKI_TRACE_BARRIER_ENTER, tiles);
+  sync_tiles_ex(tiles, 0);
+  LOKI_TRACE_EVENT(LOKI_TRACE_BARRIER_EXIT, tiles);
+  LOKI_PROF_END(LOKI_PROF_BARRIER);
+}
+
 // Only continue after all cores have executed this function. Tokens from each
 // core are collected, then redistributed to show when all have been received.
-// TODO: could speedup sync within a tile by using multicast until buffers fill?
 void loki_sync_ex(const uint cores, const tile_id_t first_tile) {
   if (cores <= 1)
     return;
 
   assert(cores <= CORES_PER_TILE * COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS);
 
-  uint core = get_core_id();
+  LOKI_PROF_BEGIN(LOKI_PROF_BARRIER);
+  LOKI_TRACE_EVENT(LOKI_TRACE_BARRIER_ENTER, cores);
+
   tile_id_t tile = get_tile_id();
   uint coresThisTile = cores_this_tile(cores, tile, first_tile);
 
-  // All cores except the final one wait until they receive a token from their
-  // neighbour. (A tree structure would be more efficient, but there isn't much
-  // difference with so few cores.)
-  if (core < coresThisTile-1)
-    loki_receive_token(CH_REGISTER_3);
-
-  // All cores except the first one send a token to their other neighbour
-  // (after setting up a connection).
-  if (core > 0) {
-    int address = loki_mcast_address(single_core_bitmask(core-1),
-                                     CH_REGISTER_3, false);
-    set_channel_map(2, address);
-    loki_send_token(2);
+  sync_tile_gather(coresThisTile);
 
-    // Receive token from core 0, telling us that synchronisation has finished.
-    loki_receive_token(CH_REGISTER_3);
-  } else {
-    // All core 0s then synchronise between tiles using the same process.
-    assert(core == 0);
+  // All core 0s then synchronise between tiles.
+  if (get_core_id() == 0 && cores > CORES_PER_TILE)
+    sync_tiles_ex(num_tiles(cores), tile2int(first_tile));
 
-    loki_sync_tiles(num_tiles(cores));
+  sync_tile_release(coresThisTile);
 
-    // All core 0s need to distribute the token throughout their tiles.
-    if (coresThisTile > 1) {
-      int bitmask = all_cores_except_0(coresThisTile);
-      int address = loki_mcast_address(bitmask, CH_REGISTER_3, false);
-      set_channel_map(2, address);
-      loki_send_token(2);
-    }
-  }
+  LOKI_TRACE_EVENT(LOKI_TRACE_BARRIER_EXIT, cores);
+  LOKI_PROF_END(LOKI_PROF_BARRIER);
 }
 
 void loki_tile_sync(const uint cores) {
@@ -660,32 +1144,12 @@ void loki_tile_sync(const uint cores) {
   if (cores <= 1)
     return;
 
-  uint core = get_core_id();
-
-  // All cores except the final one wait until they receive a token from their
-  // neighbour. (A tree structure would be more efficient, but there isn't much
-  // difference with so few cores.)
-  if (core < cores-1)
-    loki_receive_token(CH_REGISTER_3);
-
-  // All cores except the first one send a token to their other neighbour
-  // (after setting up a connection).
-  if (core > 0) {
-    int address = loki_mcast_address(single_core_bitmask(core-1),
-                                     CH_REGISTER_3, false);
-    set_channel_map(2, address);
-    loki_send_token(2);
-    loki_receive_token(CH_REGISTER_3);
-  }
-
-  // Core 0 notifies all other cores when synchronisation has finished.
-  if (core == 0) {
-    // All core 0s need to distribute the token throughout their tiles.
-    int bitmask = all_cores_except_0(cores);
-    int address = loki_mcast_address(bitmask, CH_REGISTER_3, false);
-    set_channel_map(2, address);
-    loki_send_token(2);
-  }
+  LOKI_PROF_BEGIN(LOKI_PROF_BARRIER);
+  LOKI_TRACE_EVENT(LOKI_TRACE_BARRIER_ENTER, cores);
+  sync_tile_gather(cores);
+  sync_tile_release(cores);
+  LOKI_TRACE_EVENT(LOKI_TRACE_BARRIER_EXIT, cores);
+  LOKI_PROF_END(LOKI_PROF_BARRIER);
 }
 
 // Wait until the end_parallel_section function has been called. This must be
@@ -704,23 +1168,35 @@ static inline void wait_end_parallel_section() {
 typedef struct distributed_func_internal_ {
   distributed_func const *config;
   tile_id_t first_tile;
+  bool join;            // Whether completion is reported to the first tile.
 } distributed_func_internal;
 
+// Data of at most this many bytes is sent straight to each remote tile instead
+// of through main memory.
+#define EXECUTE_STREAM_LIMIT 128
+
+// Executed by cores other than core 0 when core 0 needs to know when they are
+// done. Runs the function, then tells core 0 of this tile that it has finished.
+static void distributed_member(const void* data, general_func func) {
+  func(data);
+  sync_tile_gather(0);
+}
+
 // Start cores on the current tile. This must be executed by core 0.
 static void distribute_to_local_tile(const distributed_func_internal *internal) {
   const distributed_func *config = internal->config;
 
-  // Invalidate all data and refetch it to ensure it is up-to-date if we are on
-  // a different tile.
-  if (get_tile_id() != internal->first_tile) {
-    loki_channel_invalidate_data(1, config, sizeof(distributed_func));
-    loki_channel_invalidate_data(1, config->data, config->data_size);
-  }
-
   // Make multicast connections to all other members of the SIMD group.
   const tile_id_t tile = get_tile_id();
   const int cores = cores_this_tile(config->cores, tile, internal->first_tile);
 
+  // Other tiles hold their own copy of the data on core 0's stack, so must
+  // know when all cores are finished with it, even when not joining.
+  const bool report = internal->join || tile != internal->first_tile;
+
+  LOKI_PROF_BEGIN(LOKI_PROF_LAUNCH);
+  LOKI_TRACE_EVENT(LOKI_TRACE_LAUNCH, config->cores);
+
   if (cores > 1) {
     const unsigned int bitmask = all_cores_except_0(cores);
     const channel_t ipk_fifos = loki_mcast_address(bitmask, 0, false);
@@ -728,78 +1204,179 @@ static void distribute_to_local_tile(const distributed_func_internal *internal)
 
     set_channel_map(2, data_inputs);
     loki_send(2, (int)config->data);      // send pointer to function argument(s)
-    loki_send(2, (int)&loki_sleep);       // send function pointers
-    loki_send(2, (int)config->func);
 
-    // Tell all cores to start executing the loop.
-    set_channel_map(2, ipk_fifos);
-    asm volatile (
-      "fetchr 0f\n"
-      "rmtexecute -> 2\n"         // begin remote execution
-      "addu r13, r3, r0\n"        // receive pointer to arguments
-      "addu r10, r3, r0\n"        // set return address
-      "fetch.eop r3\n"            // fetch function to execute
-      "0:\n"
-      // No clobbers because this is all executed remotely.
-    );
+    if (report) {
+      loki_send(2, (int)config->func);
+      loki_send(2, (int)&loki_sleep);     // send function pointers
+      loki_send(2, (int)&distributed_member);
+
+      // Tell all cores to start executing the function, and to report back.
+      set_channel_map(2, ipk_fifos);
+      asm volatile (
+        "fetchr 0f\n"
+        "rmtexecute -> 2\n"       // begin remote execution
+        "addu r13, r3, r0\n"      // receive pointer to arguments
+        "addu r14, r3, r0\n"      // receive function to execute
+        "addu r10, r3, r0\n"      // set return address
+        "fetch.eop r3\n"          // fetch wrapper function
+        "0:\n"
+        // No clobbers because this is all executed remotely.
+      );
+    }
+    else {
+      loki_send(2, (int)&loki_sleep);     // send function pointers
+      loki_send(2, (int)config->func);
+
+      // Tell all cores to start executing the loop.
+      set_channel_map(2, ipk_fifos);
+      asm volatile (
+        "fetchr 0f\n"
+        "rmtexecute -> 2\n"       // begin remote execution
+        "addu r13, r3, r0\n"      // receive pointer to arguments
+        "addu r10, r3, r0\n"      // set return address
+        "fetch.eop r3\n"          // fetch function to execute
+        "0:\n"
+        // No clobbers because this is all executed remotely.
+      );
+    }
   }
 
+  LOKI_PROF_END(LOKI_PROF_LAUNCH);
+
   // Now that all the other cores are going, this core can start on its share of
   // the work.
   config->func(config->data);
 
-}
-
-// Start cores on another tile.
-static void distribute_to_remote_tile(tile_id_t tile, distributed_func_internal const *internal) {
-  // Assume that all data has already been flushed.
+  // Other tiles pass their completion up the tree straight away. The first
+  // tile waits in loki_execute_join instead.
+  if (report && tile != internal->first_tile) {
+    sync_tile_gather(cores);
+    if (internal->join)
+      sync_tiles_gather(num_tiles(config->cores), tile2int(internal->first_tile));
+  }
 
-  // Have core 0 of the remote tile share the data with all other cores there.
-  loki_remote_execute(tile, 0, &distribute_to_local_tile, (void*)internal,
-                      sizeof(distributed_func_internal));
 }
 
-// The main function to call to execute the same function on many cores.
-void loki_execute(const distributed_func* config) {
-  // Multiple tiles: malloc data, and share via main memory.
-  if (config->cores > CORES_PER_TILE) {
-    distributed_func_internal* internal =
-        loki_malloc(sizeof(distributed_func_internal));
-    internal->config = config;
-    internal->first_tile = get_tile_id();
-
-    // Flush the configuration data so it is accessible to the remote tiles.
-    loki_channel_flush_data(1, internal, sizeof(distributed_func_internal));
-    loki_channel_flush_data(1, config, sizeof(distributed_func));
-    loki_channel_flush_data(1, config->data, config->data_size);
+// Executed by core 0 of each remote tile. Receives the configuration, and
+// usually the data too, from the first tile.
+static void distribute_receive(void) {
+  distributed_func config;
+  distributed_func_internal internal;
+
+  internal.first_tile = loki_receive(3);
+  internal.join       = loki_receive(3);
+  internal.config     = &config;
+  config.cores        = loki_receive(3);
+  config.func         = (general_func)loki_receive(3);
+  config.data_size    = loki_receive(3);
+
+  if (config.data_size == 0) {
+    // Nothing to copy: the pointer refers to data shared some other way.
+    config.data = (const void*)loki_receive(3);
+    distribute_to_local_tile(&internal);
+  }
+  else if (config.data_size > EXECUTE_STREAM_LIMIT) {
+    // Large data was flushed to main memory instead.
+    config.data = (const void*)loki_receive(3);
+    loki_channel_invalidate_data(1, config.data, config.data_size);
+    distribute_to_local_tile(&internal);
+  }
+  else {
+    int data[EXECUTE_STREAM_LIMIT / sizeof(int)];
+    remote_stream_receive(data, config.data_size);
+    config.data = data;
+    distribute_to_local_tile(&internal);
+  }
+}
 
-    int tile;
-    int thisTile = tile2int(get_tile_id());
-    for (tile = 1; tile*CORES_PER_TILE < config->cores; tile++) {
-      distribute_to_remote_tile(int2tile(tile + thisTile), internal);
-    }
+// Start cores on another tile.
+static void distribute_to_remote_tile(tile_id_t tile, distributed_func_internal const *internal) {
+  const distributed_func *config = internal->config;
 
-    distribute_to_local_tile(internal);
+  // Have core 0 of the remote tile share the data with all other cores there.
+  remote_stream_start(tile, &distribute_receive);
+  loki_send(2, internal->first_tile);
+  loki_send(2, internal->join);
+  loki_send(2, config->cores);
+  loki_send(2, (int)config->func);
+  loki_send(2, config->data_size);
+
+  // Assume that large data has already been flushed. With no size given, the
+  // pointer is passed on as it is.
+  if (config->data_size == 0 || config->data_size > EXECUTE_STREAM_LIMIT)
+    loki_send(2, (int)config->data);
+  else
+    remote_stream_send(config->data, config->data_size);
+}
 
-    // TODO: free(internal) when we know all cores have finished with it.
-  }
+// Start all cores executing the function. If `join` is set, completion tokens
+// will be sent to the first tile to be collected by loki_execute_join.
+static loki_execution execute(const distributed_func* config, const bool join) {
+  loki_execution handle = {
+      .cores = config->cores
+    , .first_tile = get_tile_id()
+  };
 
-  // Single tile: allocate on stack and share locally. malloc relies on global
-  // variables, and is unsafe.
-  else if (config->cores > 1) {
+  // Everything needed by other cores is sent to them directly, so the
+  // configuration can live on the stack. malloc relies on global variables,
+  // and is unsafe.
+  if (config->cores > 1) {
     distributed_func_internal internal;
     internal.config = config;
     internal.first_tile = get_tile_id();
+    internal.join = join;
+
+    if (config->cores > CORES_PER_TILE) {
+      LOKI_PROF_BEGIN(LOKI_PROF_LAUNCH);
+
+      // Only data too large to stream is shared through main memory.
+      if (config->data_size > EXECUTE_STREAM_LIMIT)
+        loki_channel_flush_data(1, config->data, config->data_size);
+
+      int tile;
+      int thisTile = tile2int(get_tile_id());
+      for (tile = 1; tile*CORES_PER_TILE < config->cores; tile++) {
+        distribute_to_remote_tile(int2tile(tile + thisTile), &internal);
+      }
+
+      LOKI_PROF_END(LOKI_PROF_LAUNCH);
+    }
 
     distribute_to_local_tile(&internal);
-    // TODO: Would like a sync here to make sure all cores have finished with
-    // data before deallocating it.
   }
 
   // Single core: execute function directly.
   else
     config->func(config->data);
 
+  return handle;
+}
+
+// The main function to call to execute the same function on many cores.
+void loki_execute(const distributed_func* config) {
+  execute(config, false);
+}
+
+loki_execution loki_execute_async(const distributed_func* config) {
+  return execute(config, true);
+}
+
+void loki_execute_join(loki_execution* handle) {
+  assert(get_tile_id() == handle->first_tile && get_core_id() == 0);
+
+  if (handle->cores > 1) {
+    LOKI_PROF_BEGIN(LOKI_PROF_BARRIER);
+    LOKI_TRACE_EVENT(LOKI_TRACE_BARRIER_ENTER, handle->cores);
+
+    sync_tile_gather(cores_this_tile(handle->cores, handle->first_tile,
+                                     handle->first_tile));
+
+    if (handle->cores > CORES_PER_TILE)
+      sync_tiles_gather(num_tiles(handle->cores), tile2int(handle->first_tile));
+
+    LOKI_TRACE_EVENT(LOKI_TRACE_BARRIER_EXIT, handle->cores);
+    LOKI_PROF_END(LOKI_PROF_BARRIER);
+  }
 }
 
 
@@ -808,9 +1385,9 @@ void loki_execute(const distributed_func* config) {
 // SIMD
 //
 //   All cores execute the same code, but not in lockstep. Each core executes
-//   1/num_cores of the iterations, currently strided (i.e. next iteration =
-//   current iteration + num cores).
-//   TODO: option to use chunked distribution (requires a division)
+//   1/num_cores of the iterations. By default these are strided (i.e. next
+//   iteration = current iteration + num cores), but blocked, chunked and guided
+//   distributions are also available (see loop_schedule).
 //============================================================================//
 
 struct loop_config_internal {
@@ -818,35 +1395,290 @@ struct loop_config_internal {
   tile_id_t first_tile;
 };
 
+// Next unclaimed iteration of a guided loop, one counter per tile. Each counter
+// fills a whole cache line so that tiles never write back over each other's
+// counters.
+static struct {
+  int next;
+  int padding[7];
+} simd_guided_counter[COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS]
+    __attribute__((aligned(32)));
+
+// First iteration of the `index`th of `parts` contiguous blocks. Blocks differ
+// in size by at most one iteration.
+static inline int simd_block_start(int iterations, int parts, int index) {
+  int quotient = iterations / parts;
+  int remainder = iterations % parts;
+  return index * quotient + (index < remainder ? index : remainder);
+}
+
+// Position in the group of core 0 of `tile`.
+static inline int simd_tile_first_core(const tile_id_t tile,
+                                       const tile_id_t first_tile) {
+  return CORES_PER_TILE * (tile2int(tile) - tile2int(first_tile));
+}
+
+// Range of iterations shared by the cores of the tile holding the given core,
+// for guided scheduling.
+static inline void simd_tile_block(const loop_config* config, int core,
+                                   int* first, int* last, int* tile_cores) {
+  int first_core = core - (core % CORES_PER_TILE);
+  *tile_cores = config->cores - first_core;
+  if (*tile_cores > CORES_PER_TILE)
+    *tile_cores = CORES_PER_TILE;
+
+  *first = simd_block_start(config->iterations, config->cores, first_core);
+  *last = simd_block_start(config->iterations, config->cores,
+                           first_core + *tile_cores);
+}
+
+// Prepare this tile's guided scheduling counter. Must be executed by core 0
+// before any other core on the tile starts work.
+static inline void simd_guided_init(const loop_config* config,
+                                    const tile_id_t first_tile) {
+  int first, last, tile_cores;
+  simd_tile_block(config, simd_tile_first_core(get_tile_id(), first_tile),
+                  &first, &last, &tile_cores);
+
+  simd_guided_counter[tile2int(get_tile_id())].next = first;
+  barrier();
+}
+
+// Progress of one core through a prefetched stream.
+struct simd_stream {
+  const char* base;
+  int         stride;    // Bytes between this core's consecutive iterations.
+  int         distance;
+  uint        last;      // Most recently prefetched line.
+};
+
+// Execute iterations start, start+step, ... up to end, prefetching each stream
+// `distance` iterations ahead.
+static void simd_range_prefetch(const loop_config* config, int start, int end,
+                                int step, int core) {
+  iteration_func func = config->iteration;
+  struct simd_stream streams[LOOP_PREFETCH_STREAMS];
+  int count = 0;
+  int s, iter;
+
+  for (s = 0; s < LOOP_PREFETCH_STREAMS; s++) {
+    const loop_prefetch* prefetch = &config->prefetch[s];
+    if (prefetch->base == NULL)
+      continue;
+
+    struct simd_stream* stream = &streams[count++];
+    const int bytes = prefetch->stride * step;
+    const int magnitude = (bytes < 0) ? -bytes : bytes;
+
+    stream->base = (const char*)prefetch->base + start * prefetch->stride;
+    stream->stride = bytes;
+    stream->distance = (prefetch->distance > 0) ? prefetch->distance
+                     : (magnitude == 0) ? 1
+                     : (4 * 32 + magnitude - 1) / magnitude;
+    stream->last = ~0u;
+  }
+
+  // Steps ahead of `iter` which are prefetched, capped at the end of the range.
+  const int steps = (end - start + step - 1) / step;
+  int ahead[LOOP_PREFETCH_STREAMS];
+
+  // Start each stream off with everything up to its distance.
+  for (s = 0; s < count; s++) {
+    struct simd_stream* stream = &streams[s];
+    ahead[s] = (stream->distance < steps) ? stream->distance : steps;
+
+    int i;
+    for (i = 0; i < ahead[s]; i++) {
+      const uint line = (uint)(stream->base + i * stream->stride) & ~0x1f;
+      if (line != stream->last) {
+        loki_channel_prefetch_cache_line(1, (void*)line);
+        stream->last = line;
+      }
+    }
+  }
+
+  for (iter = start; iter < end; iter += step) {
+    for (s = 0; s < count; s++) {
+      struct simd_stream* stream = &streams[s];
+      if (ahead[s] >= steps)
+        continue;
+
+      const uint line = (uint)(stream->base + ahead[s] * stream->stride) & ~0x1f;
+      ahead[s]++;
+      if (line != stream->last) {
+        loki_channel_prefetch_cache_line(1, (void*)line);
+        stream->last = line;
+      }
+    }
+
+    func(iter, core);
+  }
+}
+
+// Execute iterations start, start+step, ... up to end.
+static inline void simd_range(const loop_config* config, int start, int end,
+                              int step, int core) {
+  if (config->prefetch[0].base == NULL && config->prefetch[1].base == NULL) {
+    iteration_func func = config->iteration;
+    int iter;
+    for (iter = start; iter < end; iter += step) {
+      // Does the compiler have to assume that all non-volatile registers may
+      // be written to? It would then have to store/retrieve them all every
+      // iteration, which is bad for tight loops.
+      func(iter, core);
+    }
+  }
+  else if (start < end)
+    simd_range_prefetch(config, start, end, step, core);
+}
+
+// Claim chunks of iterations from this tile's counter until there are none
+// left. The counter is shared by all cores on the tile, which see the same L1,
+// so a load-and-add makes each claim atomic.
+static inline void simd_guided_iterations(const loop_config* config, int core) {
+  int *counter = &simd_guided_counter[tile2int(get_tile_id())].next;
+  int min_chunk = (config->chunk_size > 0) ? config->chunk_size : 1;
+  int first, last, tile_cores;
+  simd_tile_block(config, core, &first, &last, &tile_cores);
+
+  // Estimate of the next unclaimed iteration, used to size the next chunk.
+  int claimed = first;
+
+  while (1) {
+    int chunk = (last - claimed) / (2 * tile_cores);
+    if (chunk < min_chunk)
+      chunk = min_chunk;
+
+    loki_channel_load_and_add(1, counter, chunk);
+    int start = loki_receive(2);
+
+    if (start >= last)
+      break;
+
+    int end = (start + chunk < last) ? start + chunk : last;
+    simd_range(config, start, end, 1, core);
+
+    claimed = end;
+  }
+}
+
+// Combine two partial results of a SIMD loop's in-network reduction.
+static int simd_combine(const loop_reduction* reduction, int a, int b) {
+  if (reduction->op == LOOP_REDUCE_CUSTOM)
+    return reduction->combine(a, b);
+
+  union {
+    int       word;
+    float     f;
+    v2int16_t v2;
+    v4int8_t  v4;
+  } x = {.word = a}, y = {.word = b};
+  int i;
+
+  switch (reduction->type) {
+  case LOOP_REDUCE_INT:
+    switch (reduction->op) {
+    case LOOP_REDUCE_SUM: return a + b;
+    case LOOP_REDUCE_MIN: return (a < b) ? a : b;
+    case LOOP_REDUCE_MAX: return (a > b) ? a : b;
+    default: break;
+    }
+    break;
+
+  case LOOP_REDUCE_FLOAT:
+    switch (reduction->op) {
+    case LOOP_REDUCE_SUM: x.f = x.f + y.f; return x.word;
+    case LOOP_REDUCE_MIN: return (x.f < y.f) ? a : b;
+    case LOOP_REDUCE_MAX: return (x.f > y.f) ? a : b;
+    default: break;
+    }
+    break;
+
+  case LOOP_REDUCE_V2INT16:
+    for (i = 0; i < 2; i++) {
+      switch (reduction->op) {
+      case LOOP_REDUCE_SUM: x.v2[i] += y.v2[i]; break;
+      case LOOP_REDUCE_MIN: if (y.v2[i] < x.v2[i]) x.v2[i] = y.v2[i]; break;
+      case LOOP_REDUCE_MAX: if (y.v2[i] > x.v2[i]) x.v2[i] = y.v2[i]; break;
+      default: assert(0);
+      }
+    }
+    return x.word;
+
+  case LOOP_REDUCE_V4INT8:
+    for (i = 0; i < 4; i++) {
+      switch (reduction->op) {
+      case LOOP_REDUCE_SUM: x.v4[i] += y.v4[i]; break;
+      case LOOP_REDUCE_MIN: if (y.v4[i] < x.v4[i]) x.v4[i] = y.v4[i]; break;
+      case LOOP_REDUCE_MAX: if (y.v4[i] > x.v4[i]) x.v4[i] = y.v4[i]; break;
+      default: assert(0);
+      }
+    }
+    return x.word;
+  }
+
+  assert(0);
+  return 0;
+}
+
 // Signal that this core has finished its share of the SIMD loop. This is done
 // in such a way that when the control core (the one that started the SIMD stuff)
 // receives the signal, it knows that all cores have finished and that it is
 // safe to continue through the program.
-// TODO: it may be worth combining this step with the reduction stage - e.g.
-// instead of sending a token, send this core's partial result.
-static inline void simd_finished(const loop_config* config, int core) {
-
-  // All cores except the final one wait until they receive a token from their
-  // neighbour. (A tree structure would be more efficient, but there isn't much
-  // difference with so few cores.)
-  if (core < config->cores - 1)
-    loki_receive_token(3);
+//
+// Cores form a binomial tree: at each level, a core either receives from the
+// core `stride` positions above it or sends to the core `stride` positions
+// below it and stops. Each message carries the sender's partial result of the
+// in-network reduction (or 0 if there is none), so core 0 ends up with the
+// final value. Levels within a tile use CH_REGISTER_3; levels between tiles
+// connect core 0s using CH_REGISTER_7.
+static inline void simd_finished(const loop_config* config, int core,
+                                 const tile_id_t first_tile) {
+  const loop_reduction* reduction = &config->reduction;
+  const bool reducing = (reduction->op != LOOP_REDUCE_NONE);
+  const int cores = config->cores;
+
+  int value = reducing ? reduction->partial(core) : 0;
+
+  int stride;
+  for (stride = 1; stride < cores; stride *= 2) {
+    if (core & stride) {
+      const int parent = core - stride;
+      channel_t address;
+      if (stride < CORES_PER_TILE)
+        address = loki_mcast_address(single_core_bitmask(parent % CORES_PER_TILE),
+                                     CH_REGISTER_3, false);
+      else
+        address = loki_core_address(
+            int2tile(tile2int(first_tile) + parent / CORES_PER_TILE), 0,
+            CH_REGISTER_7, INFINITE_CREDIT_COUNT);
+      set_channel_map(2, address);
+      loki_send(2, value);
+      return;
+    }
 
-  // All cores except the first one send a token to their other neighbour
-  // (after setting up a connection).
-  if (core > 0) {
-    int address = loki_mcast_address(single_core_bitmask(core-1), 3, false);
-    set_channel_map(2, address);
-    loki_send_token(2);
+    // Children may finish in any order, so a message received at this level
+    // need not come from this level's child. The combining operation is
+    // commutative, so this doesn't matter.
+    if (core + stride < cores) {
+      const int child = (stride < CORES_PER_TILE) ? loki_receive(3)
+                                                  : loki_receive(7);
+      if (reducing)
+        value = simd_combine(reduction, value, child);
+    }
   }
 
+  // Only core 0 reaches this point.
+  if (reducing && reduction->result != NULL)
+    *reduction->result = value;
 }
 
-// The code that a single core in the SIMD array executes. Note that the
-// iterations are currently striped across the cores - this avoids needing a
-// division to find out which cores execute which iterations, but may reduce
-// locality.
-static void worker_core(const loop_config* config, int core) {
+// The code that a single core in the SIMD array executes. By default the
+// iterations are striped across the cores - this avoids needing a division to
+// find out which cores execute which iterations, but may reduce locality. The
+// other schedules compute their bounds once, before entering the loop.
+static void worker_core(const loop_config* config, int core,
+                        const tile_id_t first_tile) {
 
   int cores = config->cores;
   int iterations = config->iterations;
@@ -858,11 +1690,35 @@ static void worker_core(const loop_config* config, int core) {
 
   int iter;
   if (config->helper == NULL) {
-    for (iter = core; iter < iterations; iter += cores) {
-      // Does the compiler have to assume that all non-volatile registers may be
-      // written to? It would then have to store/retrieve them all every
-      // iteration, which is bad for tight loops.
-      func(iter, core);
+    switch (config->schedule) {
+    case LOOP_SCHEDULE_STRIPED:
+      simd_range(config, core, iterations, cores, core);
+      break;
+
+    case LOOP_SCHEDULE_BLOCKED:
+      simd_range(config, simd_block_start(iterations, cores, core),
+                 simd_block_start(iterations, cores, core + 1), 1, core);
+      break;
+
+    case LOOP_SCHEDULE_CHUNKED: {
+      int chunk = config->chunk_size;
+      int stride = chunk * cores;
+      int start;
+      assert(chunk > 0);
+
+      for (start = core * chunk; start < iterations; start += stride) {
+        int end = (start + chunk < iterations) ? start + chunk : iterations;
+        simd_range(config, start, end, 1, core);
+      }
+      break;
+    }
+
+    case LOOP_SCHEDULE_GUIDED:
+      simd_guided_iterations(config, core);
+      break;
+
+    default:
+      assert(0);
     }
   }
   else {
@@ -884,7 +1740,9 @@ static void worker_core(const loop_config* config, int core) {
 
   // Signal that this core has finished its work. Could this happen before
   // tidying?
-  simd_finished(config, core);
+  LOKI_PROF_BEGIN(LOKI_PROF_REDUCE);
+  simd_finished(config, core, first_tile);
+  LOKI_PROF_END(LOKI_PROF_REDUCE);
 }
 
 // A core will stop work if it executes this function.
@@ -896,8 +1754,10 @@ void loki_sleep(void) {
 }
 
 // Might need inline assembly for lots of this to reduce overhead of sending/receiving
-void helper_core(const loop_config* config) {
+void helper_core(const loop_config* config, const tile_id_t first_tile) {
   assert(config->cores >= 2);
+  assert(config->schedule == LOOP_SCHEDULE_STRIPED);
+  assert(config->reduction.op == LOOP_REDUCE_NONE);
 
   int total_iterations = config->iterations;
   int cores = config->cores;
@@ -907,7 +1767,8 @@ void helper_core(const loop_config* config) {
   // Connect to all cores.
   int bitmask = all_cores_except_0(cores);
   int address = loki_mcast_address(bitmask, 3, false);
-  channel_t c8 = channel_map_swap(8, address);
+  channel_map_reserve(8);
+  set_channel_map(8, address);
 
   if (config->helper_init != NULL)
     config->helper_init();
@@ -939,28 +1800,34 @@ void helper_core(const loop_config* config) {
   // Send 0 to all cores so they know to stop.
   set_channel_map(8, address);
   loki_send(8, 0);
-  channel_map_restore(8, c8);
+  channel_map_free(8);
 
   // Signal that this core has finished its work. Do we need to tidy() too?
-  simd_finished(config, 0);
+  LOKI_PROF_BEGIN(LOKI_PROF_REDUCE);
+  simd_finished(config, 0, first_tile);
+  LOKI_PROF_END(LOKI_PROF_REDUCE);
 }
 
-void simd_member(const loop_config* config, const int core) {
-  const int tile = tile2int(get_tile_id());
-
+// `core` is this core's position in the whole group, counting from core 0 of
+// `first_tile`.
+void simd_member(const loop_config* config, const int core,
+                 const tile_id_t first_tile) {
   if (core == 0) {
     // Determine which role this core is going to play.
     if (config->helper != NULL)
-      helper_core(config);
+      helper_core(config, first_tile);
     else
-      worker_core(config, core + 8*tile);
+      worker_core(config, core, first_tile);
 
     // Combine each core's partial result before returning.
-    if (config->reduce != NULL)
+    if (config->reduce != NULL) {
+      LOKI_PROF_BEGIN(LOKI_PROF_REDUCE);
       config->reduce(config->cores);
+      LOKI_PROF_END(LOKI_PROF_REDUCE);
+    }
   }
   else {
-    worker_core(config, core + 8*tile);
+    worker_core(config, core, first_tile);
   }
 }
 
@@ -971,13 +1838,19 @@ static void simd_local_tile(const struct loop_config_internal* internal) {
   // Make multicast connections to all other members of the SIMD group.
   const tile_id_t tile = get_tile_id();
   const int cores = cores_this_tile(config->cores, tile, internal->first_tile);
+  const int first_core = simd_tile_first_core(tile, internal->first_tile);
   const unsigned int bitmask = all_cores_except_0(cores);
   const channel_t ipk_fifos = loki_mcast_address(bitmask, 0, false);
   const channel_t data_inputs = loki_mcast_address(bitmask, 3, false);
 
+  if (config->schedule == LOOP_SCHEDULE_GUIDED)
+    simd_guided_init(config, internal->first_tile);
+
   set_channel_map(2, ipk_fifos);
   set_channel_map(3, data_inputs);
   loki_send(3, (int)config);            // send pointer to configuration info
+  loki_send(3, first_core);             // send position of this tile's core 0
+  loki_send(3, (int)internal->first_tile);
   loki_send(3, (int)&loki_sleep);       // send function pointers
   loki_send(3, (int)&simd_member);
 
@@ -988,7 +1861,8 @@ static void simd_local_tile(const struct loop_config_internal* internal) {
     "addu r13, r3, r0\n"        // receive pointer to configuration info
     "cregrdi r11, 1\n"          // get core id, and put into r11
     "andi r11, r11, 0x7\n"      // get core id, and put into r11
-    "addu r14, r11, r0\n"       // put core position in argument-passing register
+    "addu r14, r11, r3\n"       // put position in group in argument-passing register
+    "addu r15, r3, r0\n"        // receive first tile of the group
     "addu r10, r3, r0\n"        // set return address
     "fetch.eop r3\n"            // fetch function to execute
     "0:\n"
@@ -997,31 +1871,33 @@ static void simd_local_tile(const struct loop_config_internal* internal) {
 
 }
 
+// Executed by core 0 of each remote tile. Receives a copy of the loop
+// configuration, starts the rest of the tile, and then takes its own share of
+// the iterations. The copy stays on this core's stack until simd_finished has
+// heard from every other core on the tile.
+static void simd_receive(void) {
+  struct loop_config_internal internal;
+  loop_config config;
+
+  internal.first_tile = loki_receive(3);
+  internal.config = &config;
+  remote_stream_receive(&config, sizeof(loop_config));
+
+  LOKI_PROF_BEGIN(LOKI_PROF_LAUNCH);
+  LOKI_TRACE_EVENT(LOKI_TRACE_LAUNCH, config.cores);
+  simd_local_tile(&internal);
+  LOKI_PROF_END(LOKI_PROF_LAUNCH);
+  worker_core(&config, simd_tile_first_core(get_tile_id(), internal.first_tile),
+              internal.first_tile);
+}
+
 // Set up a SIMD group on another tile.
 static void simd_remote_tile(const tile_id_t tile, const struct loop_config_internal *internal) {
-
-  // Connect to core 0 in the tile.
-  channel_t inst_fifo = loki_core_address(tile, 0, 0, INFINITE_CREDIT_COUNT);
-  channel_t data_input = loki_core_address(tile, 0, 3, INFINITE_CREDIT_COUNT);
-  set_channel_map(2, inst_fifo);
-  set_channel_map(3, data_input);
-
-  loki_send(3, (int)internal);               // send pointer to configuration info
-  loki_send(3, (int)&loki_sleep);            // send function pointers
-  loki_send(3, (int)&simd_local_tile);
-
-  // Tell core 0 to set up all other cores on its tile.
-  // TODO: will the pointer to data work from the other tile?
-  asm volatile (
-    "fetchr 0f\n"
-    "rmtexecute -> 2\n"         // begin remote execution
-    "addu r13, r3, r0\n"        // receive pointer to configuration info
-    "addu r10, r3, r0\n"        // set return address
-    "fetch.eop r3\n"            // fetch function to execute
-    "0:\n"
-    // No clobbers because this is all executed remotely.
-  );
-
+  // Send the configuration itself, rather than a pointer to it, since this
+  // tile's copy may not have reached main memory.
+  remote_stream_start(tile, &simd_receive);
+  loki_send(2, internal->first_tile);
+  remote_stream_send(internal->config, sizeof(loop_config));
 }
 
 // The main function to call to execute the loop in parallel.
@@ -1032,418 +1908,3596 @@ void simd_loop(const loop_config* config) {
   };
 
   if (config->cores > 1) {
+    LOKI_PROF_BEGIN(LOKI_PROF_LAUNCH);
+    LOKI_TRACE_EVENT(LOKI_TRACE_LAUNCH, config->cores);
+
     int tile;
     for (tile = 1; tile < num_tiles(config->cores); tile++) {
-      simd_remote_tile(int2tile(tile), &internal);
+      simd_remote_tile(int2tile(tile2int(internal.first_tile) + tile),
+                       &internal);
     }
 
     simd_local_tile(&internal);
+
+    LOKI_PROF_END(LOKI_PROF_LAUNCH);
   }
+  else if (config->schedule == LOOP_SCHEDULE_GUIDED)
+    simd_guided_init(config, internal.first_tile);
 
   // Now that all the other cores are going, this core can start on its share of
   // the work.
-  simd_member(config, 0);
+  simd_member(config, 0, internal.first_tile);
 
 }
 
 
 //============================================================================//
-// Worker farm
+// Vector operations
 //
-//   One core acts as the master and distributes work across a group of workers.
-//   The work is issued in the form of a loop iteration index.
+//   Parallel versions of the vector_ops.h kernels. Each simd_loop iteration
+//   processes one chunk of the arrays, described by vector_job.
 //============================================================================//
 
-// The loop executed by each worker. Executes the provided function for as long
-// as the master allows the worker to live (a nxipk command will be sent when
-// all iterations have completed).
-void worker_thread(const loop_config* config, const int worker) {
+enum vector_op {
+  VECTOR_ADD,
+  VECTOR_SUB,
+  VECTOR_MUL,
+  VECTOR_AXPY,
+  VECTOR_SUM,
+  VECTOR_DOT,
+  VECTOR_MIN,
+  VECTOR_MAX
+};
 
-  // Create a connection back to the master core.
-  // The master core has the following inputs reserved:
-  //   0: instruction packet FIFO
-  //   1: instruction packet cache
-  //   2: channel used to communicate with memory
+// The operation currently being performed. Written by core 0 of tile 0 and
+// flushed before other tiles read it.
+static struct {
+  enum vector_op  op;
+  int32_t        *dst;
+  const int32_t  *a;
+  const int32_t  *b;
+  int32_t         alpha;
+  size_t          n;
+  uint            cores;
+} vector_job __attribute__((aligned(32)));
+
+// Each core's partial result, on its own cache line so that cores on different
+// tiles never write the same line.
+static struct {
+  int32_t value;
+  int     padding[7];
+} vector_partials[CORES_PER_TILE * COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS]
+    __attribute__((aligned(32)));
+
+static inline size_t vector_chunk_size(const int chunk) {
+  size_t start = chunk * LOKI_VEC_CHUNK;
+  return (vector_job.n - start < LOKI_VEC_CHUNK) ? vector_job.n - start
+                                                 : LOKI_VEC_CHUNK;
+}
 
-  int address = loki_mcast_address(single_core_bitmask(0), get_core_id() + 2, false);
-  channel_t c8 = channel_map_swap(8, address);
+static void vector_initialise(int cores, int iterations, int core) {
+  if (get_tile_id() != int2tile(0))
+    loki_channel_invalidate_data(1, &vector_job, sizeof(vector_job));
 
-  // Loop forever, executing the iterations provided. The master will kill the
-  // worker by sending -1 as the iteration.
-  while (1) {
-    loki_send(8, get_core_id());
+  vector_partials[core].value = (vector_job.op == VECTOR_MIN) ? INT32_MAX
+                              : (vector_job.op == VECTOR_MAX) ? INT32_MIN
+                              : 0;
+}
 
-    // Receive the iteration to execute next.
-    int iteration;
-    iteration = loki_receive(3);
+static void vector_iteration(int chunk, int core) {
+  const size_t start = chunk * LOKI_VEC_CHUNK;
+  const size_t size = vector_chunk_size(chunk);
+  const bool multi_tile = vector_job.cores > CORES_PER_TILE;
+  int32_t* const dst = vector_job.dst + start;
+  const int32_t* const a = vector_job.a + start;
+  const int32_t* const b = vector_job.b + start;
+  int32_t* const partial = &vector_partials[core].value;
+  int32_t value;
+
+  // Inputs were flushed by tile 0, so other tiles must not use stale copies.
+  if (multi_tile && get_tile_id() != int2tile(0)) {
+    loki_channel_invalidate_data(1, a, size * sizeof(int32_t));
+    if (vector_job.b != NULL)
+      loki_channel_invalidate_data(1, b, size * sizeof(int32_t));
+    if (vector_job.op == VECTOR_AXPY)
+      loki_channel_invalidate_data(1, dst, size * sizeof(int32_t));
+  }
 
-    if (iteration == -1) break; // end of work signal
-    // Execute the loop iteration.
-    config->iteration(iteration, worker);
+  switch (vector_job.op) {
+  case VECTOR_ADD:  loki_vec_add_int32(dst, a, b, size); break;
+  case VECTOR_SUB:  loki_vec_sub_int32(dst, a, b, size); break;
+  case VECTOR_MUL:  loki_vec_mul_int32(dst, a, b, size); break;
+  case VECTOR_AXPY: loki_vec_axpy_int32(dst, vector_job.alpha, a, size); break;
+  case VECTOR_SUM:  *partial += loki_vec_sum_int32(a, size); break;
+  case VECTOR_DOT:  *partial += loki_vec_dot_int32(a, b, size); break;
+  case VECTOR_MIN:
+    value = loki_vec_min_int32(a, size);
+    *partial = (value < *partial) ? value : *partial;
+    break;
+  case VECTOR_MAX:
+    value = loki_vec_max_int32(a, size);
+    *partial = (value > *partial) ? value : *partial;
+    break;
+  default:
+    assert(0);
   }
-  channel_map_restore(8, c8);
+
+  if (multi_tile && vector_job.dst != NULL)
+    loki_channel_flush_data(1, dst, size * sizeof(int32_t));
 }
 
-// Distribute all loop iterations across the workers, and wait for them all to
-// complete.
-void worker_farm(const loop_config* config) {
-  assert(config->cores > 1);
-  assert(config->cores <= 6); // Currently limited by number of master's input ports
+static int vector_partial(int core) {
+  return vector_partials[core].value;
+}
 
-  // Make multicast connections to all workers.
-  unsigned int bitmask = all_cores_except_0(config->cores);
-  const channel_t ipk_fifos = loki_mcast_address(bitmask, 0, false);
-  const channel_t data_inputs = loki_mcast_address(bitmask, 3, false);
-  set_channel_map(2, ipk_fifos);
-  set_channel_map(3, data_inputs);
+// Run the operation described by vector_job, and return the reduced result
+// for reductions.
+static int32_t vector_run(void) {
+  const size_t n = vector_job.n;
+  const int32_t* dst = vector_job.dst;
+  const bool multi_tile = vector_job.cores > CORES_PER_TILE;
+  int32_t result = 0;
+
+  enum loop_reduce_op reduce = LOOP_REDUCE_NONE;
+  switch (vector_job.op) {
+  case VECTOR_SUM:
+  case VECTOR_DOT: reduce = LOOP_REDUCE_SUM; break;
+  case VECTOR_MIN: reduce = LOOP_REDUCE_MIN; result = INT32_MAX; break;
+  case VECTOR_MAX: reduce = LOOP_REDUCE_MAX; result = INT32_MIN; break;
+  default: break;
+  }
 
-  loki_send(3, (int)config);  // send pointer to configuration info
+  if (n == 0)
+    return result;
+
+  if (multi_tile) {
+    assert(dst == NULL || ((uint)dst & 0x1f) == 0);
+    loki_channel_flush_data(1, &vector_job, sizeof(vector_job));
+    loki_channel_flush_data(1, vector_job.a, n * sizeof(int32_t));
+    if (vector_job.b != NULL)
+      loki_channel_flush_data(1, vector_job.b, n * sizeof(int32_t));
+    if (dst != NULL)
+      loki_channel_flush_data(1, dst, n * sizeof(int32_t));
+  }
 
-  asm (
-    "fetchr 0f\n"
-    "rmtexecute -> 2\n"             // begin remote execution
-    "addu r13, r3, r0\n"            // receive pointer to configuration info
-    "cregrdi r11, 1\n"              // get core id, and put into r11
-    "andi r11, r11, 0x7\n"          // get core id, and put into r11
-    "addui r14, r11, -1\n"          // worker ID = core ID - 1 because core 0 is master
-    "lli r10, %lo(loki_sleep)\n"    // set return address - sleep when finished
-    "lui r10, %hi(loki_sleep)\n"
-    "lli r24, %lo(worker_thread)\n"
-    "lui r24, %hi(worker_thread)\n"
-    "fetch.eop r24\n"               // fetch the worker's task
-    "0:\n"
-  );
+  loop_config config = {
+    .cores      = vector_job.cores,
+    .iterations = (n + LOKI_VEC_CHUNK - 1) / LOKI_VEC_CHUNK,
+    .initialise = &vector_initialise,
+    .iteration  = &vector_iteration,
+    .schedule   = LOOP_SCHEDULE_BLOCKED,
+    .reduction  = {
+      .op      = reduce,
+      .type    = LOOP_REDUCE_INT,
+      .partial = &vector_partial,
+      .result  = &result
+    }
+  };
+  simd_loop(&config);
 
-  // Issue workers with loop iterations to work on.
-  int iter;
-  for (iter = 0; iter < config->iterations; iter++) {
-    const int worker = receive_any_input();             // wait for any worker to request work
-    const int worker_addr = loki_mcast_address(single_core_bitmask(worker), 3, false);
-    set_channel_map(3, worker_addr);                    // connect
-    loki_send(3, iter);                                      // send work
-  }
+  // Every core has flushed its chunks, so refetch the other tiles' results.
+  if (multi_tile && dst != NULL)
+    loki_channel_invalidate_data(1, dst, n * sizeof(int32_t));
 
-  // Wait for all workers to finish their final tasks, and kill them.
-  int finished;
-  for (finished = 0; finished < config->cores-1; finished++) {
-    const int worker = receive_any_input();             // wait for any worker to request work
-    const int worker_addr = loki_mcast_address(single_core_bitmask(worker), 3, false);
-    set_channel_map(3, worker_addr);                    // connect
-    loki_send(3, -1);                                      // send end of work
-  }
+  return result;
+}
+
+static inline int32_t vector_start(enum vector_op op, uint cores, int32_t* dst,
+                                   const int32_t* a, const int32_t* b,
+                                   int32_t alpha, size_t n) {
+  vector_job.op = op;
+  vector_job.dst = dst;
+  vector_job.a = a;
+  vector_job.b = b;
+  vector_job.alpha = alpha;
+  vector_job.n = n;
+  vector_job.cores = cores;
+  return vector_run();
+}
+
+void loki_vec_add_int32_parallel(uint cores, int32_t* dst, const int32_t* a,
+                                 const int32_t* b, size_t n) {
+  vector_start(VECTOR_ADD, cores, dst, a, b, 0, n);
+}
+
+void loki_vec_sub_int32_parallel(uint cores, int32_t* dst, const int32_t* a,
+                                 const int32_t* b, size_t n) {
+  vector_start(VECTOR_SUB, cores, dst, a, b, 0, n);
+}
+
+void loki_vec_mul_int32_parallel(uint cores, int32_t* dst, const int32_t* a,
+                                 const int32_t* b, size_t n) {
+  vector_start(VECTOR_MUL, cores, dst, a, b, 0, n);
+}
+
+void loki_vec_axpy_int32_parallel(uint cores, int32_t* y, int32_t alpha,
+                                  const int32_t* x, size_t n) {
+  vector_start(VECTOR_AXPY, cores, y, x, NULL, alpha, n);
+}
+
+int32_t loki_vec_sum_int32_parallel(uint cores, const int32_t* a, size_t n) {
+  return vector_start(VECTOR_SUM, cores, NULL, a, NULL, 0, n);
+}
 
-  // Combine each core's partial result before returning.
-  config->reduce(config->cores-1);
+int32_t loki_vec_dot_int32_parallel(uint cores, const int32_t* a,
+                                    const int32_t* b, size_t n) {
+  return vector_start(VECTOR_DOT, cores, NULL, a, b, 0, n);
+}
+
+int32_t loki_vec_min_int32_parallel(uint cores, const int32_t* a, size_t n) {
+  return vector_start(VECTOR_MIN, cores, NULL, a, NULL, 0, n);
+}
 
+int32_t loki_vec_max_int32_parallel(uint cores, const int32_t* a, size_t n) {
+  return vector_start(VECTOR_MAX, cores, NULL, a, NULL, 0, n);
 }
 
 
 //============================================================================//
-// Task-level pipeline
+// Algorithms
 //
-//   Each core executes a different task, and tells the next core when it has
-//   finished each iteration.
+//   Each phase is a simd_loop with one iteration per core, so iteration `n` is
+//   core n's block. Phases pass results to each other through tables in
+//   memory; when the loop spans several tiles, whoever writes a table flushes
+//   it, and whoever reads it invalidates it first.
 //============================================================================//
 
-void pipeline_stage(const pipeline_config* config, const int stage) {
-
-  const int have_predecessor = (stage > 0);
-  const int have_successor = (stage < config->cores - 1);
+#define ALGORITHM_LINE_WORDS 8
+#define ALGORITHM_RADIX_BITS 8
+#define ALGORITHM_RADIX (1 << ALGORITHM_RADIX_BITS)
+
+enum algorithm_phase {
+  ALGORITHM_REDUCE,           // Fold each block with a custom function
+  ALGORITHM_SCAN_SUM,         // Sum each block
+  ALGORITHM_SCAN,             // Prefix sum of each block, from its offset
+  ALGORITHM_HISTOGRAM_COUNT,  // Count each block's values into its table
+  ALGORITHM_HISTOGRAM_MERGE,  // Add up a range of bins from every table
+  ALGORITHM_SORT_COUNT,       // Count each block's digits into its table
+  ALGORITHM_SORT_OFFSETS,     // Turn a range of digits' counts into positions
+  ALGORITHM_SORT_SCATTER      // Move each block's elements to their positions
+};
 
-  // Address to connect to. Most cores connect to the next stage in the pipeline
-  // so they can tell when it is safe to begin the next loop iteration. The
-  // final core, however, tells the first core when all work has finished.
-  int next_addr;
-  if (have_successor)
-    next_addr = loki_mcast_address(single_core_bitmask(stage+1), 3, false);
-  else
-    next_addr = loki_mcast_address(single_core_bitmask(0), 3, false);
+// The phase currently being performed. Written by core 0 of tile 0 and
+// flushed before other tiles read it.
+static struct {
+  enum algorithm_phase  phase;
+  const int32_t        *src;
+  int32_t              *dst;
+  size_t                n;
+  uint                  cores;
+  combine_func          combine;
+  int32_t               identity;
+  uint32_t             *tables;       // One table per core, `table_words` apart
+  uint                  table_words;
+  uint                  bins;         // Entries used in each table
+  uint32_t             *counts;       // Histogram, or total of each digit
+  int                   shift;        // Position of the current digit
+} algorithm_job __attribute__((aligned(32)));
+
+// Each core's partial result and, for scans, the offset of its block. One
+// cache line per core.
+static struct {
+  int32_t value;
+  int32_t offset;
+  int     padding[6];
+} algorithm_cores[CORES_PER_TILE * COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS]
+    __attribute__((aligned(32)));
+
+// Number of elements of each digit in the current pass of a sort, and then
+// the position of the first of them.
+static uint32_t algorithm_digits[ALGORITHM_RADIX] __attribute__((aligned(32)));
+
+static inline bool algorithm_multi_tile(void) {
+  return algorithm_job.cores > CORES_PER_TILE;
+}
 
-  // Make connection.
-  channel_t c8 = channel_map_swap(8, next_addr);
+// Whether this core must invalidate data written by core 0 of tile 0.
+static inline bool algorithm_remote(void) {
+  return get_tile_id() != int2tile(0);
+}
 
-  // If there is work to do before the pipeline starts, do it now.
-  if (config->initialise && config->initialise[stage])
-    config->initialise[stage]();
+// The `index`th of `parts` blocks of `count` words, in whole cache lines
+// (except at the end). Blocks differ in size by at most one line.
+static inline void algorithm_block(size_t count, int parts, int index,
+                                   size_t* start, size_t* end) {
+  const int lines = (count + ALGORITHM_LINE_WORDS - 1) / ALGORITHM_LINE_WORDS;
+  *start = simd_block_start(lines, parts, index) * ALGORITHM_LINE_WORDS;
+  *end = simd_block_start(lines, parts, index + 1) * ALGORITHM_LINE_WORDS;
+  if (*start > count) *start = count;
+  if (*end > count)   *end = count;
+}
 
-  // Execute loop
-  int i;
-  for (i=0; i<config->iterations; i++) {
-    // If there is a previous core in the pipeline, wait for it to tell us that
-    // we can begin work on the next iteration.
-    if (have_predecessor)
-      loki_receive_token(3);
+// Digit of `value` for the current pass. The sign bit is flipped in the top
+// digit so that negative values come first.
+static inline uint algorithm_digit(int32_t value, int shift) {
+  const uint digit = ((uint32_t)value >> shift) & (ALGORITHM_RADIX - 1);
+  return (shift == 32 - ALGORITHM_RADIX_BITS) ? digit ^ (ALGORITHM_RADIX >> 1)
+                                              : digit;
+}
 
-    // Execute this iteration.
-    config->stage_func[stage](i);
+static void algorithm_initialise(int cores, int iterations, int core) {
+  if (algorithm_remote())
+    loki_channel_invalidate_data(1, &algorithm_job, sizeof(algorithm_job));
+}
 
-    // If there is a subsequent core in the pipeline, tell it that it may now
-    // begin work on the next iteration.
-    if (have_successor)
-      loki_send_token(8);
-  }
+static void algorithm_table_count(int block, int core) {
+  const bool multi_tile = algorithm_multi_tile();
+  const bool sort = (algorithm_job.phase == ALGORITHM_SORT_COUNT);
+  const int32_t* const src = algorithm_job.src;
+  uint32_t* const table = algorithm_job.tables + core * algorithm_job.table_words;
+  const uint bins = algorithm_job.bins;
+  const int shift = algorithm_job.shift;
+  size_t start, end, i;
+  uint bin;
 
-  // Final core tells core 0 when all work has finished.
-  if (!have_successor)
-    loki_send_token(8);
+  algorithm_block(algorithm_job.n, algorithm_job.cores, block, &start, &end);
 
-  // Core 0 only returns when it receives the signal from the final core.
-  if (!have_predecessor)
-    loki_receive_token(3);
+  // A sort's input was written by every tile in the previous pass.
+  if (multi_tile && (sort || algorithm_remote()))
+    loki_channel_invalidate_data(1, src + start, (end - start) * sizeof(int32_t));
 
-  channel_map_restore(8, c8);
+  for (bin = 0; bin < bins; bin++)
+    table[bin] = 0;
 
-  // Release any resources when the pipeline has finished.
-  // TODO: can cores other than 0 ever reach this code?
-  if (config->tidy && config->tidy[stage])
-    config->tidy[stage]();
+  if (sort) {
+    for (i = start; i < end; i++)
+      table[algorithm_digit(src[i], shift)]++;
+  }
+  else {
+    for (i = start; i < end; i++)
+      if ((uint32_t)src[i] < bins)
+        table[src[i]]++;
+  }
 
+  if (multi_tile)
+    loki_channel_flush_data(1, table, bins * sizeof(uint32_t));
 }
 
-void pipeline_loop(const pipeline_config* config) {
+static void algorithm_histogram_merge(int block, int core) {
+  const bool multi_tile = algorithm_multi_tile();
+  uint32_t* const counts = algorithm_job.counts;
+  size_t start, end, bin;
+  uint c;
 
-  // Tell all cores to start executing the loop.
-  const int bitmask = all_cores_except_0(config->cores);
-  const channel_t ipk_fifo = loki_mcast_address(bitmask, 0, false);
-  const channel_t data_input = loki_mcast_address(bitmask, 3, false);
-  set_channel_map(2, ipk_fifo);
-  set_channel_map(3, data_input);
+  algorithm_block(algorithm_job.bins, algorithm_job.cores, block, &start, &end);
+  if (start == end)
+    return;
 
-  loki_send(3, (int)config);
+  for (bin = start; bin < end; bin++)
+    counts[bin] = 0;
 
-  asm (
+  for (c = 0; c < algorithm_job.cores; c++) {
+    const uint32_t* table = algorithm_job.tables + c * algorithm_job.table_words;
+    if (multi_tile)
+      loki_channel_invalidate_data(1, table + start,
+                                   (end - start) * sizeof(uint32_t));
+    for (bin = start; bin < end; bin++)
+      counts[bin] += table[bin];
+  }
+
+  if (multi_tile)
+    loki_channel_flush_data(1, counts + start, (end - start) * sizeof(uint32_t));
+}
+
+// Replace each core's count of a digit with the number of elements with that
+// digit in earlier cores' blocks, and record each digit's total.
+static void algorithm_sort_offsets(int block, int core) {
+  const bool multi_tile = algorithm_multi_tile();
+  uint32_t totals[ALGORITHM_RADIX];
+  size_t start, end, digit;
+  uint c;
+
+  algorithm_block(ALGORITHM_RADIX, algorithm_job.cores, block, &start, &end);
+  if (start == end)
+    return;
+
+  for (digit = start; digit < end; digit++)
+    totals[digit] = 0;
+
+  for (c = 0; c < algorithm_job.cores; c++) {
+    uint32_t* table = algorithm_job.tables + c * algorithm_job.table_words;
+    if (multi_tile)
+      loki_channel_invalidate_data(1, table + start,
+                                   (end - start) * sizeof(uint32_t));
+
+    for (digit = start; digit < end; digit++) {
+      const uint32_t count = table[digit];
+      table[digit] = totals[digit];
+      totals[digit] += count;
+    }
+
+    if (multi_tile)
+      loki_channel_flush_data(1, table + start, (end - start) * sizeof(uint32_t));
+  }
+
+  for (digit = start; digit < end; digit++)
+    algorithm_digits[digit] = totals[digit];
+
+  if (multi_tile)
+    loki_channel_flush_data(1, algorithm_digits + start,
+                            (end - start) * sizeof(uint32_t));
+}
+
+static void algorithm_sort_scatter(int block, int core) {
+  const bool multi_tile = algorithm_multi_tile();
+  const int32_t* const src = algorithm_job.src;
+  int32_t* const dst = algorithm_job.dst;
+  const int shift = algorithm_job.shift;
+  const uint32_t* table = algorithm_job.tables + core * algorithm_job.table_words;
+  uint32_t positions[ALGORITHM_RADIX];
+  size_t start, end, i;
+  uint digit;
+
+  algorithm_block(algorithm_job.n, algorithm_job.cores, block, &start, &end);
+
+  if (multi_tile) {
+    if (algorithm_remote())
+      loki_channel_invalidate_data(1, algorithm_digits, sizeof(algorithm_digits));
+    loki_channel_invalidate_data(1, table, ALGORITHM_RADIX * sizeof(uint32_t));
+  }
+
+  // Copied, so this core's table is never left modified in the cache.
+  for (digit = 0; digit < ALGORITHM_RADIX; digit++)
+    positions[digit] = algorithm_digits[digit] + table[digit];
+
+  if (!multi_tile) {
+    for (i = start; i < end; i++)
+      dst[positions[algorithm_digit(src[i], shift)]++] = src[i];
+    return;
+  }
+
+  // Every tile writes all over the destination, so its lines can't be cached.
+  // Remember the last word stored through each bank.
+  const uint banks = 1 << loki_channel_memory_get_group_size(get_channel_map(1));
+  int32_t* last[CORES_PER_TILE] = {NULL};
+  set_channel_map(2, uncached_memory_channel());
+  for (i = start; i < end; i++) {
+    int32_t* const target = &dst[positions[algorithm_digit(src[i], shift)]++];
+    loki_channel_store_word(2, target, src[i]);
+    last[((uint)target >> 5) & (banks - 1)] = target;
+  }
+
+  // Wait for the stores to reach memory before reporting that this core has
+  // finished. Requests through each bank are handled in order, so reading back
+  // the last word stored through a bank means all of its stores have arrived.
+  uint bank, pending = 0;
+  for (bank = 0; bank < banks; bank++) {
+    if (last[bank] != NULL) {
+      loki_channel_load_word(2, last[bank]);
+      pending++;
+    }
+  }
+  for ( ; pending > 0; pending--)
+    loki_receive(2);
+}
+
+static void algorithm_iteration(int block, int core) {
+  const bool multi_tile = algorithm_multi_tile();
+  const int32_t* const src = algorithm_job.src;
+  int32_t* const dst = algorithm_job.dst;
+  size_t start, end, i;
+  int32_t value;
+
+  switch (algorithm_job.phase) {
+  case ALGORITHM_REDUCE:
+  case ALGORITHM_SCAN_SUM:
+    algorithm_block(algorithm_job.n, algorithm_job.cores, block, &start, &end);
+    if (multi_tile && algorithm_remote())
+      loki_channel_invalidate_data(1, src + start, (end - start) * sizeof(int32_t));
+
+    if (algorithm_job.phase == ALGORITHM_REDUCE) {
+      const combine_func combine = algorithm_job.combine;
+      value = algorithm_job.identity;
+      for (i = start; i < end; i++)
+        value = combine(value, src[i]);
+    }
+    else {
+      value = 0;
+      for (i = start; i < end; i++)
+        value += src[i];
+    }
+
+    algorithm_cores[core].value = value;
+    if (multi_tile)
+      loki_channel_flush_data(1, &algorithm_cores[core], sizeof(algorithm_cores[core]));
+    break;
+
+  case ALGORITHM_SCAN:
+    // The block is still cached from ALGORITHM_SCAN_SUM.
+    algorithm_block(algorithm_job.n, algorithm_job.cores, block, &start, &end);
+    if (multi_tile && algorithm_remote())
+      loki_channel_invalidate_data(1, &algorithm_cores[core], sizeof(algorithm_cores[core]));
+
+    value = algorithm_cores[core].offset;
+    for (i = start; i < end; i++) {
+      value += src[i];
+      dst[i] = value;
+    }
+
+    if (multi_tile)
+      loki_channel_flush_data(1, dst + start, (end - start) * sizeof(int32_t));
+    break;
+
+  case ALGORITHM_HISTOGRAM_COUNT:
+  case ALGORITHM_SORT_COUNT:
+    algorithm_table_count(block, core);
+    break;
+
+  case ALGORITHM_HISTOGRAM_MERGE:
+    algorithm_histogram_merge(block, core);
+    break;
+
+  case ALGORITHM_SORT_OFFSETS:
+    algorithm_sort_offsets(block, core);
+    break;
+
+  case ALGORITHM_SORT_SCATTER:
+    algorithm_sort_scatter(block, core);
+    break;
+
+  default:
+    assert(0);
+  }
+}
+
+static int algorithm_partial(int core) {
+  return algorithm_cores[core].value;
+}
+
+// Run one phase on every core, combining the cores' results with `reduce`.
+static int32_t algorithm_run(enum algorithm_phase phase,
+                             enum loop_reduce_op reduce) {
+  int32_t result = 0;
+
+  algorithm_job.phase = phase;
+  if (algorithm_multi_tile())
+    loki_channel_flush_data(1, &algorithm_job, sizeof(algorithm_job));
+
+  loop_config config = {
+    .cores      = algorithm_job.cores,
+    .iterations = algorithm_job.cores,
+    .initialise = &algorithm_initialise,
+    .iteration  = &algorithm_iteration,
+    .schedule   = LOOP_SCHEDULE_BLOCKED,
+    .reduction  = {
+      .op      = reduce,
+      .type    = LOOP_REDUCE_INT,
+      .partial = &algorithm_partial,
+      .combine = algorithm_job.combine,
+      .result  = &result
+    }
+  };
+  simd_loop(&config);
+
+  return result;
+}
+
+// Describe a new job, and make its arrays visible to other tiles. Nothing
+// other tiles write may be cached here dirty, or it would later be written
+// back over their results.
+static void algorithm_start(uint cores, const int32_t* src, size_t n,
+                            int32_t* dst, size_t dst_words) {
+  algorithm_job.cores = cores;
+  algorithm_job.src = src;
+  algorithm_job.n = n;
+  algorithm_job.dst = dst;
+  algorithm_job.combine = NULL;
+  algorithm_job.identity = 0;
+  algorithm_job.tables = NULL;
+  algorithm_job.table_words = 0;
+  algorithm_job.bins = 0;
+  algorithm_job.counts = NULL;
+  algorithm_job.shift = 0;
+
+  if (algorithm_multi_tile()) {
+    assert(dst == NULL || ((uint)dst & 0x1f) == 0);
+    loki_channel_flush_data(1, src, n * sizeof(int32_t));
+    if (dst != NULL)
+      loki_channel_flush_data(1, dst, dst_words * sizeof(int32_t));
+  }
+}
+
+// Allocate one table of `words` words per core, each on its own lines.
+static void algorithm_tables(uint words) {
+  const uint table_words = (words + ALGORITHM_LINE_WORDS - 1)
+                         & ~(ALGORITHM_LINE_WORDS - 1);
+  const size_t size = algorithm_job.cores * table_words * sizeof(uint32_t);
+
+  algorithm_job.tables = loki_malloc(size);
+  assert(algorithm_job.tables != NULL);
+  algorithm_job.table_words = table_words;
+  algorithm_job.bins = words;
+
+  if (algorithm_multi_tile()) {
+    loki_channel_flush_data(1, algorithm_job.tables, size);
+    loki_channel_invalidate_data(1, algorithm_job.tables, size);
+  }
+}
+
+int32_t loki_parallel_reduce(uint cores, const int32_t* a, size_t n,
+                             enum loop_reduce_op op, combine_func combine,
+                             int32_t identity) {
+  switch (op) {
+  case LOOP_REDUCE_SUM: return loki_vec_sum_int32_parallel(cores, a, n);
+  case LOOP_REDUCE_MIN: return loki_vec_min_int32_parallel(cores, a, n);
+  case LOOP_REDUCE_MAX: return loki_vec_max_int32_parallel(cores, a, n);
+  case LOOP_REDUCE_CUSTOM: break;
+  default: assert(0);
+  }
+
+  if (n == 0)
+    return identity;
+
+  algorithm_start(cores, a, n, NULL, 0);
+  algorithm_job.combine = combine;
+  algorithm_job.identity = identity;
+  return algorithm_run(ALGORITHM_REDUCE, LOOP_REDUCE_CUSTOM);
+}
+
+int32_t loki_parallel_scan(uint cores, int32_t* dst, const int32_t* a,
+                           size_t n) {
+  int32_t offset = 0;
+  uint core;
+
+  if (n == 0)
+    return 0;
+
+  algorithm_start(cores, a, n, dst, n);
+  const int32_t sum = algorithm_run(ALGORITHM_SCAN_SUM, LOOP_REDUCE_SUM);
+
+  if (algorithm_multi_tile())
+    loki_channel_invalidate_data(1, algorithm_cores,
+                                 cores * sizeof(algorithm_cores[0]));
+  for (core = 0; core < cores; core++) {
+    algorithm_cores[core].offset = offset;
+    offset += algorithm_cores[core].value;
+  }
+  if (algorithm_multi_tile())
+    loki_channel_flush_data(1, algorithm_cores,
+                            cores * sizeof(algorithm_cores[0]));
+
+  algorithm_run(ALGORITHM_SCAN, LOOP_REDUCE_NONE);
+
+  // Every core has flushed its block, so refetch the other tiles' results.
+  if (algorithm_multi_tile())
+    loki_channel_invalidate_data(1, dst, n * sizeof(int32_t));
+
+  return sum;
+}
+
+void loki_parallel_histogram(uint cores, uint32_t* counts, uint bins,
+                             const int32_t* a, size_t n) {
+  if (bins == 0)
+    return;
+
+  algorithm_start(cores, a, n, (int32_t*)counts, bins);
+  algorithm_tables(bins);
+  algorithm_job.counts = counts;
+
+  algorithm_run(ALGORITHM_HISTOGRAM_COUNT, LOOP_REDUCE_NONE);
+  algorithm_run(ALGORITHM_HISTOGRAM_MERGE, LOOP_REDUCE_NONE);
+
+  if (algorithm_multi_tile())
+    loki_channel_invalidate_data(1, counts, bins * sizeof(uint32_t));
+
+  loki_free(algorithm_job.tables);
+}
+
+void loki_parallel_sort(uint cores, int32_t* data, int32_t* scratch, size_t n) {
+  int32_t* arrays[2] = {data, scratch};
+  int pass;
+  uint digit;
+
+  if (n < 2)
+    return;
+
+  algorithm_start(cores, data, n, data, n);
+  algorithm_tables(ALGORITHM_RADIX);
+
+  // The passes write both arrays with uncached stores, so no line of them may
+  // be left in this tile's cache.
+  if (algorithm_multi_tile()) {
+    assert(((uint)scratch & 0x1f) == 0);
+    loki_channel_flush_data(1, scratch, n * sizeof(int32_t));
+    loki_channel_invalidate_data(1, scratch, n * sizeof(int32_t));
+    loki_channel_invalidate_data(1, data, n * sizeof(int32_t));
+  }
+
+  // An even number of passes leaves the result in `data`.
+  for (pass = 0; pass < 32 / ALGORITHM_RADIX_BITS; pass++) {
+    algorithm_job.src = arrays[pass & 1];
+    algorithm_job.dst = arrays[(pass + 1) & 1];
+    algorithm_job.shift = pass * ALGORITHM_RADIX_BITS;
+
+    algorithm_run(ALGORITHM_SORT_COUNT, LOOP_REDUCE_NONE);
+    algorithm_run(ALGORITHM_SORT_OFFSETS, LOOP_REDUCE_NONE);
+
+    // Turn each digit's total into the position of its first element.
+    if (algorithm_multi_tile())
+      loki_channel_invalidate_data(1, algorithm_digits, sizeof(algorithm_digits));
+    uint32_t position = 0;
+    for (digit = 0; digit < ALGORITHM_RADIX; digit++) {
+      const uint32_t count = algorithm_digits[digit];
+      algorithm_digits[digit] = position;
+      position += count;
+    }
+    if (algorithm_multi_tile())
+      loki_channel_flush_data(1, algorithm_digits, sizeof(algorithm_digits));
+
+    algorithm_run(ALGORITHM_SORT_SCATTER, LOOP_REDUCE_NONE);
+  }
+
+  if (algorithm_multi_tile())
+    loki_channel_invalidate_data(1, data, n * sizeof(int32_t));
+
+  loki_free(algorithm_job.tables);
+}
+
+
+//============================================================================//
+// Worker farm
+//
+//   Core 0 of each tile acts as a sub-master and distributes work across the
+//   other cores of its tile. The work is issued in the form of a loop iteration
+//   index. Sub-masters claim blocks of iterations from a counter shared by the
+//   whole farm, so load is balanced both within and between tiles.
+//============================================================================//
+
+// Counters shared by all tiles of the worker farm: the next unclaimed
+// iteration, and the total number of cycles workers have spent waiting for
+// iterations. Both are offset by base values read at the start of each farm.
+// They are only ever accessed through uncached_memory_channel, so load-and-add is
+// atomic across all tiles. The counters fill a whole cache line so that no
+// cached data can be written back over them.
+static struct {
+  uint next;
+  uint wait_cycles;
+  uint padding[6];
+} farm_counter __attribute__((aligned(32)));
+
+// Average cycles each iteration of the most recent worker farm spent waiting to
+// be dispatched.
+static uint farm_dispatch_cycles;
+
+// The loop executed by each worker. Executes the provided function for as long
+// as the sub-master allows the worker to live (-1 will be sent as the iteration
+// when all iterations have completed).
+//
+// The sub-master grants each worker its first iteration unprompted, and the
+// worker requests its next iteration as soon as it starts the current one, so
+// the next grant arrives while the current iteration executes. Each request
+// also reports how long the worker waited for the iteration it just received.
+void worker_thread(const loop_config* config, const int worker) {
+
+  // Create a connection back to the sub-master core. All workers share one
+  // input, and identify themselves in each request.
+  int address = loki_mcast_address(single_core_bitmask(0), CH_REGISTER_3, false);
+  channel_map_reserve(8);
+  set_channel_map(8, address);
+
+  // Loop forever, executing the iterations provided. The master will kill the
+  // worker by sending -1 as the iteration. That answers a request made before
+  // the worker's last iteration, so the worker then reports that it really
+  // has finished, with its negated core ID.
+  while (1) {
+    // Receive the iteration to execute next.
+    const unsigned long start = get_cycle_count();
+    int iteration;
+    iteration = loki_receive(3);
+    const uint waited = get_cycle_count() - start;
+    LOKI_TRACE_EVENT(LOKI_TRACE_GRANT_RECEIVED, iteration);
+
+    if (iteration == -1) break; // end of work signal
+
+    // Request another iteration.
+    loki_send(8, waited * CORES_PER_TILE + get_core_id());
+
+    // Execute the loop iteration.
+    config->iteration(iteration, worker);
+  }
+  loki_send(8, -(int)get_core_id());
+  channel_map_free(8);
+}
+
+// Iterations claimed by a sub-master but not yet issued: [next, end).
+struct farm_block {
+  uint next;
+  uint end;
+  bool exhausted;
+};
+
+// Return the next iteration for this tile to execute, or -1 if there are none
+// left. Claims another block of iterations from the farm's counter when the
+// current one is used up. Entry 2 must hold uncached_memory_channel.
+static inline int farm_next_iteration(struct farm_block* claimed,
+                                      const uint block,
+                                      const uint iterations,
+                                      const uint base) {
+  if (claimed->next == claimed->end && !claimed->exhausted) {
+    loki_channel_load_and_add(2, &farm_counter.next, block);
+    claimed->next = loki_receive(2) - base;
+
+    if (claimed->next < iterations)
+      claimed->end = (claimed->next + block < iterations) ? claimed->next + block
+                                                          : iterations;
+    else {
+      claimed->exhausted = true;
+      claimed->end = claimed->next;
+    }
+  }
+
+  return (claimed->next < claimed->end) ? (int)claimed->next++ : -1;
+}
+
+// Start the workers on this tile, then issue them with iterations until the
+// farm's counter runs out. Each time the current block of iterations is used
+// up, another is claimed from the counter. Must be executed by core 0.
+static void farm_sub_master(const loop_config* config,
+                            const tile_id_t first_tile,
+                            const uint base) {
+  const tile_id_t tile = get_tile_id();
+  const uint relative_tile = tile2int(tile) - tile2int(first_tile);
+
+  // The first tile flushed the configuration before starting this one, but
+  // this tile may still hold an old copy of it. The workers share this tile's
+  // cache, so they see the fresh copy too.
+  if (relative_tile > 0)
+    loki_channel_invalidate_data(1, config, sizeof(loop_config));
+
+  const uint cores = cores_this_tile(config->cores, tile, first_tile);
+  const uint iterations = config->iterations;
+  const uint block = (config->chunk_size > 0) ? config->chunk_size
+                                              : 4 * (cores - 1);
+
+  if (cores > 1) {
+    // Make multicast connections to all workers.
+    unsigned int bitmask = all_cores_except_0(cores);
+    const channel_t ipk_fifos = loki_mcast_address(bitmask, 0, false);
+    const channel_t data_inputs = loki_mcast_address(bitmask, 3, false);
+    set_channel_map(2, ipk_fifos);
+    set_channel_map(3, data_inputs);
+
+    // Send pointer to configuration info, and the offset which turns a core's
+    // position into its worker ID. Core 0 of each tile is not a worker.
+    loki_send(3, (int)config);
+    loki_send(3, relative_tile * (CORES_PER_TILE - 1) - 1);
+
+    asm (
+      "fetchr 0f\n"
+      "rmtexecute -> 2\n"             // begin remote execution
+      "addu r13, r3, r0\n"            // receive pointer to configuration info
+      "cregrdi r11, 1\n"              // get core id, and put into r11
+      "andi r11, r11, 0x7\n"          // get core id, and put into r11
+      "addu r14, r11, r3\n"           // worker ID = core ID + tile's offset
+      "lli r10, %lo(loki_sleep)\n"    // set return address - sleep when finished
+      "lui r10, %hi(loki_sleep)\n"
+      "lli r24, %lo(worker_thread)\n"
+      "lui r24, %hi(worker_thread)\n"
+      "fetch.eop r24\n"               // fetch the worker's task
+      "0:\n"
+    );
+  }
+
+  set_channel_map(2, uncached_memory_channel());
+
+  // Keep a connection to every worker, so each grant is a single send: core n
+  // is reached through entry 7+n.
+  uint core;
+  for (core = 1; core < cores; core++) {
+    const channel_t worker_addr = loki_mcast_address(single_core_bitmask(core), 3, false);
+    channel_map_reserve(7 + core);
+    set_channel_map(7 + core, worker_addr);
+  }
+
+  struct farm_block claimed = {.next = 0, .end = 0, .exhausted = false};
+  uint active = cores - 1;    // Workers not yet sent -1.
+  uint running = cores - 1;   // Workers which have not reported finishing.
+  uint wait_cycles = 0;
+
+  LOKI_PROF_BEGIN(LOKI_PROF_DISPATCH);
+
+  // Give every worker its first iteration.
+  for (core = 1; core < cores; core++) {
+    const int iteration = farm_next_iteration(&claimed, block, iterations, base);
+    loki_send(7 + core, iteration);
+    LOKI_TRACE_EVENT(LOKI_TRACE_GRANT_SENT, iteration);
+    if (iteration == -1)
+      active--;
+  }
+
+  // Each request is answered with the worker's next iteration, or -1 to end.
+  // Workers may report finishing while others still ask for work.
+  while (active > 0) {
+    const int request = loki_receive(3); // wait for any worker to request work
+    if (request <= 0) {
+      running--;
+      continue;
+    }
+
+    const uint worker = request % CORES_PER_TILE;
+    wait_cycles += request / CORES_PER_TILE;
+
+    const int iteration = farm_next_iteration(&claimed, block, iterations, base);
+    loki_send(7 + worker, iteration);
+    LOKI_TRACE_EVENT(LOKI_TRACE_GRANT_SENT, iteration);
+    if (iteration == -1)
+      active--;
+  }
+
+  // Wait for every worker to finish the iteration it was running when it was
+  // sent -1. Nothing but these reports can arrive now.
+  for ( ; running > 0; running--)
+    loki_receive(3);
+
+  LOKI_PROF_END(LOKI_PROF_DISPATCH);
+
+  for (core = 1; core < cores; core++)
+    channel_map_free(7 + core);
+
+  loki_channel_load_and_add(2, &farm_counter.wait_cycles, wait_cycles);
+  loki_receive(2);
+
+  // Wait for all other tiles' workers to finish.
+  const uint tiles = num_tiles(config->cores);
+  if (tiles > 1) {
+    LOKI_PROF_BEGIN(LOKI_PROF_BARRIER);
+    LOKI_TRACE_EVENT(LOKI_TRACE_BARRIER_ENTER, tiles);
+    sync_tiles_ex(tiles, tile2int(first_tile));
+    LOKI_TRACE_EVENT(LOKI_TRACE_BARRIER_EXIT, tiles);
+    LOKI_PROF_END(LOKI_PROF_BARRIER);
+  }
+}
+
+// Start a sub-master on another tile.
+static void farm_remote_tile(const tile_id_t tile, const loop_config* config,
+                             const tile_id_t first_tile, const uint base) {
+
+  // Connect to core 0 in the tile.
+  channel_t inst_fifo = loki_core_address(tile, 0, 0, INFINITE_CREDIT_COUNT);
+  channel_t data_input = loki_core_address(tile, 0, 3, INFINITE_CREDIT_COUNT);
+  set_channel_map(2, inst_fifo);
+  set_channel_map(3, data_input);
+
+  loki_send(3, (int)config);                 // send arguments
+  loki_send(3, (int)first_tile);
+  loki_send(3, (int)base);
+  loki_send(3, (int)&loki_sleep);            // send function pointers
+  loki_send(3, (int)&farm_sub_master);
+
+  asm volatile (
+    "fetchr 0f\n"
+    "rmtexecute -> 2\n"         // begin remote execution
+    "addu r13, r3, r0\n"        // receive pointer to configuration info
+    "addu r14, r3, r0\n"        // receive first tile
+    "addu r15, r3, r0\n"        // receive counter base
+    "addu r10, r3, r0\n"        // set return address
+    "fetch.eop r3\n"            // fetch function to execute
+    "0:\n"
+    // No clobbers because this is all executed remotely.
+  );
+
+}
+
+// Distribute all loop iterations across the workers, and wait for them all to
+// complete.
+void worker_farm(const loop_config* config) {
+  assert(config->cores > 1);
+  assert(config->cores <= CORES_PER_TILE * COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS);
+
+  const tile_id_t first_tile = get_tile_id();
+  const uint tiles = num_tiles(config->cores);
+
+  // Rather than resetting the shared counter, which would race with any
+  // sub-master which has already started, record where this farm begins.
+  set_channel_map(2, uncached_memory_channel());
+  loki_channel_load_and_add(2, &farm_counter.next, 0);
+  const uint base = loki_receive(2);
+  loki_channel_load_and_add(2, &farm_counter.wait_cycles, 0);
+  const uint wait_base = loki_receive(2);
+
+  // Other tiles' sub-masters and workers read the configuration from main
+  // memory.
+  if (tiles > 1)
+    loki_channel_flush_data(1, config, sizeof(loop_config));
+
+  uint tile;
+  for (tile = 1; tile < tiles; tile++)
+    farm_remote_tile(int2tile(tile2int(first_tile) + tile), config, first_tile,
+                     base);
+
+  farm_sub_master(config, first_tile, base);
+
+  // All sub-masters have added their workers' waiting time by now.
+  set_channel_map(2, uncached_memory_channel());
+  loki_channel_load_and_add(2, &farm_counter.wait_cycles, 0);
+  const uint waited = loki_receive(2) - wait_base;
+  farm_dispatch_cycles = (config->iterations > 0) ? waited / config->iterations
+                                                  : 0;
+
+  // Combine each worker's partial result before returning.
+  if (config->reduce != NULL) {
+    LOKI_PROF_BEGIN(LOKI_PROF_REDUCE);
+    config->reduce(config->cores - tiles);
+    LOKI_PROF_END(LOKI_PROF_REDUCE);
+  }
+
+}
+
+uint worker_farm_dispatch_cycles(void) {
+  return farm_dispatch_cycles;
+}
+
+
+//============================================================================//
+// Work stealing
+//
+//   Each core owns a deque of tasks in its tile's memory, which only cores on
+//   the same tile can access (memory is coherent there). Each tile also has a
+//   single-task mailbox accessed only through an uncached channel, through
+//   which busy cores offer work to other tiles. Task records, which hold
+//   results, are also only accessed uncached, so tasks may complete on any
+//   tile.
+//
+//   While the scheduler runs, every core keeps an uncached memory channel in
+//   entry 8.
+//============================================================================//
+
+#define TASK_DEPTH 16              // Maximum unsynchronised spawns per core
+#define TASK_EXPORT_INTERVAL 8     // Spawns between offers to other tiles
+#define TASK_CHANNEL 8             // Channel map entry with uncached access
+
+#define TASK_MAILBOX_EMPTY 0
+#define TASK_MAILBOX_BUSY 1
+#define TASK_MAILBOX_FULL 2
+
+// A task waiting to be executed. Fills one cache line.
+struct task_slot {
+  loki_task_func func;
+  loki_task      record;           // (owner's task_core_index << 8) | depth
+  int            args[LOKI_TASK_ARGS];
+  int            padding[2];
+};
+
+// One core's deque. Thieves take the oldest task from `top`; the owner pushes
+// and pops at `bottom`. All index updates happen while holding `lock`.
+struct task_deque {
+  volatile int  lock;
+  volatile uint top;
+  volatile uint bottom;
+  uint          depth;             // Owner only: outstanding spawns
+  uint          spawns;            // Owner only
+  uint          tile_cores;        // Owner only: cores on this tile
+  uint          tiles;             // Owner only: tiles in the scheduler
+  uint          first_tile;        // Owner only: first tile, as an integer
+  struct task_slot slots[TASK_DEPTH];
+} __attribute__((aligned(32)));
+
+// Result of a spawned task. Both words share a line so `value` is always
+// written before `done`.
+struct task_record {
+  int done;
+  int value;
+};
+
+// A task offered to other tiles.
+struct task_mailbox {
+  int              state;
+  int              padding[7];
+  struct task_slot slot;
+} __attribute__((aligned(32)));
+
+#define TASK_MAX_CORES (CORES_PER_TILE * COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS)
+
+static struct task_deque task_deques[TASK_MAX_CORES];
+static struct task_record task_records[TASK_MAX_CORES][TASK_DEPTH]
+    __attribute__((aligned(32)));
+static struct task_mailbox task_mailboxes[COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS];
+
+// Set when the root task completes. Only accessed uncached.
+static struct {
+  int finished;
+  int padding[7];
+} task_state __attribute__((aligned(32)));
+
+// Information passed to every core when the scheduler starts.
+struct task_start {
+  loki_task_func root;
+  int            args[LOKI_TASK_ARGS];
+  uint           cores;
+  tile_id_t      first_tile;
+  int            result;
+};
+
+// Unique index of this core, used to find its deque and records.
+static inline uint task_core_index(void) {
+  return tile2int(get_tile_id()) * CORES_PER_TILE + get_core_id();
+}
+
+static inline int task_uncached_load(void const *address) {
+  loki_channel_load_word(TASK_CHANNEL, address);
+  return loki_receive(2);
+}
+
+static inline void task_uncached_store(void *address, int value) {
+  loki_channel_store_word(TASK_CHANNEL, address, value);
+}
+
+// Attempt to change a word from `expected` to `value` using load-linked and
+// store-conditional. The memory returns non-zero if the store succeeded.
+static inline bool task_compare_and_set(const int channel, volatile int *word,
+                                        int expected, int value) {
+  loki_channel_load_linked(channel, (void*)word);
+  if (loki_receive(2) != expected)
+    return false;
+
+  loki_channel_store_conditional(channel, (void*)word, value);
+  return loki_receive(2) != 0;
+}
+
+static inline void task_lock(struct task_deque *deque) {
+  while (!task_compare_and_set(1, &deque->lock, 0, 1))
+    ;
+}
+
+static inline void task_unlock(struct task_deque *deque) {
+  barrier();
+  deque->lock = 0;
+}
+
+// Remove the newest task from this core's deque.
+static bool task_pop(struct task_deque *deque, struct task_slot *slot) {
+  bool found = false;
+  task_lock(deque);
+  if (deque->bottom != deque->top) {
+    deque->bottom--;
+    *slot = deque->slots[deque->bottom % TASK_DEPTH];
+    found = true;
+  }
+  task_unlock(deque);
+  return found;
+}
+
+// Remove the oldest task from a deque on this tile.
+static bool task_steal_local(struct task_deque *deque, struct task_slot *slot) {
+  // Avoid taking the lock of an empty deque.
+  if (deque->bottom == deque->top)
+    return false;
+
+  bool found = false;
+  task_lock(deque);
+  if (deque->bottom != deque->top) {
+    *slot = deque->slots[deque->top % TASK_DEPTH];
+    deque->top++;
+    found = true;
+  }
+  task_unlock(deque);
+  return found;
+}
+
+static inline void task_slot_copy_uncached(struct task_slot *to,
+                                           struct task_slot *from,
+                                           bool to_uncached) {
+  int *dst = (int*)to;
+  int *src = (int*)from;
+  uint i;
+  for (i = 0; i < sizeof(struct task_slot) / sizeof(int); i++) {
+    if (to_uncached)
+      task_uncached_store(&dst[i], src[i]);
+    else
+      dst[i] = task_uncached_load(&src[i]);
+  }
+}
+
+// Take the task offered by a tile's mailbox, if there is one.
+static bool task_steal_remote(struct task_mailbox *mailbox,
+                              struct task_slot *slot) {
+  if (task_uncached_load(&mailbox->state) != TASK_MAILBOX_FULL)
+    return false;
+  if (!task_compare_and_set(TASK_CHANNEL, &mailbox->state, TASK_MAILBOX_FULL,
+                            TASK_MAILBOX_BUSY))
+    return false;
+
+  task_slot_copy_uncached(slot, &mailbox->slot, false);
+  task_uncached_store(&mailbox->state, TASK_MAILBOX_EMPTY);
+  return true;
+}
+
+// Offer this core's oldest task to other tiles, if the tile's mailbox is empty
+// and the core has work to spare.
+static void task_export(struct task_deque *deque) {
+  struct task_mailbox *mailbox = &task_mailboxes[tile2int(get_tile_id())];
+
+  if (task_uncached_load(&mailbox->state) != TASK_MAILBOX_EMPTY)
+    return;
+  if (!task_compare_and_set(TASK_CHANNEL, &mailbox->state, TASK_MAILBOX_EMPTY,
+                            TASK_MAILBOX_BUSY))
+    return;
+
+  struct task_slot slot;
+  bool found = false;
+  task_lock(deque);
+  if (deque->bottom - deque->top >= 2) {
+    slot = deque->slots[deque->top % TASK_DEPTH];
+    deque->top++;
+    found = true;
+  }
+  task_unlock(deque);
+
+  if (found) {
+    task_slot_copy_uncached(&mailbox->slot, &slot, true);
+    task_uncached_store(&mailbox->state, TASK_MAILBOX_FULL);
+  }
+  else
+    task_uncached_store(&mailbox->state, TASK_MAILBOX_EMPTY);
+}
+
+static inline void task_execute(const struct task_slot *slot) {
+  int result = slot->func(slot->args);
+
+  struct task_record *record =
+      &task_records[slot->record >> 8][slot->record & 0xFF];
+  task_uncached_store(&record->value, result);
+  task_uncached_store(&record->done, 1);
+}
+
+// Find a task to execute, trying other cores on this tile first, then each
+// tile's mailbox. Returns whether a task was executed.
+static bool task_find_work(void) {
+  const uint index = task_core_index();
+  struct task_deque *own = &task_deques[index];
+  const uint first_core = index - get_core_id();
+  struct task_slot slot;
+  uint i;
+
+  for (i = 1; i < own->tile_cores; i++) {
+    uint victim = first_core + (get_core_id() + i) % own->tile_cores;
+    if (task_steal_local(&task_deques[victim], &slot)) {
+      task_execute(&slot);
+      return true;
+    }
+  }
+
+  const uint tile = index / CORES_PER_TILE - own->first_tile;
+  for (i = 0; i < own->tiles; i++) {
+    uint victim = own->first_tile + (tile + i) % own->tiles;
+    if (task_steal_remote(&task_mailboxes[victim], &slot)) {
+      task_execute(&slot);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+loki_task loki_task_spawn(loki_task_func func, const int* args) {
+  const uint index = task_core_index();
+  struct task_deque *deque = &task_deques[index];
+  assert(deque->depth < TASK_DEPTH);
+
+  LOKI_PROF_BEGIN(LOKI_PROF_DISPATCH);
+
+  const loki_task task = (index << 8) | deque->depth;
+  task_uncached_store(&task_records[index][deque->depth].done, 0);
+  deque->depth++;
+
+  struct task_slot slot = {.func = func, .record = task};
+  memcpy(slot.args, args, sizeof(slot.args));
+
+  task_lock(deque);
+  deque->slots[deque->bottom % TASK_DEPTH] = slot;
+  deque->bottom++;
+  task_unlock(deque);
+
+  if (deque->tiles > 1 && ++deque->spawns % TASK_EXPORT_INTERVAL == 0)
+    task_export(deque);
+
+  LOKI_PROF_END(LOKI_PROF_DISPATCH);
+
+  return task;
+}
+
+int loki_task_sync(loki_task task) {
+  const uint index = task_core_index();
+  struct task_deque *deque = &task_deques[index];
+  struct task_slot slot;
+  int result;
+
+  // Tasks must be synchronised in the reverse order of spawning.
+  assert(task == ((index << 8) | (deque->depth - 1)));
+
+  // If the task has not been stolen, it is the newest in the deque.
+  if (task_pop(deque, &slot)) {
+    assert(slot.record == task);
+    result = slot.func(slot.args);
+  }
+  else {
+    // Help with other work while the thief finishes the task.
+    struct task_record *record = &task_records[index][task & 0xFF];
+    while (!task_uncached_load(&record->done))
+      task_find_work();
+    result = task_uncached_load(&record->value);
+  }
+
+  deque->depth--;
+  return result;
+}
+
+// Executed by every core in the scheduler.
+static void task_scheduler_member(const void *data) {
+  const struct task_start *start = data;
+  channel_map_reserve(TASK_CHANNEL);
+  set_channel_map(TASK_CHANNEL, uncached_memory_channel());
+
+  const tile_id_t tile = get_tile_id();
+
+  struct task_deque *deque = &task_deques[task_core_index()];
+  deque->lock = 0;
+  deque->top = deque->bottom = 0;
+  deque->depth = deque->spawns = 0;
+  deque->tile_cores = cores_this_tile(start->cores, tile, start->first_tile);
+  deque->tiles = num_tiles(start->cores);
+  deque->first_tile = tile2int(start->first_tile);
+
+  if (get_core_id() == 0)
+    task_uncached_store(&task_mailboxes[tile2int(tile)].state,
+                        TASK_MAILBOX_EMPTY);
+
+  loki_sync_ex(start->cores, start->first_tile);
+
+  if (tile == start->first_tile && get_core_id() == 0) {
+    ((struct task_start*)start)->result = start->root(start->args);
+    task_uncached_store(&task_state.finished, 1);
+  }
+  else {
+    while (!task_uncached_load(&task_state.finished))
+      task_find_work();
+  }
+
+  channel_map_free(TASK_CHANNEL);
+}
+
+int loki_tasks_run(const uint cores, loki_task_func root, const int* args) {
+  static bool flushed = false;
+  assert(cores <= TASK_MAX_CORES);
+
+  // The scheduler's uncached data must not be overwritten by stale cache
+  // lines left over from program loading.
+  if (!flushed) {
+    loki_channel_flush_data(1, task_deques, sizeof(task_deques));
+    loki_channel_flush_data(1, task_records, sizeof(task_records));
+    loki_channel_flush_data(1, task_mailboxes, sizeof(task_mailboxes));
+    loki_channel_flush_data(1, &task_state, sizeof(task_state));
+    flushed = true;
+  }
+
+  channel_map_reserve(TASK_CHANNEL);
+  set_channel_map(TASK_CHANNEL, uncached_memory_channel());
+  task_uncached_store(&task_state.finished, 0);
+  task_uncached_load(&task_state.finished);   // wait for the store to complete
+  channel_map_free(TASK_CHANNEL);
+
+  struct task_start start = {
+      .root = root
+    , .cores = cores
+    , .first_tile = get_tile_id()
+  };
+  memcpy(start.args, args, sizeof(start.args));
+
+  distributed_func config = {
+      .cores = cores
+    , .func = &task_scheduler_member
+    , .data = &start
+    , .data_size = sizeof(start)
+  };
+
+  loki_execution handle = loki_execute_async(&config);
+  loki_execute_join(&handle);
+
+  return start.result;
+}
+
+
+//============================================================================//
+// Task-level pipeline
+//
+//   Each core executes a different task, and tells the next core when it has
+//   finished each iteration.
+//============================================================================//
+
+void pipeline_stage(const pipeline_config* config, const int stage) {
+
+  const int have_predecessor = (stage > 0);
+  const int have_successor = (stage < config->cores - 1);
+
+  // Address to connect to. Most cores connect to the next stage in the pipeline
+  // so they can tell when it is safe to begin the next loop iteration. The
+  // final core, however, tells the first core when all work has finished.
+  int next_addr;
+  if (have_successor)
+    next_addr = loki_mcast_address(single_core_bitmask(stage+1), 3, false);
+  else
+    next_addr = loki_mcast_address(single_core_bitmask(0), 3, false);
+
+  // Make connection.
+  channel_map_reserve(8);
+  set_channel_map(8, next_addr);
+
+  // If there is work to do before the pipeline starts, do it now.
+  if (config->initialise && config->initialise[stage])
+    config->initialise[stage]();
+
+  // Execute loop
+  int i;
+  for (i=0; i<config->iterations; i++) {
+    // If there is a previous core in the pipeline, wait for it to tell us that
+    // we can begin work on the next iteration.
+    if (have_predecessor) {
+      loki_receive_token(3);
+      LOKI_TRACE_EVENT(LOKI_TRACE_TOKEN_RECEIVED, i);
+    }
+
+    // Execute this iteration.
+    config->stage_func[stage](i);
+
+    // If there is a subsequent core in the pipeline, tell it that it may now
+    // begin work on the next iteration.
+    if (have_successor) {
+      loki_send_token(8);
+      LOKI_TRACE_EVENT(LOKI_TRACE_TOKEN_SENT, i);
+    }
+  }
+
+  // Final core tells core 0 when all work has finished.
+  if (!have_successor)
+    loki_send_token(8);
+
+  // Core 0 only returns when it receives the signal from the final core.
+  if (!have_predecessor)
+    loki_receive_token(3);
+
+  channel_map_free(8);
+
+  // Release any resources when the pipeline has finished.
+  // TODO: can cores other than 0 ever reach this code?
+  if (config->tidy && config->tidy[stage])
+    config->tidy[stage]();
+
+}
+
+// Tile on which a given stage of a pipeline runs.
+static inline tile_id_t pipeline_stage_tile(const tile_id_t first_tile,
+                                            const int stage) {
+  return int2tile(tile2int(first_tile) + stage / CORES_PER_TILE);
+}
+
+// Executed by each stage of a pipeline connected with credit-based channels.
+//
+// Progress is passed in counts. A stage tells its successor how many more
+// iterations it has finished (on CH_REGISTER_3), and its predecessor how many
+// more it has finished (on CH_REGISTER_4). Counts to the successor are held
+// back while too many might be unread, so those sends never block. Counts to
+// the predecessor are sent every few iterations, and whenever this stage is
+// about to wait for its predecessor. Each stage only returns once its
+// successor has reported finishing every iteration, so stage 0 returning
+// means that the whole pipeline has finished.
+static void pipeline_credit_stage(const pipeline_config* config,
+                                  const tile_id_t first_tile,
+                                  const int stage) {
+  const bool have_predecessor = (stage > 0);
+  const bool have_successor = (stage < config->cores - 1);
+  const int iterations = config->iterations;
+  const int run_ahead = (config->max_run_ahead > 0) ? config->max_run_ahead
+                                                    : CORE_INPUT_BUFFER_DEPTH;
+  const int report_interval =
+      (run_ahead + CORE_INPUT_BUFFER_DEPTH - 1) / CORE_INPUT_BUFFER_DEPTH;
+
+  channel_map_reserve(8);
+  channel_map_reserve(9);
+  if (have_successor)
+    loki_connect_ex(8, pipeline_stage_tile(first_tile, stage + 1),
+                    (stage + 1) % CORES_PER_TILE, CH_REGISTER_3, false);
+  if (have_predecessor)
+    loki_connect_ex(9, pipeline_stage_tile(first_tile, stage - 1),
+                    (stage - 1) % CORES_PER_TILE, CH_REGISTER_4, false);
+
+  if (config->initialise && config->initialise[stage])
+    config->initialise[stage]();
+
+  int available = 0;    // Finished by the predecessor, not yet started here.
+  int unreported = 0;   // Finished here, not yet reported to the predecessor.
+  int completed = 0;    // Finished here.
+  int sent = 0;         // Reported to the successor.
+  int acknowledged = 0; // Reported finished by the successor.
+
+  int i;
+  for (i = 0; i < iterations; i++) {
+    if (have_predecessor) {
+      while (available == 0) {
+        if (unreported > 0) {
+          loki_send(9, unreported);
+          unreported = 0;
+        }
+        available += loki_receive(3);
+        LOKI_TRACE_EVENT(LOKI_TRACE_TOKEN_RECEIVED, i);
+      }
+      available--;
+    }
+
+    if (have_successor)
+      while (completed - acknowledged >= run_ahead)
+        acknowledged += loki_receive(4);
+
+    config->stage_func[stage](i);
+
+    if (have_predecessor && ++unreported >= report_interval) {
+      loki_send(9, unreported);
+      unreported = 0;
+    }
+
+    if (have_successor) {
+      completed++;
+      while (loki_test_channel(CH_REGISTER_4))
+        acknowledged += loki_receive(4);
+
+      // Each unread count covers at least one unacknowledged iteration.
+      if (sent - acknowledged < CORE_INPUT_BUFFER_DEPTH) {
+        loki_send(8, completed - sent);
+        sent = completed;
+        LOKI_TRACE_EVENT(LOKI_TRACE_TOKEN_SENT, i);
+      }
+    }
+  }
+
+  // Pass on any progress held back, and wait for the successor to finish.
+  if (have_successor) {
+    while (acknowledged < iterations) {
+      if (sent < completed && sent - acknowledged < CORE_INPUT_BUFFER_DEPTH) {
+        loki_send(8, completed - sent);
+        sent = completed;
+      }
+      else
+        acknowledged += loki_receive(4);
+    }
+    loki_disconnect(8);
+  }
+
+  if (have_predecessor) {
+    if (unreported > 0)
+      loki_send(9, unreported);
+    loki_disconnect(9);
+  }
+
+  channel_map_free(8);
+  channel_map_free(9);
+
+  if (config->tidy && config->tidy[stage])
+    config->tidy[stage]();
+}
+
+// Everything a stage of a credit-based pipeline needs to know. Small enough
+// to be streamed to other tiles.
+typedef struct {
+  pipeline_config config;
+  tile_id_t       first_tile;
+} pipeline_launch;
+
+static void pipeline_credit_member(const void* data) {
+  const pipeline_launch* launch = data;
+  const int stage = (tile2int(get_tile_id()) - tile2int(launch->first_tile))
+                  * CORES_PER_TILE + get_core_id();
+  pipeline_credit_stage(&launch->config, launch->first_tile, stage);
+}
+
+void pipeline_loop(const pipeline_config* config) {
+
+  if (config->cores > CORES_PER_TILE || config->max_run_ahead > 0) {
+    pipeline_launch launch = {.config = *config, .first_tile = get_tile_id()};
+    distributed_func execution = {
+      .cores     = config->cores,
+      .func      = &pipeline_credit_member,
+      .data      = &launch,
+      .data_size = sizeof(launch)
+    };
+    loki_execution handle = loki_execute_async(&execution);
+    loki_execute_join(&handle);
+    return;
+  }
+
+  // Tell all cores to start executing the loop.
+  const int bitmask = all_cores_except_0(config->cores);
+  const channel_t ipk_fifo = loki_mcast_address(bitmask, 0, false);
+  const channel_t data_input = loki_mcast_address(bitmask, 3, false);
+  set_channel_map(2, ipk_fifo);
+  set_channel_map(3, data_input);
+
+  loki_send(3, (int)config);
+
+  asm (
+    "fetchr 0f\n"
+    "rmtexecute -> 2\n"             // begin remote execution
+    "addu r13, r3, r0\n"            // receive pointer to configuration info
+    "cregrdi r11, 1\n"              // get core id, and put into r11
+    "andi r11, r11, 0x7\n"          // get core id, and put into r11
+    "addu r14, r11, r0\n"
+    "lli r10, %lo(loki_sleep)\n"    // set return address - sleep when finished
+    "lui r10, %hi(loki_sleep)\n"    // set return address - sleep when finished
+    "lli r24, %lo(pipeline_stage)\n"
+    "lui r24, %hi(pipeline_stage)\n"
+    "fetch.eop r24\n"               // fetch the pipeline stage's task
+    "0:\n"
+  );
+
+  // Also start this core.
+  pipeline_stage(config, 0);
+
+}
+
+// Whether any of the optional features of data driven pipelines are in use.
+static inline bool dd_pipeline_extended(const dd_pipeline_config* config) {
+  return config->payload_words > 0 || config->batch_size > 1
+      || config->replicas != NULL;
+}
+
+static inline int dd_pipeline_stages(const dd_pipeline_config* config) {
+  return (config->replicas != NULL) ? config->stages : config->cores;
+}
+
+static inline int dd_pipeline_replicas(const dd_pipeline_config* config,
+                                       const int stage) {
+  return (config->replicas != NULL) ? config->replicas[stage] : 1;
+}
+
+// Produce or transform one item. Single-word items use the original stage
+// functions, for which the first stage ends the stream by returning
+// end_of_stream_token.
+static inline bool dd_pipeline_item(const dd_pipeline_config* config,
+                                    const int stage, const int index,
+                                    const int* input, int* output) {
+  if (config->payload_words > 0)
+    return config->stage_items[stage](index, input, output);
+
+  *output = config->stage_tasks[stage]((stage == 0) ? index : *input);
+  return (stage != 0) || (*output != config->end_of_stream_token);
+}
+
+// Whether a data driven pipeline spans several tiles. Its cores are then
+// started with loki_execute_async, and connected with credit-based channels.
+static inline bool dd_pipeline_spans_tiles(const dd_pipeline_config* config) {
+  return config->cores > CORES_PER_TILE;
+}
+
+// Send a batch to the core of the next stage which handles batch `batch`,
+// using `next_entry`, which holds one entry for each core of the next stage. A
+// header word gives the number of items in the batch; it is negative at the
+// end of the stream, and then encodes the number of batches sent in total.
+// Each sender uses a different input channel, so batches from different cores
+// cannot be interleaved.
+static inline void dd_pipeline_send(const int* next_entry, const int next_replicas,
+                                    const int batch, const int header,
+                                    const int* data, const int words) {
+  const int entry = next_entry[batch % next_replicas];
+  loki_send(entry, header);
+  if (words > 0)
+    loki_send_words(data, words, entry);
+  LOKI_TRACE_EVENT(LOKI_TRACE_TOKEN_SENT, batch);
+}
+
+// Executed by every core of a pipeline which uses multi-word items, batching or
+// replicated stages, or which spans several tiles. Batch `b` is handled by core
+// `b % replicas` of each stage, so each core knows which of its predecessors to
+// receive its next batch from.
+//
+// On several tiles, core 0 of each tile also receives the tokens joining the
+// execution, on CH_REGISTER_3 and CH_REGISTER_7, so batches arrive on the
+// channels between them instead.
+static void dd_pipeline_member(const dd_pipeline_config* config,
+                               const tile_id_t first_tile, const int core) {
+  // Find this core's stage.
+  int stage = 0;
+  int first = 0;
+  while (core >= first + dd_pipeline_replicas(config, stage))
+    first += dd_pipeline_replicas(config, stage++);
+
+  const int stages = dd_pipeline_stages(config);
+  const int replica = core - first;
+  const int replicas = dd_pipeline_replicas(config, stage);
+  const bool have_successor = (stage < stages - 1);
+  const int next_first = first + replicas;
+  const int next_replicas = have_successor ? dd_pipeline_replicas(config, stage + 1) : 0;
+  const int previous_replicas = (stage > 0) ? dd_pipeline_replicas(config, stage - 1) : 1;
+
+  const bool spans_tiles = dd_pipeline_spans_tiles(config);
+  const enum Channels first_input = spans_tiles ? CH_REGISTER_4 : CH_REGISTER_3;
+  const enum Channels last_input = spans_tiles ? CH_REGISTER_6 : CH_REGISTER_7;
+
+  const int words = (config->payload_words > 0) ? config->payload_words : 1;
+  const int batch_size = (config->batch_size > 1) ? config->batch_size : 1;
+  int input[batch_size * words];
+  int output[batch_size * words];
+
+  assert(stage < stages);
+  assert(stage > 0 || replicas == 1);
+  assert(previous_replicas <= last_input - first_input + 1);
+
+  // One entry for each core of the next stage, so that sending a batch does
+  // not need to change the channel map table.
+  int next_entry[have_successor ? next_replicas : 1];
+  int next;
+  for (next = 0; next < next_replicas; next++) {
+    const int next_core = next_first + next;
+    next_entry[next] = channel_map_alloc();
+
+    if (spans_tiles)
+      loki_connect_ex(next_entry[next], pipeline_stage_tile(first_tile, next_core),
+                      next_core % CORES_PER_TILE, first_input + replica, false);
+    else
+      set_channel_map(next_entry[next],
+                      loki_mcast_address(single_core_bitmask(next_core),
+                                         first_input + replica, false));
+  }
+
+  if (config->initialise && config->initialise[stage])
+    config->initialise[stage]();
+
+  int batch;
+  int batches;
+
+  // Stage 0 produces items until its function reports that there are none
+  // left.
+  if (stage == 0) {
+    bool more = true;
+    int index = 0;
+
+    for (batch = 0; more; batch++) {
+      int items;
+      for (items = 0; items < batch_size; items++, index++) {
+        more = dd_pipeline_item(config, 0, index, NULL, &output[items * words]);
+        if (!more)
+          break;
+      }
+
+      if (items == 0)
+        break;
+
+      if (have_successor)
+        dd_pipeline_send(next_entry, next_replicas, batch, items,
+                         output, items * words);
+    }
+
+    batches = batch;
+  }
+  // Other cores handle every `replicas`th batch until told the stream has
+  // ended.
+  else {
+    for (batch = replica; ; batch += replicas) {
+      const enum Channels channel = first_input + batch % previous_replicas;
+      const int items = loki_receive(channel);
+      LOKI_TRACE_EVENT(LOKI_TRACE_TOKEN_RECEIVED, items < 0 ? -1 : batch);
+
+      if (items < 0) {
+        batches = -items - 1;
+        break;
+      }
+
+      loki_receive_words(input, items * words, channel);
+
+      int i;
+      for (i = 0; i < items; i++)
+        dd_pipeline_item(config, stage, batch * batch_size + i,
+                         &input[i * words], &output[i * words]);
+
+      if (have_successor)
+        dd_pipeline_send(next_entry, next_replicas, batch, items,
+                         output, items * words);
+    }
+  }
+
+  // Pass the end of the stream on to each core of the next stage which would
+  // otherwise expect its next batch from this core.
+  for (next = 0; next < next_replicas; next++) {
+    const int expected = batches + (next - batches % next_replicas + next_replicas) % next_replicas;
+    if (expected % replicas == replica)
+      dd_pipeline_send(next_entry, next_replicas, expected,
+                       -batches - 1, NULL, 0);
+  }
+
+  for (next = 0; next < next_replicas; next++) {
+    loki_disconnect(next_entry[next]);
+    channel_map_free(next_entry[next]);
+  }
+
+  if (config->tidy && config->tidy[stage])
+    config->tidy[stage]();
+
+  // Every core of the last stage reports that it has finished. Pipelines on
+  // several tiles are joined instead.
+  if (!have_successor && !spans_tiles)
+    end_parallel_section();
+}
+
+// Everything a core of a data driven pipeline spanning several tiles needs to
+// know. Small enough to be streamed to other tiles.
+typedef struct {
+  dd_pipeline_config config;
+  tile_id_t          first_tile;
+} dd_pipeline_launch;
+
+static void dd_pipeline_credit_member(const void* data) {
+  const dd_pipeline_launch* launch = data;
+  const int core = (tile2int(get_tile_id()) - tile2int(launch->first_tile))
+                 * CORES_PER_TILE + get_core_id();
+  dd_pipeline_member(&launch->config, launch->first_tile, core);
+}
+
+void dd_pipeline_stage(const dd_pipeline_config* config, const int stage) {
+
+  if (dd_pipeline_extended(config)) {
+    dd_pipeline_member(config, get_tile_id(), stage);
+    return;
+  }
+
+  const int have_successor = (stage < config->cores - 1);
+
+  // Address to connect to. Most cores connect to the next stage in the pipeline
+  // so they can tell when it is safe to begin the next loop iteration. The
+  // final core, however, tells the first core when all work has finished.
+  int next_addr;
+  if (have_successor)
+    next_addr = loki_mcast_address(single_core_bitmask(stage+1), 3, false);
+  else
+    next_addr = loki_mcast_address(single_core_bitmask(0), 3, false);
+
+  // Make connection.
+  channel_map_reserve(8);
+  set_channel_map(8, next_addr);
+
+  // If there is work to do before the pipeline starts, do it now.
+  if (config->initialise && config->initialise[stage])
+    config->initialise[stage]();
+
+  dd_pipeline_func my_func = config->stage_tasks[stage];
+
+  // Stage 0 is in charge of supplying the data to the pipeline, so it should
+  // know how much there is and how many iterations to perform.
+  if (stage == 0) {
+    int arg = 0;
+    while (1) {
+      int result = my_func(arg);
+      if (result == config->end_of_stream_token) {
+        if (have_successor)
+          loki_send(8, result);
+        break;
+      }
+
+      if (have_successor) {
+        loki_send(8, result);
+        LOKI_TRACE_EVENT(LOKI_TRACE_TOKEN_SENT, result);
+      }
+      arg++;
+    }
+  }
+  // All other cores enter an infinite loop, working with the data they receive
+  // for as long as it arrives. At some point one core must call the
+  // end_parallel_section function.
+  else {
+    while (1) {
+      // Receive an argument from the previous core in the pipeline. (Assuming
+      // there is only one argument - more can be passed manually, however.)
+      int arg;
+      arg = loki_receive(3);
+      LOKI_TRACE_EVENT(LOKI_TRACE_TOKEN_RECEIVED, arg);
+
+      if (arg == config->end_of_stream_token) {
+        if (have_successor)
+          loki_send(8, arg);
+        break;
+      }
+
+      // Execute this iteration.
+      int result = my_func(arg);
+
+      // If there is a subsequent core in the pipeline, send it an argument to
+      // work on.
+      if (have_successor) {
+        loki_send(8, result);
+        LOKI_TRACE_EVENT(LOKI_TRACE_TOKEN_SENT, result);
+      }
+    }
+  }
+
+  channel_map_free(8);
+
+  // Release any resources when the pipeline has finished.
+  if (config->tidy && config->tidy[stage])
+    config->tidy[stage]();
+
+  // Signal that the pipeline has finished (assumes that no one has a long tidy
+  // function).
+  if (!have_successor)
+    end_parallel_section();
+
+}
+
+void dd_pipeline_loop(const dd_pipeline_config* config) {
+
+  if (dd_pipeline_spans_tiles(config)) {
+    dd_pipeline_launch launch = {.config = *config, .first_tile = get_tile_id()};
+    distributed_func execution = {
+      .cores     = config->cores,
+      .func      = &dd_pipeline_credit_member,
+      .data      = &launch,
+      .data_size = sizeof(launch)
+    };
+    loki_execution handle = loki_execute_async(&execution);
+    loki_execute_join(&handle);
+    return;
+  }
+
+  if (config->cores > 1) {
+    // Tell all cores to start executing the loop.
+    const int bitmask = all_cores_except_0(config->cores);
+    const channel_t ipk_fifo = loki_mcast_address(bitmask, 0, false);
+    const channel_t data_input = loki_mcast_address(bitmask, 3, false);
+    set_channel_map(2, ipk_fifo);
+    set_channel_map(3, data_input);
+
+    loki_send(3, (int)config);
+
+    asm (
+      "fetchr 0f\n"
+      "rmtexecute -> 2\n"           // begin remote execution
+      "addu r13, r3, r0\n"          // receive pointer to configuration info
+      "cregrdi r11, 1\n"            // get core id, and put into r14
+      "andi r14, r11, 0x7\n"        // get core id, and put into r14
+      "lli r10, %lo(loki_sleep)\n"  // set return address - sleep when finished
+      "lui r10, %hi(loki_sleep)\n"  // set return address - sleep when finished
+      "lli r24, %lo(dd_pipeline_stage)\n"
+      "lui r24, %hi(dd_pipeline_stage)\n"
+      "fetch.eop r24\n"             // fetch the pipeline stage's task
+      "0:\n"
+    );
+  }
+
+  // Also start this core.
+  dd_pipeline_stage(config, 0);
+
+
+  if (config->cores > 1) {
+    // Wait for the rest of the pipeline to finish before continuing. Would like
+    // to remove this stall, but there are issues if we start sending
+    // instructions to FIFOs when other cores are still doing work.
+    const int finishers =
+        dd_pipeline_replicas(config, dd_pipeline_stages(config) - 1);
+    int i;
+    for (i = 0; i < finishers; i++)
+      wait_end_parallel_section();
+  }
+
+}
+
+
+//============================================================================//
+// Dataflow
+//
+//   Each core repeatedly executes a single instruction packet, receiving data
+//   over the network and sending results on to one or more cores.
+//============================================================================//
+
+void start_dataflow(const dataflow_config* config) {
+
+  // Send each core the function it is to execute.
+  int core;
+  for (core = 1; core < config->cores; core++)
+    loki_remote_execute(get_tile_id(), core, config->core_tasks[core], NULL, 0);
+
+  // Once all other cores have been set up, this core can join in.
+  config->core_tasks[0]();
+
+  // After this core has finished its work, wait for the dataflow network to
+  // drain, then kill all cores.
+  wait_end_parallel_section();
+
+  const int bitmask = all_cores_except_0(config->cores);
+  const int ipk_fifos = loki_mcast_address(bitmask, 0, false);
+  set_channel_map(2, ipk_fifos);
+  loki_send_interrupt(2);
+
+  // The dataflow macro stores the address of any tidy-up code which needs to
+  // be executed when dataflow has finished. Tell the core to fetch this now.
+  asm (
+    "fetchr 0f\n"
+    "rmtexecute -> 2\n"
+    "fetch.eop r24\n"
+    "0:\n"
+  );
+
+}
+
+
+void dataflow_graph_init(dataflow_graph* graph, int end_of_stream) {
+  graph->end_of_stream = end_of_stream;
+  graph->nodes = 0;
+  graph->edges = 0;
+  graph->packets = 0;
+}
+
+static int dataflow_graph_add(dataflow_graph* graph, dataflow_node node) {
+  assert(graph->nodes < DATAFLOW_MAX_NODES);
+  assert(node.inputs <= DATAFLOW_MAX_INPUTS && node.outputs <= DATAFLOW_MAX_OUTPUTS);
+  graph->node[graph->nodes] = node;
+  return graph->nodes++;
+}
+
+int dataflow_graph_add_function(dataflow_graph* graph, dataflow_node_func func,
+                                int inputs, int outputs) {
+  dataflow_node node = {
+    .kind = DATAFLOW_NODE_FUNCTION,
+    .function = func,
+    .inputs = inputs,
+    .outputs = outputs
+  };
+  return dataflow_graph_add(graph, node);
+}
+
+int dataflow_graph_add_packet(dataflow_graph* graph, dataflow_func func,
+                              int inputs, int outputs) {
+  dataflow_node node = {
+    .kind = DATAFLOW_NODE_PACKET,
+    .packet = func,
+    .inputs = inputs,
+    .outputs = outputs
+  };
+  graph->packets++;
+  return dataflow_graph_add(graph, node);
+}
+
+void dataflow_graph_connect(dataflow_graph* graph, int from, int output,
+                            int to, int input) {
+  assert(graph->edges < DATAFLOW_MAX_EDGES);
+  assert(from < graph->nodes && output < graph->node[from].outputs);
+  assert(to < graph->nodes && input < graph->node[to].inputs);
+
+  dataflow_edge edge = {.from = from, .output = output, .to = to, .input = input};
+  graph->edge[graph->edges++] = edge;
+}
+
+static inline tile_id_t dataflow_node_tile(const dataflow_graph* graph,
+                                           const int node) {
+  return int2tile(tile2int(graph->first_tile) + node / CORES_PER_TILE);
+}
+
+// Number of function nodes which have finished, when packet nodes must be
+// stopped afterwards. Only ever accessed uncached.
+static volatile uint dataflow_finished;
+
+// Routes leaving one node.
+struct dataflow_routes {
+  uint          count;
+  unsigned char port[DATAFLOW_MAX_ROUTES];   // Output port each route serves.
+  unsigned char entry[DATAFLOW_MAX_ROUTES];  // Channel map table entry used.
+};
+
+static void dataflow_add_route(struct dataflow_routes* routes, const bool packet,
+                               const int port, const channel_t address) {
+  assert(routes->count < DATAFLOW_MAX_ROUTES);
+
+  // Packets send from a fixed entry for each port, so can only have one route
+  // per port. Reserving the entry a second time fails.
+  int entry;
+  if (packet) {
+    entry = DATAFLOW_OUTPUT_ENTRY(port);
+    channel_map_reserve(entry);
+  }
+  else
+    entry = channel_map_alloc();
+
+  set_channel_map(entry, address);
+  routes->port[routes->count] = port;
+  routes->entry[routes->count] = entry;
+  routes->count++;
+}
+
+// Connect each of this node's output ports to its destinations. Destinations on
+// this tile which use the same input port share a multicast route.
+static void dataflow_make_routes(const dataflow_graph* graph, const int node,
+                                 struct dataflow_routes* routes) {
+  const tile_id_t tile = dataflow_node_tile(graph, node);
+  const bool packet = (graph->node[node].kind == DATAFLOW_NODE_PACKET);
+  routes->count = 0;
+
+  int port;
+  for (port = 0; port < graph->node[node].outputs; port++) {
+    // Local destinations, by input port.
+    uint local[DATAFLOW_MAX_INPUTS] = {0};
+
+    uint e;
+    for (e = 0; e < graph->edges; e++) {
+      const dataflow_edge* edge = &graph->edge[e];
+      if (edge->from != node || edge->output != port)
+        continue;
+
+      const tile_id_t destination = dataflow_node_tile(graph, edge->to);
+      if (destination == tile) {
+        local[edge->input] |= single_core_bitmask(edge->to % CORES_PER_TILE);
+        continue;
+      }
+
+      dataflow_add_route(routes, packet, port,
+          loki_core_address(destination, edge->to % CORES_PER_TILE,
+                            DATAFLOW_INPUT_CHANNEL(edge->input),
+                            INFINITE_CREDIT_COUNT));
+    }
+
+    int input;
+    for (input = 0; input < DATAFLOW_MAX_INPUTS; input++)
+      if (local[input] != 0)
+        dataflow_add_route(routes, packet, port,
+            loki_mcast_address(local[input], DATAFLOW_INPUT_CHANNEL(input),
+                               false));
+  }
+}
+
+static void dataflow_restore_routes(const struct dataflow_routes* routes) {
+  uint route;
+  for (route = 0; route < routes->count; route++)
+    channel_map_free(routes->entry[route]);
+}
+
+// Fire a function node until it stops. If `entry` is not negative, the node has
+// a single route, using that entry, which should be a constant.
+static inline __attribute__((always_inline))
+void dataflow_fire(const dataflow_graph* graph, const dataflow_node* config,
+                   const struct dataflow_routes* routes, int* pending,
+                   const int entry) {
+  const int end = graph->end_of_stream;
+  int inputs[DATAFLOW_MAX_INPUTS];
+  int outputs[DATAFLOW_MAX_OUTPUTS];
+
+  bool running = true;
+  while (running) {
+    int port;
+    for (port = 0; port < config->inputs && running; port++) {
+      const enum Channels channel = DATAFLOW_INPUT_CHANNEL(port);
+      int value;
+      while ((value = loki_receive(channel)) == end)
+        if (--pending[port] == 0) {
+          running = false;
+          break;
+        }
+      inputs[port] = value;
+    }
+
+    if (running)
+      running = config->function(inputs, outputs);
+
+    if (running) {
+      if (entry >= 0)
+        loki_send(entry, outputs[routes->port[0]]);
+      else {
+        uint route;
+        for (route = 0; route < routes->count; route++)
+          loki_send(routes->entry[route], outputs[routes->port[route]]);
+      }
+    }
+  }
+}
+
+// Fire a function node until it stops, then drain its inputs and pass the end
+// of the stream on.
+static void dataflow_function_node(const dataflow_graph* graph, const int node,
+                                   const struct dataflow_routes* routes) {
+  const dataflow_node* config = &graph->node[node];
+  const int end = graph->end_of_stream;
+
+  // Number of edges into each input port which have not yet ended.
+  int pending[DATAFLOW_MAX_INPUTS] = {0};
+  uint e;
+  for (e = 0; e < graph->edges; e++)
+    if (graph->edge[e].to == node)
+      pending[graph->edge[e].input]++;
+
+  int port;
+  for (port = 0; port < config->inputs; port++)
+    assert(pending[port] > 0);
+
+  // Most nodes have a single route: select its entry once rather than for
+  // every value sent.
+  if (routes->count == 1)
+    CHANNEL_MAP_DISPATCH(routes->entry[0],
+        dataflow_fire(graph, config, routes, pending, CHANNEL_MAP_ENTRY));
+  else
+    dataflow_fire(graph, config, routes, pending, -1);
+
+  for (port = 0; port < config->inputs; port++)
+    while (pending[port] > 0)
+      if (loki_receive(DATAFLOW_INPUT_CHANNEL(port)) == end)
+        pending[port]--;
+
+  uint route;
+  for (route = 0; route < routes->count; route++)
+    loki_send(routes->entry[route], end);
+}
+
+// Executed by the core holding each node.
+static void dataflow_graph_member(const void* data) {
+  const dataflow_graph* graph = data;
+  const int node = (tile2int(get_tile_id()) - tile2int(graph->first_tile))
+                 * CORES_PER_TILE + get_core_id();
+
+  struct dataflow_routes routes;
+  dataflow_make_routes(graph, node, &routes);
+
+  if (graph->node[node].kind == DATAFLOW_NODE_PACKET) {
+    // Returns once the core is interrupted and fetches its tidy-up code.
+    graph->node[node].packet();
+  }
+  else {
+    dataflow_function_node(graph, node, &routes);
+
+    // Tell node 0 that this node has finished. This can't use a token, which
+    // might be confused with those joining the execution.
+    if (graph->packets > 0 && node != 0) {
+      set_channel_map(2, uncached_memory_channel());
+      loki_channel_load_and_add(2, (void*)&dataflow_finished, 1);
+      loki_receive(2);
+    }
+  }
+
+  dataflow_restore_routes(&routes);
+}
+
+void dataflow_graph_run(dataflow_graph* graph) {
+  assert(graph->nodes > 0 && graph->node[0].kind == DATAFLOW_NODE_FUNCTION);
+  graph->first_tile = get_tile_id();
+
+  if (graph->packets > 0) {
+    set_channel_map(2, uncached_memory_channel());
+    loki_channel_store_word(2, (void*)&dataflow_finished, 0);
+  }
+
+  distributed_func config = {
+    .cores     = graph->nodes,
+    .func      = &dataflow_graph_member,
+    .data      = graph,
+    .data_size = sizeof(dataflow_graph)
+  };
+  loki_execution handle = loki_execute_async(&config);
+
+  // Node 0 has finished by now. Wait for every other function node, then stop
+  // the packet nodes.
+  if (graph->packets > 0) {
+    const uint functions = graph->nodes - graph->packets - 1;
+    uint finished;
+    set_channel_map(2, uncached_memory_channel());
+    do {
+      loki_channel_load_word(2, (void*)&dataflow_finished);
+      finished = loki_receive(2);
+    } while (finished < functions);
+  }
+
+  uint node;
+  for (node = 1; node < graph->nodes; node++) {
+    if (graph->node[node].kind != DATAFLOW_NODE_PACKET)
+      continue;
+
+    set_channel_map(2, loki_core_address(dataflow_node_tile(graph, node),
+                                         node % CORES_PER_TILE, 0,
+                                         INFINITE_CREDIT_COUNT));
+    loki_send_interrupt(2);
+
+    // The dataflow macro stores the address of any tidy-up code in r24.
+    asm (
+      "fetchr 0f\n"
+      "rmtexecute -> 2\n"
+      "fetch.eop r24\n"
+      "0:\n"
+    );
+  }
+
+  loki_execute_join(&handle);
+}
+
+
+//============================================================================//
+// Atomics
+//
+//   Everything goes to main memory through entry 2, so these work between any
+//   cores on the chip. Requests from one core reach main memory in the order
+//   they were sent. Waiting cores back off between polls, since each poll is a
+//   round trip which competes with the requests that would release them.
+//============================================================================//
+
+// Cycles to wait between polls for each core ahead in a ticket lock's queue.
+#define ATOMIC_TICKET_BACKOFF 32
+
+// Cycles to wait between polls of a word which only one other core will write.
+#define ATOMIC_SPIN_BACKOFF 8
+
+void loki_ticket_lock_acquire(loki_ticket_lock* lock) {
+  const int ticket = loki_atomic_fetch_add(&lock->next, 1);
+
+  while (true) {
+    const int ahead = ticket - loki_atomic_load(&lock->serving);
+    if (ahead == 0)
+      break;
+    loki_atomic_pause(ahead * ATOMIC_TICKET_BACKOFF);
+  }
+
+  barrier();
+}
+
+void loki_mcs_lock_acquire(loki_mcs_lock* lock, loki_mcs_node* node) {
+  loki_atomic_store(&node->next, 0);
+  loki_atomic_store(&node->locked, 1);
+
+  loki_mcs_node* predecessor =
+      (loki_mcs_node*)loki_atomic_exchange(&lock->tail, (int)node);
+
+  if (predecessor != NULL) {
+    loki_atomic_store(&predecessor->next, (int)node);
+    while (loki_atomic_load(&node->locked))
+      loki_atomic_pause(ATOMIC_SPIN_BACKOFF);
+  }
+
+  barrier();
+}
+
+void loki_mcs_lock_release(loki_mcs_lock* lock, loki_mcs_node* node) {
+  barrier();
+
+  loki_mcs_node* successor = (loki_mcs_node*)loki_atomic_load(&node->next);
+
+  if (successor == NULL) {
+    // Nobody has joined the queue yet, or somebody is between swapping the
+    // tail and linking themselves in. Only in the second case does the tail
+    // no longer point here. The store-conditional may fail spuriously, so
+    // only wait for a successor once the tail is seen to have moved on.
+    set_channel_map(2, uncached_memory_channel());
+    while (true) {
+      loki_channel_load_linked(2, (void*)&lock->tail.value);
+      if (loki_receive(CH_REGISTER_2) != (int)node)
+        break;
+
+      loki_channel_store_conditional(2, (void*)&lock->tail.value, 0);
+      if (loki_receive(CH_REGISTER_2) != 0)
+        return;
+    }
+
+    while ((successor = (loki_mcs_node*)loki_atomic_load(&node->next)) == NULL)
+      loki_atomic_pause(ATOMIC_SPIN_BACKOFF);
+  }
+
+  loki_atomic_store(&successor->locked, 0);
+}
+
+void loki_atomic_barrier_wait(loki_atomic_barrier* barrier) {
+  // The sense can't change until this core has arrived, so this is the sense
+  // of the current episode.
+  const int sense = loki_atomic_load(&barrier->sense);
+
+  if (loki_atomic_fetch_add(&barrier->remaining, -1) == 1) {
+    // Last to arrive. Nobody else touches the count until the sense flips.
+    loki_atomic_store(&barrier->remaining, loki_atomic_load(&barrier->cores));
+    loki_atomic_store(&barrier->sense, !sense);
+  }
+  else {
+    while (loki_atomic_load(&barrier->sense) == sense)
+      loki_atomic_pause(ATOMIC_SPIN_BACKOFF);
+  }
+}
+
+
+//============================================================================//
+// Queues
+//
+//   Messages are pushed straight into the consumer's L1, one cache line each.
+//   Only the flow-control counters go to main memory, and these are always
+//   accessed uncached.
+//============================================================================//
+
+static inline uint queue_uncached_load(volatile uint *address) {
+  set_channel_map(2, uncached_memory_channel());
+  loki_channel_load_word(2, (void*)address);
+  return loki_receive(2);
+}
+
+static inline void queue_uncached_store(volatile uint *address, uint value) {
+  set_channel_map(2, uncached_memory_channel());
+  loki_channel_store_word(2, (void*)address, value);
+}
+
+void loki_queue_init(loki_queue* queue, loki_queue_slot* slots, uint capacity,
+                     tile_id_t consumer_tile, channel_t consumer_memory,
+                     bool multi_producer) {
+  assert(((uint)slots & 0x1f) == 0);
+  assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+
+  if (consumer_memory == 0)
+    consumer_memory = get_channel_map(1);
+
+  queue->slots = slots;
+  queue->capacity = capacity;
+  queue->consumer_tile = consumer_tile;
+  queue->group_start = (enum Memories)((consumer_memory >> 5) & 0x7);
+  queue->group_size = loki_channel_memory_get_group_size(consumer_memory);
+  queue->multi_producer = multi_producer;
+
+  // Position n is written with sequence number n + 1, so zero marks every
+  // slot as empty.
+  uint i;
+  for (i = 0; i < capacity; i++)
+    slots[i].sequence = 0;
+
+  loki_channel_flush_data(1, queue, offsetof(loki_queue, reserved));
+  loki_channel_flush_data(1, slots, capacity * sizeof(loki_queue_slot));
+
+  queue_uncached_store(&queue->reserved, 0);
+  queue_uncached_store(&queue->consumed, 0);
+}
+
+void loki_queue_producer_init(loki_queue_producer* producer, loki_queue* queue,
+                              unsigned char mask_index,
+                              unsigned char directory_index) {
+  assert(directory_index < LOKI_MEMORY_DIRECTORY_SIZE);
+
+  // The descriptor may have been created on another tile.
+  loki_channel_invalidate_data(1, queue, offsetof(loki_queue, reserved));
+
+  // Pushes replace the directory bits of each address with `directory_index`
+  // to select the entry routing to the consumer, which then restores the
+  // original bits. This only works if every slot has the same original bits.
+  uint first = (uint)queue->slots;
+  uint last = first + queue->capacity * sizeof(loki_queue_slot) - 1;
+  uint segment = (first >> mask_index) & (LOKI_MEMORY_DIRECTORY_SIZE - 1);
+  assert((first >> mask_index) == (last >> mask_index));
+
+  loki_memory_directory_entry_t entry = {
+    .next_tile        = queue->consumer_tile,
+    .replacement_bits = segment,
+    .scratchpad       = false
+  };
+  loki_memory_directory_l1_entry_update(
+      (void*)((uint)directory_index << mask_index), entry);
+
+  producer->queue = queue;
+  producer->next = 0;
+  producer->limit = queue->capacity;
+  producer->mask_index = mask_index;
+  producer->directory_index = directory_index;
+}
+
+void loki_queue_consumer_init(loki_queue_consumer* consumer, loki_queue* queue) {
+  assert(get_tile_id() == queue->consumer_tile);
+
+  loki_channel_invalidate_data(1, queue, offsetof(loki_queue, reserved));
+  loki_channel_invalidate_data(1, queue->slots,
+                               queue->capacity * sizeof(loki_queue_slot));
+
+  consumer->queue = queue;
+  consumer->next = 0;
+}
+
+void loki_queue_send(loki_queue_producer* producer, const int* payload) {
+  loki_queue* queue = producer->queue;
+  uint position;
+
+  if (queue->multi_producer) {
+    set_channel_map(2, uncached_memory_channel());
+    loki_channel_load_and_add(2, (void*)&queue->reserved, 1);
+    position = loki_receive(2);
+  }
+  else
+    position = producer->next++;
+
+  // Wait until the consumer has finished with this slot's previous message.
+  // The difference is signed so positions may wrap around.
+  while ((int)(position - producer->limit) >= 0)
+    producer->limit = queue_uncached_load(&queue->consumed) + queue->capacity;
+
+  loki_queue_slot* slot = &queue->slots[position & (queue->capacity - 1)];
+  loki_memory_push_cache_line(1, slot,
+                              producer->mask_index, producer->directory_index,
+                              queue->group_start, queue->group_size,
+                              payload[0], payload[1], payload[2], payload[3],
+                              payload[4], payload[5], payload[6],
+                              position + 1);
+}
+
+bool loki_queue_try_receive(loki_queue_consumer* consumer, int* payload) {
+  loki_queue* queue = consumer->queue;
+  loki_queue_slot* slot = &queue->slots[consumer->next & (queue->capacity - 1)];
+
+  if (slot->sequence != consumer->next + 1)
+    return false;
+
+  uint i;
+  for (i = 0; i < LOKI_QUEUE_PAYLOAD_WORDS; i++)
+    payload[i] = slot->payload[i];
+
+  consumer->next++;
+
+  // Return space to the producers every half-queue, so they rarely need to
+  // read the counter, but can never wait on a slot which has been consumed.
+  if ((consumer->next & (queue->capacity/2 - 1)) == 0) {
+    barrier();
+    queue_uncached_store(&queue->consumed, consumer->next);
+  }
+
+  return true;
+}
+
+
+//============================================================================//
+// Coherence regions
+//============================================================================//
+
+void loki_region_init(loki_region* region, void* base, size_t size,
+                      uint32_t* bitmap) {
+  char* first = (char*)((uint)base & ~0x1f);
+  char* end = (char*)base + size;
+
+  region->base = first;
+  region->lines = (end - first + 31) / 32;
+  region->marked = bitmap;
+
+  size_t words = (region->lines + 31) / 32;
+  size_t i;
+  for (i = 0; i < words; i++)
+    bitmap[i] = 0;
+}
+
+// Wait for a cache bank in the channel 1 group to finish all earlier requests
+// from this core. As in loki_cache_flush_all_lines_ex, the load is made in
+// scratchpad mode so nothing is fetched.
+static inline void region_wait_for_bank(const uint bank) {
+  asm volatile (
+    "sendconfig %0, %1 -> 1\n"
     "fetchr 0f\n"
-    "rmtexecute -> 2\n"             // begin remote execution
-    "addu r13, r3, r0\n"            // receive pointer to configuration info
-    "cregrdi r11, 1\n"              // get core id, and put into r11
-    "andi r11, r11, 0x7\n"          // get core id, and put into r11
-    "addu r14, r11, r0\n"
-    "lli r10, %lo(loki_sleep)\n"    // set return address - sleep when finished
-    "lui r10, %hi(loki_sleep)\n"    // set return address - sleep when finished
-    "lli r24, %lo(pipeline_stage)\n"
-    "lui r24, %hi(pipeline_stage)\n"
-    "fetch.eop r24\n"               // fetch the pipeline stage's task
+    "or.eop r0, r2, r0\n"
     "0:\n"
+    :
+    : "r" (bank*0x20), "n" (SC_RETURN_TO_R2 | SC_L1_SCRATCHPAD | SC_LOAD_WORD)
+    : "memory"
   );
+}
 
-  // Also start this core.
-  pipeline_stage(config, 0);
+void loki_region_publish(loki_region* region) {
+  const uint banks = 1 << loki_channel_memory_get_group_size(get_channel_map(1));
+  const size_t words = (region->lines + 31) / 32;
+  uint used_banks = 0;
+  size_t word;
+
+  for (word = 0; word < words; word++) {
+    uint32_t bits = region->marked[word];
+    region->marked[word] = 0;
+
+    while (bits != 0) {
+      uint bit = __builtin_ctz(bits);
+      bits &= bits - 1;
+
+      char* line = region->base + (word * 32 + bit) * 32;
+      loki_channel_flush_cache_line(1, line);
+      used_banks |= 1 << (((uint)line >> 5) & (banks - 1));
+    }
+  }
+
+  // Requests to each bank are handled in order, so one reply per bank shows
+  // that all of its flushes have been sent on.
+  uint bank;
+  for (bank = 0; bank < banks; bank++)
+    if (used_banks & (1 << bank))
+      region_wait_for_bank(bank);
+}
+
+void loki_region_acquire(loki_region* region) {
+  const size_t words = (region->lines + 31) / 32;
+  size_t word;
+
+  for (word = 0; word < words; word++) {
+    uint32_t bits = region->marked[word];
+    region->marked[word] = 0;
+
+    while (bits != 0) {
+      uint bit = __builtin_ctz(bits);
+      bits &= bits - 1;
+      loki_channel_invalidate_cache_line(1, region->base + (word * 32 + bit) * 32);
+    }
+  }
+}
+
+
+//============================================================================//
+// Memory
+//============================================================================//
+
+extern void* __heap_ptr;
+
+void loki_free(void* ptr) {
+  // The standard free does what we want here.
+  free(ptr);
+}
+
+// Round val up to the nearest multiple of the cache line size.
+static inline int loki_round_up_cache_line(int val) {
+  if (val & 0x1F)
+    return (val & ~0x1F) + 32;  // Clear offset, then add a whole line.
+  else
+    return val;
+}
+
+void* loki_malloc(size_t size) {
+  if (tile2int(get_tile_id()) != 0) {
+    printf("Warning: calling malloc on tile %d is unsafe!\n",
+           tile2int(get_tile_id()));
+  }
+
+  // Round the heap pointer up to the nearest cache line boundary.
+  __heap_ptr = (void*)loki_round_up_cache_line((int)__heap_ptr);
+
+  // Round up size so we allocate a whole number of cache lines.
+  size_t newSize = loki_round_up_cache_line(size);
+
+  // Normal malloc.
+  return malloc(newSize);
+}
+
+// Each core's private heap is divided into pages. A page either holds objects
+// from one size class, or is part of a larger, multi-page block. The first
+// pages of each heap hold a table describing all of its pages.
+#define HEAP_PAGE_SIZE 128
+#define HEAP_SIZE_CLASSES 5        // 4, 8, 16, 32 and 64 bytes
+#define HEAP_MAX_OBJECT (4 << (HEAP_SIZE_CLASSES - 1))
+
+// Page table entries. Size classes are stored as class+1.
+#define HEAP_PAGE_FREE 0
+#define HEAP_PAGE_BLOCK 0x8000     // First page of a block; low bits hold length
+#define HEAP_PAGE_CONTINUATION 0x4000
+
+// Location of all cores' private heaps, set up by loki_init. Fills a whole
+// cache line so that it can be flushed for other tiles to read.
+static struct {
+  char  *base;
+  size_t size;                     // of each core's heap
+  uint   cores;
+  uint   padding[5];
+} private_heap_config __attribute__((aligned(32)));
+
+// State of one core's private heap. Only ever accessed by its owner, and fills
+// a whole cache line, so no coherence is needed.
+struct private_heap {
+  uint16_t *pages;                 // page table, at the start of the heap
+  uint      num_pages;
+  void     *free[HEAP_SIZE_CLASSES];
+} __attribute__((aligned(32)));
+
+static struct private_heap
+    private_heaps[CORES_PER_TILE * COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS];
+
+static void private_heap_reserve(uint cores, size_t size) {
+  size = (size + HEAP_PAGE_SIZE - 1) & ~(HEAP_PAGE_SIZE - 1);
+
+  private_heap_config.base = loki_malloc(cores * size);
+  private_heap_config.size = size;
+  private_heap_config.cores = cores;
+  assert(private_heap_config.base != NULL);
+
+  // Other tiles read this before they first allocate.
+  loki_channel_flush_data(1, &private_heap_config, sizeof(private_heap_config));
+}
+
+// Mark `count` pages, starting at `first`, as a single block.
+static inline void private_heap_mark_block(struct private_heap* heap,
+                                           uint first, uint count) {
+  assert(count < HEAP_PAGE_CONTINUATION);
+
+  heap->pages[first] = HEAP_PAGE_BLOCK | count;
+
+  uint page;
+  for (page = first + 1; page < first + count; page++)
+    heap->pages[page] = HEAP_PAGE_CONTINUATION;
+}
+
+// Return this core's heap, setting it up on first use.
+static struct private_heap* private_heap_this_core(void) {
+  const uint index = tile2int(get_tile_id()) * CORES_PER_TILE + get_core_id();
+  struct private_heap *heap = &private_heaps[index];
+
+  if (heap->pages == NULL) {
+    assert(private_heap_config.size > 0);   // loki_init reserved no heaps
+    assert(index < private_heap_config.cores);
+
+    heap->pages = (uint16_t*)(private_heap_config.base
+                              + index * private_heap_config.size);
+    heap->num_pages = private_heap_config.size / HEAP_PAGE_SIZE;
+    memset(heap->pages, 0, heap->num_pages * sizeof(uint16_t));
+    memset(heap->free, 0, sizeof(heap->free));
+
+    // Reserve the pages holding the page table.
+    uint table_pages = (heap->num_pages * sizeof(uint16_t) + HEAP_PAGE_SIZE - 1)
+                     / HEAP_PAGE_SIZE;
+    private_heap_mark_block(heap, 0, table_pages);
+  }
+
+  return heap;
+}
+
+// Find the first run of `count` free pages, and mark it as a block.
+// Returns the index of the first page, or -1 if there is no such run.
+static int private_heap_take_pages(struct private_heap* heap, uint count) {
+  uint start = 0;
+  uint page;
+
+  for (page = 0; page < heap->num_pages; page++) {
+    if (heap->pages[page] != HEAP_PAGE_FREE)
+      start = page + 1;
+    else if (page + 1 - start == count) {
+      private_heap_mark_block(heap, start, count);
+      return start;
+    }
+  }
+
+  return -1;
+}
+
+static inline char* private_heap_page(struct private_heap* heap, uint page) {
+  return (char*)heap->pages + page * HEAP_PAGE_SIZE;
+}
+
+void* loki_private_malloc(size_t size) {
+  struct private_heap *heap = private_heap_this_core();
+  int page;
+
+  if (size > HEAP_MAX_OBJECT) {
+    page = private_heap_take_pages(heap,
+                                   (size + HEAP_PAGE_SIZE - 1) / HEAP_PAGE_SIZE);
+    return (page < 0) ? NULL : private_heap_page(heap, page);
+  }
+
+  // Find the smallest size class which fits.
+  uint size_class = 0;
+  while ((4u << size_class) < size)
+    size_class++;
+
+  // Refill an empty pool with a whole page of objects.
+  if (heap->free[size_class] == NULL) {
+    page = private_heap_take_pages(heap, 1);
+    if (page < 0)
+      return NULL;
+    heap->pages[page] = size_class + 1;
+
+    char *object = private_heap_page(heap, page);
+    char *end = object + HEAP_PAGE_SIZE;
+    for (; object < end; object += (4 << size_class)) {
+      *(void**)object = heap->free[size_class];
+      heap->free[size_class] = object;
+    }
+  }
+
+  void *result = heap->free[size_class];
+  heap->free[size_class] = *(void**)result;
+  return result;
+}
+
+void loki_private_free(void* ptr) {
+  if (ptr == NULL)
+    return;
+
+  struct private_heap *heap = private_heap_this_core();
+  uint page = ((char*)ptr - (char*)heap->pages) / HEAP_PAGE_SIZE;
+  assert((char*)ptr >= (char*)heap->pages && page < heap->num_pages);
+
+  uint16_t entry = heap->pages[page];
+
+  if (entry & HEAP_PAGE_BLOCK) {
+    uint count = entry & ~HEAP_PAGE_BLOCK;
+    uint i;
+    for (i = 0; i < count; i++)
+      heap->pages[page + i] = HEAP_PAGE_FREE;
+  }
+  else {
+    // Pool pages are never returned; the object just rejoins its pool.
+    assert(entry != HEAP_PAGE_FREE && entry != HEAP_PAGE_CONTINUATION);
+    uint size_class = entry - 1;
+    *(void**)ptr = heap->free[size_class];
+    heap->free[size_class] = ptr;
+  }
+}
+
+void* loki_private_realloc(void* ptr, size_t size) {
+  if (size == 0) {
+    loki_private_free(ptr);
+    return NULL;
+  }
+  else if (ptr == NULL)
+    return loki_private_malloc(size);
+
+  struct private_heap *heap = private_heap_this_core();
+  uint page = ((char*)ptr - (char*)heap->pages) / HEAP_PAGE_SIZE;
+  assert((char*)ptr >= (char*)heap->pages && page < heap->num_pages);
+
+  uint16_t entry = heap->pages[page];
+  size_t current;
+
+  if (entry & HEAP_PAGE_BLOCK) {
+    uint count = entry & ~HEAP_PAGE_BLOCK;
+    uint needed = (size + HEAP_PAGE_SIZE - 1) / HEAP_PAGE_SIZE;
+    uint i;
+
+    // Shrink in place, returning any spare pages.
+    if (needed <= count) {
+      private_heap_mark_block(heap, page, needed);
+      for (i = needed; i < count; i++)
+        heap->pages[page + i] = HEAP_PAGE_FREE;
+      return ptr;
+    }
+
+    // Grow in place if the following pages are free.
+    if (page + needed <= heap->num_pages) {
+      for (i = count; i < needed; i++)
+        if (heap->pages[page + i] != HEAP_PAGE_FREE)
+          break;
+
+      if (i == needed) {
+        private_heap_mark_block(heap, page, needed);
+        return ptr;
+      }
+    }
+
+    current = count * HEAP_PAGE_SIZE;
+  }
+  else {
+    current = 4 << (entry - 1);
+    if (size <= current)
+      return ptr;
+  }
+
+  // Move the block, copying only the current allocation. Both blocks are
+  // aligned, and blocks of a line or more are whole lines.
+  void *newPtr = loki_private_malloc(size);
+  if (newPtr != NULL) {
+    loki_memcpy(newPtr, ptr, current);
+    loki_private_free(ptr);
+  }
+  return newPtr;
+}
+
+int loki_arena_init(loki_arena* arena, size_t size) {
+  arena->base = loki_private_malloc(size);
+  if (arena->base == NULL)
+    return -1;
+
+  arena->next = arena->base;
+  arena->end = arena->base + size;
+  return 0;
+}
+
+void loki_arena_free(loki_arena* arena) {
+  loki_private_free(arena->base);
+  arena->base = arena->next = arena->end = NULL;
+}
+
+// Copy fewer than a cache line's worth of bytes, using whole words where the
+// two pointers allow it.
+static inline void memory_copy_small(char* dst, const char* src, size_t size) {
+  if ((((uint)dst ^ (uint)src) & 0x3) == 0) {
+    for ( ; size > 0 && ((uint)dst & 0x3) != 0; size--)
+      *dst++ = *src++;
+    for ( ; size >= sizeof(int); size -= sizeof(int), dst += 4, src += 4)
+      *(int*)dst = *(const int*)src;
+  }
+
+  for ( ; size > 0; size--)
+    *dst++ = *src++;
+}
+
+// As memory_copy_small, but working down from the ends of both regions.
+static inline void memory_copy_small_backward(char* dst_end,
+                                              const char* src_end,
+                                              size_t size) {
+  if ((((uint)dst_end ^ (uint)src_end) & 0x3) == 0) {
+    for ( ; size > 0 && ((uint)dst_end & 0x3) != 0; size--)
+      *--dst_end = *--src_end;
+    for ( ; size >= sizeof(int); size -= sizeof(int)) {
+      dst_end -= 4;
+      src_end -= 4;
+      *(int*)dst_end = *(const int*)src_end;
+    }
+  }
+
+  for ( ; size > 0; size--)
+    *--dst_end = *--src_end;
+}
+
+// Copy one cache line to a line-aligned destination. All of the source is read
+// before anything is written, so the two lines may overlap, and the
+// destination is written with a single operation, so is never fetched.
+static inline void memory_copy_line(void* dst, const void* src) {
+  if (((uint)src & 0x1f) == 0) {
+    v8int32_t v = loki_load_v8int32_t(src);
+    loki_store_8_int32_t(dst, v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+    return;
+  }
+
+  int w[8];
+  if (((uint)src & 0x3) == 0) {
+    const int* words = src;
+    w[0] = words[0]; w[1] = words[1]; w[2] = words[2]; w[3] = words[3];
+    w[4] = words[4]; w[5] = words[5]; w[6] = words[6]; w[7] = words[7];
+  }
+  else {
+    const char* bytes = src;
+    char* buffer = (char*)w;
+    uint i;
+    for (i = 0; i < sizeof(w); i++)
+      buffer[i] = bytes[i];
+  }
+
+  loki_store_8_int32_t(dst, w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7]);
+}
+
+void* loki_memcpy(void* dst, const void* src, size_t size) {
+  char* d = dst;
+  const char* s = src;
+
+  // Bring the destination up to a cache line boundary.
+  size_t head = (-(uint)d) & 0x1f;
+  if (head > size)
+    head = size;
+  memory_copy_small(d, s, head);
+  d += head;
+  s += head;
+  size -= head;
+
+  for ( ; size >= 32; size -= 32, d += 32, s += 32)
+    memory_copy_line(d, s);
+
+  memory_copy_small(d, s, size);
+  return dst;
+}
+
+void* loki_memmove(void* dst, const void* src, size_t size) {
+  // Copying forwards is safe unless the destination starts inside the source.
+  if ((uint)dst - (uint)src >= size)
+    return loki_memcpy(dst, src, size);
+  else if (dst == src)
+    return dst;
+
+  char* d = (char*)dst + size;
+  const char* s = (const char*)src + size;
+
+  // Bring the end of the destination down to a cache line boundary.
+  size_t tail = (uint)d & 0x1f;
+  if (tail > size)
+    tail = size;
+  memory_copy_small_backward(d, s, tail);
+  d -= tail;
+  s -= tail;
+  size -= tail;
+
+  for ( ; size >= 32; size -= 32) {
+    d -= 32;
+    s -= 32;
+    memory_copy_line(d, s);
+  }
+
+  memory_copy_small_backward(d, s, size);
+  return dst;
+}
+
+void* loki_memset(void* dst, int value, size_t size) {
+  unsigned char* d = dst;
+  unsigned char byte = value;
+
+  for ( ; size > 0 && ((uint)d & 0x3) != 0; size--)
+    *d++ = byte;
+
+  // Whole lines are set with a single operation each.
+  size_t words = size / sizeof(int);
+  if (words > 0)
+    loki_channel_memset_words(1, d, byte * 0x01010101, words);
+  d += words * sizeof(int);
+  size -= words * sizeof(int);
+
+  for ( ; size > 0; size--)
+    *d++ = byte;
+
+  return dst;
+}
+
+void* loki_calloc (size_t num, size_t size) {
+  void* ptr = loki_malloc(num*size);
+  loki_memset(ptr, 0, num*size);
+  return ptr;
+}
+
+void* loki_realloc (void* ptr, size_t size) {
+  if (size == 0) {
+    loki_free(ptr);
+    return NULL;
+  }
+  else if (ptr == NULL)
+    return loki_malloc(size);
+
+  // The allocator records the size of each block in a header just before it,
+  // so there is no need to move a block which is already big enough.
+  if (size <= malloc_usable_size(ptr))
+    return ptr;
+
+  // Otherwise, move the block. newlib's realloc may return a block which is
+  // not line-aligned, so go through loki_malloc instead. Only the old block's
+  // usable bytes are copied: its chunk need not end on a line boundary.
+  const size_t current = malloc_usable_size(ptr);
+  void* newPtr = loki_malloc(size);
+  if (newPtr == NULL)
+    return NULL;
 
+  loki_memcpy(newPtr, ptr, current);
+  loki_free(ptr);
+  return newPtr;
 }
 
-void dd_pipeline_stage(const dd_pipeline_config* config, const int stage) {
 
-  const int have_successor = (stage < config->cores - 1);
+//============================================================================//
+// Placement
+//
+//   Only core 0 of the first tile touches the placement table, so it needs no
+//   synchronisation. Each redirected entry is identified by the L2 tile it
+//   points at and the original directory bits it restores.
+//============================================================================//
 
-  // Address to connect to. Most cores connect to the next stage in the pipeline
-  // so they can tell when it is safe to begin the next loop iteration. The
-  // final core, however, tells the first core when all work has finished.
-  int next_addr;
-  if (have_successor)
-    next_addr = loki_mcast_address(single_core_bitmask(stage+1), 3, false);
-  else
-    next_addr = loki_mcast_address(single_core_bitmask(0), 3, false);
+static struct {
+  loki_placement_config config;
+  uint16_t              used;  // Entries already redirected.
+  tile_id_t             tile[LOKI_MEMORY_DIRECTORY_SIZE];
+  unsigned char         segment[LOKI_MEMORY_DIRECTORY_SIZE];
+} placement;
 
-  // Make connection.
-  channel_t c8 = channel_map_swap(8, next_addr);
+static inline uint placement_segment(const void* address) {
+  return ((uint)address >> placement.config.mask_index)
+       & (LOKI_MEMORY_DIRECTORY_SIZE - 1);
+}
 
-  // If there is work to do before the pipeline starts, do it now.
-  if (config->initialise && config->initialise[stage])
-    config->initialise[stage]();
+// Replace the directory bits of an address.
+static inline void* placement_rebase(const void* address, const uint segment) {
+  const uint mask = (LOKI_MEMORY_DIRECTORY_SIZE - 1) << placement.config.mask_index;
+  return (void*)(((uint)address & ~mask) | (segment << placement.config.mask_index));
+}
 
-  dd_pipeline_func my_func = config->stage_tasks[stage];
+// Executed by core 0 of each other tile: receive one directory update.
+static void placement_update_remote(void) {
+  void* address = (void*)loki_receive(3);
+  int value = loki_receive(3);
+  loki_channel_update_directory_entry(1, address, value);
+}
 
-  // Stage 0 is in charge of supplying the data to the pipeline, so it should
-  // know how much there is and how many iterations to perform.
-  if (stage == 0) {
-    int arg = 0;
-    while (1) {
-      int result = my_func(arg);
-      if (result == config->end_of_stream_token) {
-        if (have_successor)
-          loki_send(8, result);
-        break;
-      }
-      arg++;
+// Point `entry` at `tile` on every tile which may access placed data.
+static void placement_redirect(const uint entry, const tile_id_t tile,
+                               const uint segment) {
+  loki_memory_directory_entry_t value = {
+    .next_tile        = tile,
+    .replacement_bits = segment,
+    .scratchpad       = false
+  };
+  void* address = (void*)(entry << placement.config.mask_index);
+  const int encoded = loki_memory_directory_entry_to_int(value);
+
+  uint t;
+  for (t = 0; t < placement.config.tiles; t++) {
+    const tile_id_t target = int2tile(t);
+    if (placement.config.l2_tiles & (1 << t))
+      continue;
+
+    if (target == get_tile_id())
+      loki_memory_directory_l1_entry_update(address, value);
+    else {
+      remote_stream_start(target, &placement_update_remote);
+      loki_send(2, (int)address);
+      loki_send(2, encoded);
     }
   }
-  // All other cores enter an infinite loop, working with the data they receive
-  // for as long as it arrives. At some point one core must call the
-  // end_parallel_section function.
-  else {
-    while (1) {
-      // Receive an argument from the previous core in the pipeline. (Assuming
-      // there is only one argument - more can be passed manually, however.)
-      int arg;
-      arg = loki_receive(3);
+}
 
-      if (arg == config->end_of_stream_token) {
-        if (have_successor)
-          loki_send(8, arg);
-        break;
-      }
+void loki_placement_init(const loki_placement_config* config) {
+  assert(get_tile_id() == int2tile(0) && get_core_id() == 0);
+  assert(config->mask_index >= 5);  // At least a cache line.
+  assert(config->mask_index <= 32 - LOKI_MEMORY_DIRECTORY_SIZE_LOG2);
 
-      // Execute this iteration.
-      int result = my_func(arg);
+  placement.config = *config;
+  placement.used = 0;
+}
 
-      // If there is a subsequent core in the pipeline, send it an argument to
-      // work on.
-      if (have_successor)
-        loki_send(8, result);
-    }
+void* loki_place_range(void* ptr, size_t len, tile_id_t tile) {
+  assert(get_tile_id() == int2tile(0) && get_core_id() == 0);
+  assert(len > 0);
+  assert(((uint)ptr >> placement.config.mask_index)
+      == (((uint)ptr + len - 1) >> placement.config.mask_index));
+
+  const uint segment = placement_segment(ptr);
+
+  uint entry;
+  for (entry = 0; entry < LOKI_MEMORY_DIRECTORY_SIZE; entry++)
+    if ((placement.used & (1 << entry)) && placement.tile[entry] == tile
+        && placement.segment[entry] == segment)
+      break;
+
+  if (entry == LOKI_MEMORY_DIRECTORY_SIZE) {
+    const uint free = placement.config.entries & ~placement.used;
+    assert(free != 0 && "no directory entries left for placement");
+
+    entry = __builtin_ctz(free);
+    placement.used |= 1 << entry;
+    placement.tile[entry] = tile;
+    placement.segment[entry] = segment;
+    placement_redirect(entry, tile, segment);
   }
 
-  channel_map_restore(8, c8);
-
-  // Release any resources when the pipeline has finished.
-  if (config->tidy && config->tidy[stage])
-    config->tidy[stage]();
+  // Any copies under the original address would not be seen through the
+  // alias.
+  loki_channel_flush_data(1, ptr, len);
+  loki_channel_invalidate_data(1, ptr, len);
 
-  // Signal that the pipeline has finished (assumes that no one has a long tidy
-  // function).
-  if (!have_successor)
-    end_parallel_section();
+  return placement_rebase(ptr, entry);
+}
 
+// Start of the data in a block from loki_malloc, after a word pointing back to
+// the block.
+static inline char* placement_data(char* block) {
+  return (char*)loki_round_up_cache_line((int)(block + sizeof(void*)));
 }
 
-void dd_pipeline_loop(const dd_pipeline_config* config) {
+void* loki_alloc_on_tile(size_t size, tile_id_t tile) {
+  const uint block_size = 1u << placement.config.mask_index;
+  assert(size > 0 && size <= block_size);
 
-  if (config->cores > 1) {
-    // Tell all cores to start executing the loop.
-    const int bitmask = all_cores_except_0(config->cores);
-    const channel_t ipk_fifo = loki_mcast_address(bitmask, 0, false);
-    const channel_t data_input = loki_mcast_address(bitmask, 3, false);
-    set_channel_map(2, ipk_fifo);
-    set_channel_map(3, data_input);
+  char* block = loki_malloc(size + 32);
+  if (block == NULL)
+    return NULL;
+  char* data = placement_data(block);
+
+  // If the data straddles two directory blocks, make room to start it at the
+  // boundary instead.
+  if (placement_segment(data) != placement_segment(data + size - 1)) {
+    loki_free(block);
+    block = loki_malloc(2 * size + 32);
+    if (block == NULL)
+      return NULL;
+    data = placement_data(block);
+
+    if (placement_segment(data) != placement_segment(data + size - 1))
+      data = (char*)(((uint)data + size - 1) & ~(block_size - 1));
+  }
 
-    loki_send(3, (int)config);
+  ((char**)data)[-1] = block;
+  return loki_place_range(data, size, tile);
+}
 
-    asm (
-      "fetchr 0f\n"
-      "rmtexecute -> 2\n"           // begin remote execution
-      "addu r13, r3, r0\n"          // receive pointer to configuration info
-      "cregrdi r11, 1\n"            // get core id, and put into r14
-      "andi r14, r11, 0x7\n"        // get core id, and put into r14
-      "lli r10, %lo(loki_sleep)\n"  // set return address - sleep when finished
-      "lui r10, %hi(loki_sleep)\n"  // set return address - sleep when finished
-      "lli r24, %lo(dd_pipeline_stage)\n"
-      "lui r24, %hi(dd_pipeline_stage)\n"
-      "fetch.eop r24\n"             // fetch the pipeline stage's task
-      "0:\n"
-    );
+tile_id_t loki_nearest_l2(tile_id_t user) {
+  assert(placement.config.l2_tiles != 0);
+
+  tile_id_t nearest = 0;
+  uint best = ~0u;
+  uint t;
+  for (t = 0; t < COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS; t++) {
+    if (!(placement.config.l2_tiles & (1 << t)))
+      continue;
+
+    const tile_id_t candidate = int2tile(t);
+    const uint distance = abs((int)(candidate >> 3) - (int)(user >> 3))
+                        + abs((int)(candidate & 7) - (int)(user & 7));
+    if (distance < best) {
+      best = distance;
+      nearest = candidate;
+    }
   }
 
-  // Also start this core.
-  dd_pipeline_stage(config, 0);
+  return nearest;
+}
 
+void* loki_alloc_near(size_t size, tile_id_t user) {
+  return loki_alloc_on_tile(size, loki_nearest_l2(user));
+}
 
-  if (config->cores > 1) {
-    // Wait for the rest of the pipeline to finish before continuing. Would like
-    // to remove this stall, but there are issues if we start sending
-    // instructions to FIFOs when other cores are still doing work.
-    wait_end_parallel_section();
-  }
+void loki_free_placed(void* alias) {
+  assert(get_tile_id() == int2tile(0) && get_core_id() == 0);
+
+  const uint entry = placement_segment(alias);
+  assert(placement.used & (1 << entry));
 
+  char* data = placement_rebase(alias, placement.segment[entry]);
+  loki_free(((char**)data)[-1]);
 }
 
 
 //============================================================================//
-// Dataflow
+// Task pool
 //
-//   Each core repeatedly executes a single instruction packet, receiving data
-//   over the network and sending results on to one or more cores.
+//   Cores wait in a receive loop on CH_REGISTER_3 for tasks. Each task is sent
+//   as a function pointer, a future pointer, an argument size and the
+//   arguments themselves. Memory is coherent within a tile, so free cores are
+//   tracked with a bitmask updated by load-and-add.
 //============================================================================//
 
-void start_dataflow(const dataflow_config* config) {
+// State of one tile's task pool. Fills a whole cache line so that tiles never
+// write back over each other's state.
+static struct {
+  volatile uint idle;       // Bitmask of cores waiting for a task
+  uint          members;    // Bitmask of all cores in the pool
+  uint          padding[6];
+} task_pools[COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS]
+    __attribute__((aligned(32)));
 
-  // Send each core the function it is to execute.
-  int core;
-  for (core = 1; core < config->cores; core++)
-    loki_remote_execute(get_tile_id(), core, config->core_tasks[core], NULL, 0);
+// Loop executed by each core in the pool until it receives a NULL function.
+static void task_pool_worker(void) {
+  const uint bit = single_core_bitmask(get_core_id());
+  volatile uint *idle = &task_pools[tile2int(get_tile_id())].idle;
 
-  // Once all other cores have been set up, this core can join in.
-  config->core_tasks[0]();
+  while (1) {
+    task_func func = (task_func)loki_receive(3);
+    if (func == NULL)
+      break;
 
-  // After this core has finished its work, wait for the dataflow network to
-  // drain, then kill all cores.
-  wait_end_parallel_section();
+    loki_future *future = (loki_future*)loki_receive(3);
+    uint words = loki_receive(3);
 
-  const int bitmask = all_cores_except_0(config->cores);
-  const int ipk_fifos = loki_mcast_address(bitmask, 0, false);
-  set_channel_map(2, ipk_fifos);
-  loki_send_interrupt(2);
+    int args[words > 0 ? words : 1];
+    uint i;
+    for (i = 0; i < words; i++)
+      args[i] = loki_receive(3);
 
-  // The dataflow macro stores the address of any tidy-up code which needs to
-  // be executed when dataflow has finished. Tell the core to fetch this now.
-  asm (
+    int result = func(args);
+
+    if (future != NULL) {
+      future->value = result;
+      barrier();
+      future->ready = 1;
+    }
+
+    // Tell the dispatcher that this core is free again.
+    loki_channel_load_and_add(1, (void*)idle, bit);
+    loki_receive(2);
+  }
+}
+
+void loki_task_pool_start(const uint cores) {
+  assert(get_core_id() == 0);
+  assert(cores > 1 && cores <= CORES_PER_TILE);
+
+  const uint members = all_cores_except_0(cores);
+  task_pools[tile2int(get_tile_id())].members = members;
+  task_pools[tile2int(get_tile_id())].idle = members;
+  barrier();
+
+  set_channel_map(2, loki_mcast_address(members, 3, false));
+  loki_send(2, (int)&loki_sleep);       // send function pointers
+  loki_send(2, (int)&task_pool_worker);
+
+  set_channel_map(2, loki_mcast_address(members, 0, false));
+  asm volatile (
     "fetchr 0f\n"
-    "rmtexecute -> 2\n"
-    "fetch.eop r24\n"
+    "rmtexecute -> 2\n"         // begin remote execution
+    "addu r10, r3, r0\n"        // set return address
+    "fetch.eop r3\n"            // fetch function to execute
     "0:\n"
+    // No clobbers because this is all executed remotely.
   );
+}
+
+void loki_task_pool_stop(void) {
+  const uint members = task_pools[tile2int(get_tile_id())].members;
+  assert(get_core_id() == 0 && members != 0);
+
+  // Wait for all tasks to finish.
+  while (task_pools[tile2int(get_tile_id())].idle != members)
+    ;
+
+  set_channel_map(2, loki_mcast_address(members, 3, false));
+  loki_send(2, (int)NULL);
+
+  task_pools[tile2int(get_tile_id())].members = 0;
+}
+
+void loki_task_dispatch(task_func func, const void* args, size_t arg_size,
+                        loki_future* future) {
+  volatile uint *idle = &task_pools[tile2int(get_tile_id())].idle;
+  assert(get_core_id() == 0);
+  assert(task_pools[tile2int(get_tile_id())].members != 0);
 
+  LOKI_PROF_BEGIN(LOKI_PROF_DISPATCH);
+
+  // Wait for a free core, then claim it. Only this core claims cores, so the
+  // bit cannot be taken by anyone else in the meantime.
+  uint free_cores;
+  do {
+    free_cores = *idle;
+  } while (free_cores == 0);
+
+  const uint core = __builtin_ctz(free_cores);
+  loki_channel_load_and_add(1, (void*)idle, -(int)single_core_bitmask(core));
+  loki_receive(2);
+
+  if (future != NULL)
+    future->ready = 0;
+
+  const uint words = (arg_size + 3) / 4;
+  const int *data = args;
+
+  set_channel_map(2, loki_mcast_address(single_core_bitmask(core), 3, false));
+  loki_send(2, (int)func);
+  loki_send(2, (int)future);
+  loki_send(2, words);
+
+  uint i;
+  for (i = 0; i < words; i++)
+    loki_send(2, data[i]);
+
+  LOKI_PROF_END(LOKI_PROF_DISPATCH);
 }
 
 
 //============================================================================//
-// Memory
+// Channel map table
+//
+//   Each core keeps its own record of which entries it has handed out. A
+//   cached connection occupies an entry, but doesn't count as allocated: it
+//   can be evicted whenever nobody is using it.
 //============================================================================//
 
-extern void* __heap_ptr;
+channel_map_state channel_map_states[CORES_PER_TILE * COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS];
 
-void loki_free(void* ptr) {
-  // The standard free does what we want here.
-  free(ptr);
+// Disconnect a cached connection and give its entry back.
+static void channel_map_evict(channel_map_state* state, const int id) {
+  assert(state->users[id] == 0);
+  loki_disconnect(id);
+  channel_map_restore(id, state->saved[id]);
+  state->connected &= ~(1 << id);
 }
 
-// Round val up to the nearest multiple of the cache line size.
-static inline int loki_round_up_cache_line(int val) {
-  if (val & 0x1F)
-    return (val & ~0x1F) + 32;  // Clear offset, then add a whole line.
-  else
-    return val;
+// Find an entry which is neither allocated nor connected, evicting an idle
+// connection if there is none.
+static int channel_map_find_free(channel_map_state* state) {
+  const uint available = CHANNEL_MAP_MANAGED & ~state->allocated
+                                             & ~state->connected;
+
+  // Prefer entries which no pattern reserves, so that holding one across a
+  // call to a pattern is safe.
+  const uint unclaimed = available & ~CHANNEL_MAP_PATTERN_ENTRIES;
+  if (unclaimed != 0)
+    return 31 - __builtin_clz(unclaimed);
+  if (available != 0)
+    return 31 - __builtin_clz(available);
+
+  // Take idle connections in turn, so a frequently used one is not always the
+  // first to go.
+  int i;
+  for (i = 0; i < CHANNEL_MAP_ENTRIES; i++) {
+    const int id = (state->victim + i) % CHANNEL_MAP_ENTRIES;
+    if ((state->connected & (1 << id)) && state->users[id] == 0) {
+      state->victim = id + 1;
+      channel_map_evict(state, id);
+      return id;
+    }
+  }
+
+  assert(false && "no free channel map table entries");
+  return -1;
 }
 
-void* loki_malloc(size_t size) {
-  if (tile2int(get_tile_id()) != 0) {
-    printf("Warning: calling malloc on tile %d is unsafe!\n",
-           tile2int(get_tile_id()));
+int channel_map_alloc(void) {
+  channel_map_state* state = channel_map_this_core();
+  const int id = channel_map_find_free(state);
+
+  state->allocated |= 1 << id;
+  state->saved[id] = channel_map_save(id);
+  return id;
+}
+
+void channel_map_reserve(int id) {
+  channel_map_state* state = channel_map_this_core();
+  assert((CHANNEL_MAP_MANAGED & (1 << id)) && !(state->allocated & (1 << id)));
+
+  if (state->connected & (1 << id))
+    channel_map_evict(state, id);
+
+  state->allocated |= 1 << id;
+  state->saved[id] = channel_map_save(id);
+}
+
+void channel_map_free(int id) {
+  channel_map_state* state = channel_map_this_core();
+  assert(state->allocated & (1 << id));
+
+  channel_map_restore(id, state->saved[id]);
+  state->allocated &= ~(1 << id);
+}
+
+int channel_map_connect_new(channel_t address) {
+  channel_map_state* state = channel_map_this_core();
+  const int id = channel_map_find_free(state);
+
+  state->connected |= 1 << id;
+  state->users[id] = 1;
+  state->destination[id] = address;
+  state->saved[id] = channel_map_swap(id, address);
+
+  loki_connect_async_wait(id);
+
+  return id;
+}
+
+void channel_map_flush_connections(void) {
+  channel_map_state* state = channel_map_this_core();
+
+  uint connected = state->connected;
+  while (connected != 0) {
+    const int id = __builtin_ctz(connected);
+    if (state->users[id] == 0)
+      channel_map_evict(state, id);
+    connected &= connected - 1;
   }
+}
 
-  // Round the heap pointer up to the nearest cache line boundary.
-  __heap_ptr = (void*)loki_round_up_cache_line((int)__heap_ptr);
 
-  // Round up size so we allocate a whole number of cache lines.
-  size_t newSize = loki_round_up_cache_line(size);
+//============================================================================//
+// Profiling
+//
+//   Each core accumulates its own counters, which are only gathered into one
+//   place when a report is requested.
+//============================================================================//
 
-  // Normal malloc.
-  return malloc(newSize);
+loki_prof_core loki_prof_cores[CORES_PER_TILE * COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS];
+
+static const char* prof_names[LOKI_PROF_IDS] = {
+  [LOKI_PROF_LAUNCH]   = "launch",
+  [LOKI_PROF_BARRIER]  = "barrier",
+  [LOKI_PROF_REDUCE]   = "reduce",
+  [LOKI_PROF_DISPATCH] = "dispatch"
+};
+
+static inline loki_prof_core* prof_this_core(void) {
+  return &loki_prof_cores[tile2int(get_tile_id()) * CORES_PER_TILE + get_core_id()];
 }
 
-void* loki_calloc (size_t num, size_t size) {
-  void* ptr = loki_malloc(num*size);
-  memset(ptr, 0, num*size);
-  return ptr;
+void loki_prof_name(uint id, const char* name) {
+  assert(id < LOKI_PROF_IDS);
+  prof_names[id] = name;
 }
 
-void* loki_realloc (void* ptr, size_t size) {
-  if (size == 0) {
-    loki_free(ptr);
-    return NULL;
+void loki_prof_reset(void) {
+  memset(prof_this_core(), 0, sizeof(loki_prof_core));
+}
+
+// Bytes of a per-core block published at a time.
+#define PUBLISH_CHUNK 1024
+
+// Make a block of per-core data visible to core 0 of the first tile. Cores on
+// that tile share its L1, so only other tiles need to send the data to main
+// memory, and wait until it has arrived.
+static void publish_core_block(void* block, size_t size) {
+  if (get_tile_id() == int2tile(0))
+    return;
+
+  uint32_t bitmap[LOKI_REGION_BITMAP_WORDS(PUBLISH_CHUNK)];
+  loki_region region;
+  size_t offset;
+
+  for (offset = 0; offset < size; offset += PUBLISH_CHUNK) {
+    const size_t remaining = size - offset;
+    loki_region_init(&region, (char*)block + offset,
+                     (remaining < PUBLISH_CHUNK) ? remaining : PUBLISH_CHUNK,
+                     bitmap);
+    loki_region_mark_all(&region);
+    loki_region_publish(&region);
   }
-  else {
-    // Would ideally like to avoid allocation if the requested size is less than
-    // the current size, but we don't have the current size.
-    void* newPtr = loki_malloc(size);
+}
+
+// Executed by every core being reported on.
+static void prof_publish(const void* unused) {
+  publish_core_block(prof_this_core(), sizeof(loki_prof_core));
+}
 
-    if (ptr != NULL) {
-      // This is likely to copy too much, but again, we don't know how much data
-      // is in the current allocation.
-      memcpy(newPtr, ptr, size);
-      loki_free(ptr);
+void loki_prof_report(uint cores) {
+  assert(get_tile_id() == int2tile(0) && get_core_id() == 0);
+  assert(cores >= 1 && cores <= CORES_PER_TILE * COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS);
+
+  distributed_func config = {
+    .cores = cores,
+    .func = &prof_publish,
+    .data = NULL,
+    .data_size = 0
+  };
+  loki_execution handle = loki_execute_async(&config);
+  loki_execute_join(&handle);
+
+  // Drop any copies of other tiles' counters left over from earlier reports.
+  if (cores > CORES_PER_TILE)
+    loki_channel_invalidate_data(1, &loki_prof_cores[CORES_PER_TILE],
+                                 (cores - CORES_PER_TILE) * sizeof(loki_prof_core));
+
+  printf("%-12s %10s %12s %12s %10s %12s\n", "region", "calls", "cycles",
+         "instructions", "cyc/call", "max cycles");
+
+  uint id;
+  for (id = 0; id < LOKI_PROF_IDS; id++) {
+    uint calls = 0, cycles = 0, instructions = 0, max_cycles = 0;
+
+    uint core;
+    for (core = 0; core < cores; core++) {
+      const loki_prof_counter* counter = &loki_prof_cores[core].counters[id];
+      calls += counter->calls;
+      cycles += counter->cycles;
+      instructions += counter->instructions;
+      if (counter->cycles > max_cycles)
+        max_cycles = counter->cycles;
     }
 
-    return newPtr;
+    if (calls == 0)
+      continue;
+
+    if (prof_names[id] != NULL)
+      printf("%-12s", prof_names[id]);
+    else
+      printf("region %-5u", id);
+
+    printf(" %10u %12u %12u %10u %12u\n", calls, cycles, instructions,
+           cycles / calls, max_cycles);
+  }
+}
+
+
+//============================================================================//
+// Tracing
+//
+//   Each core records events in its own ring buffer, which are only gathered
+//   into one place when a dump is requested.
+//============================================================================//
+
+loki_trace_core loki_trace_cores[CORES_PER_TILE * COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS];
+
+static inline loki_trace_core* trace_this_core(void) {
+  return &loki_trace_cores[tile2int(get_tile_id()) * CORES_PER_TILE + get_core_id()];
+}
+
+void loki_trace_reset(void) {
+  trace_this_core()->recorded = 0;
+}
+
+// Executed by every core being dumped.
+static void trace_publish(const void* unused) {
+  publish_core_block(trace_this_core(), sizeof(loki_trace_core));
+}
+
+void loki_trace_dump(uint cores) {
+  assert(get_tile_id() == int2tile(0) && get_core_id() == 0);
+  assert(cores >= 1 && cores <= CORES_PER_TILE * COMPUTE_TILE_ROWS * COMPUTE_TILE_COLUMNS);
+
+  distributed_func config = {
+    .cores = cores,
+    .func = &trace_publish,
+    .data = NULL,
+    .data_size = 0
+  };
+  loki_execution handle = loki_execute_async(&config);
+  loki_execute_join(&handle);
+
+  // Drop any copies of other tiles' buffers left over from earlier dumps.
+  if (cores > CORES_PER_TILE)
+    loki_channel_invalidate_data(1, &loki_trace_cores[CORES_PER_TILE],
+                                 (cores - CORES_PER_TILE) * sizeof(loki_trace_core));
+
+  printf("tile,core,cycle,event,arg\n");
+
+  uint core;
+  for (core = 0; core < cores; core++) {
+    const loki_trace_core* trace = &loki_trace_cores[core];
+    const uint recorded = trace->recorded;
+    uint n = (recorded > LOKI_TRACE_EVENTS) ? recorded - LOKI_TRACE_EVENTS : 0;
+
+    for ( ; n < recorded; n++) {
+      const loki_trace_entry* entry = &trace->entries[n % LOKI_TRACE_EVENTS];
+      const int arg = (int)(entry->event << 8) >> 8;
+      printf("%u,%u,%u,%u,%d\n", core / CORES_PER_TILE, core % CORES_PER_TILE,
+             entry->cycle, entry->event >> 24, arg);
+    }
   }
 }
 